@@ -0,0 +1,17 @@
+#include "BlurKernel.h"
+
+namespace BlurKernel {
+
+    // Evaluated by the compiler
+    static constexpr Kernel commonKernels[] = { Compute(8), Compute(16), Compute(24), Compute(32), Compute(48), Compute(72) };
+
+    Kernel Build(i32 radius)
+    {
+        for (const Kernel& kernel : commonKernels)
+            if (kernel.radius == radius)
+                return kernel;
+
+        return Compute(radius);
+    }
+
+}
@@ -0,0 +1,70 @@
+#ifndef BLUR_KERNEL
+#define BLUR_KERNEL
+
+#include "platform.h"
+
+// Must match MAX_RADIUS of BLUR and BLOOM_BLUR in shaders.glsl
+#define BLUR_KERNEL_MAX_RADIUS 72
+
+// The center and one tap per pair of texels on each side
+#define BLUR_KERNEL_MAX_TAPS (BLUR_KERNEL_MAX_RADIUS / 2 + 1)
+
+namespace BlurKernel
+{
+	// One side of the symmetric bloom blur kernel
+	struct Kernel
+	{
+		i32   radius;
+
+		// Weight of the texel i away, normalized over both sides
+		float weights[BLUR_KERNEL_MAX_RADIUS + 1];
+
+		// Texels 2i - 1 and 2i folded into one bilinear fetch at the offset weighting them
+		// right, tap 0 is the center alone
+		u32   tapCount;
+		float tapOffsets[BLUR_KERNEL_MAX_TAPS];
+		float tapWeights[BLUR_KERNEL_MAX_TAPS];
+	};
+
+	constexpr float Smoothstep(float edge0, float edge1, float x)
+	{
+		float t = (x - edge0) / (edge1 - edge0);
+		t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+		return t * t * (3.0f - 2.0f * t);
+	}
+
+	// Smoothstep falloff reaching 0 at the radius, constexpr so the common radii are tables
+	constexpr Kernel Compute(i32 radius)
+	{
+		Kernel kernel = {};
+		radius = radius < 1 ? 1 : (radius > BLUR_KERNEL_MAX_RADIUS ? BLUR_KERNEL_MAX_RADIUS : radius);
+		kernel.radius = radius;
+
+		float sum = 0.0f;
+		for (i32 i = 0; i <= radius; ++i) {
+			kernel.weights[i] = Smoothstep(0.0f, (float)radius, (float)(radius - i));
+			sum += i == 0 ? kernel.weights[i] : 2.0f * kernel.weights[i];
+		}
+		for (i32 i = 0; i <= radius; ++i)
+			kernel.weights[i] /= sum;
+
+		kernel.tapOffsets[0] = 0.0f;
+		kernel.tapWeights[0] = kernel.weights[0];
+		kernel.tapCount = 1;
+
+		// The texel at the radius weighs nothing and is left out
+		for (i32 i = 1; i < radius; i += 2) {
+			float w0 = kernel.weights[i];
+			float w1 = kernel.weights[i + 1];
+			kernel.tapOffsets[kernel.tapCount] = (i * w0 + (i + 1) * w1) / (w0 + w1);
+			kernel.tapWeights[kernel.tapCount] = w0 + w1;
+			kernel.tapCount++;
+		}
+		return kernel;
+	}
+
+	// From the tables when the radius is a common one
+	Kernel Build(i32 radius);
+}
+
+#endif // !BLUR_KERNEL
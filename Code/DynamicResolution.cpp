@@ -0,0 +1,105 @@
+#include "DynamicResolution.h"
+
+// Grows only while the frame fits in this fraction of the budget, so it does not bounce back
+#define DYNAMIC_RESOLUTION_RAISE_THRESHOLD 0.75f
+
+// Aim a little under the budget when lowering
+#define DYNAMIC_RESOLUTION_LOWER_TARGET 0.9f
+
+namespace DynamicResolution {
+
+    void Init(Controller& controller)
+    {
+        glGenQueries(DYNAMIC_RESOLUTION_TIMER_COUNT, controller.queries);
+        for (u32 i = 0; i < DYNAMIC_RESOLUTION_TIMER_COUNT; ++i)
+            controller.queryPending[i] = false;
+        controller.queryHead = 0;
+        controller.queryActive = false;
+    }
+
+    void BeginFrame(Controller& controller)
+    {
+        // Every timer still waiting for its result, skip the measure this frame
+        if (controller.queryPending[controller.queryHead])
+            return;
+
+        glBeginQuery(GL_TIME_ELAPSED, controller.queries[controller.queryHead]);
+        controller.queryActive = true;
+    }
+
+    void EndFrame(Controller& controller)
+    {
+        if (!controller.queryActive)
+            return;
+
+        glEndQuery(GL_TIME_ELAPSED);
+        controller.queryActive = false;
+        controller.queryPending[controller.queryHead] = true;
+        controller.queryHead = (controller.queryHead + 1) % DYNAMIC_RESOLUTION_TIMER_COUNT;
+    }
+
+    void Update(Controller& controller)
+    {
+        controller.framesSinceChange++;
+
+        // Oldest first, stop at the first one still running
+        for (u32 i = 0; i < DYNAMIC_RESOLUTION_TIMER_COUNT; ++i)
+        {
+            u32 query = (controller.queryHead + i) % DYNAMIC_RESOLUTION_TIMER_COUNT;
+            if (!controller.queryPending[query])
+                continue;
+
+            GLuint available = 0;
+            glGetQueryObjectuiv(controller.queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(controller.queries[query], GL_QUERY_RESULT, &elapsed);
+            controller.queryPending[query] = false;
+
+            controller.measuredMs = (float)(elapsed / 1.0e6);
+
+            // The timers queued before the last change still measure the old scale
+            if (controller.framesSinceChange > DYNAMIC_RESOLUTION_TIMER_COUNT)
+                controller.smoothedMs = controller.smoothedMs == 0.0f ? controller.measuredMs
+                    : glm::mix(controller.smoothedMs, controller.measuredMs, 0.2f);
+        }
+
+        if (!controller.enabled)
+        {
+            controller.scale = controller.maxScale;
+            return;
+        }
+
+        // Nothing measured at the current scale yet
+        if (controller.smoothedMs <= 0.0f)
+            return;
+
+        float scale = controller.scale;
+        if (controller.smoothedMs > controller.targetMs)
+        {
+            // The cost mostly follows the pixel count, the square of the scale
+            float estimate = scale * sqrtf(controller.targetMs * DYNAMIC_RESOLUTION_LOWER_TARGET / controller.smoothedMs);
+            scale = glm::min(floorf(estimate / controller.step + 1e-3f) * controller.step, scale - controller.step);
+        }
+        else if (controller.smoothedMs < controller.targetMs * DYNAMIC_RESOLUTION_RAISE_THRESHOLD)
+        {
+            scale += controller.step;
+        }
+
+        scale = glm::clamp(scale, controller.minScale, controller.maxScale);
+        if (scale != controller.scale)
+        {
+            controller.scale = scale;
+            controller.framesSinceChange = 0;
+            controller.smoothedMs = 0.0f;
+        }
+    }
+
+    glm::ivec2 ScaledSize(const Controller& controller, glm::ivec2 size)
+    {
+        return glm::max(glm::ivec2(glm::vec2(size) * controller.scale + 0.5f), glm::ivec2(1));
+    }
+
+}
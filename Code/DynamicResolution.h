@@ -0,0 +1,48 @@
+#ifndef DYNAMIC_RESOLUTION
+#define DYNAMIC_RESOLUTION
+
+#include "platform.h"
+#include <glad/glad.h>
+
+// Timer queries in flight, results are read a few frames late so the CPU never waits
+#define DYNAMIC_RESOLUTION_TIMER_COUNT 4
+
+namespace DynamicResolution
+{
+	struct Controller
+	{
+		bool  enabled = false;
+		float targetMs = 16.0f;
+		float minScale = 0.5f;
+		float maxScale = 1.0f;
+		float step = 0.05f;
+
+		// Render scale per axis, the targets stay allocated at maxScale
+		float scale = 1.0f;
+
+		float measuredMs = 0.0f;
+		float smoothedMs = 0.0f;
+		u32   framesSinceChange = 0;
+
+		GLuint queries[DYNAMIC_RESOLUTION_TIMER_COUNT];
+		bool   queryPending[DYNAMIC_RESOLUTION_TIMER_COUNT];
+		u32    queryHead = 0;
+		bool   queryActive = false;
+	};
+
+	void  Init(Controller& controller);
+
+	// Brackets the GPU work of a frame with a GL_TIME_ELAPSED query
+	void  BeginFrame(Controller& controller);
+	void  EndFrame(Controller& controller);
+
+	// Reads the finished timers and moves the scale: straight to the estimated scale when
+	// over budget, one step up at a time when well under it. Only the frames rendered at
+	// the current scale are judged.
+	void  Update(Controller& controller);
+
+	// size * scale, at least one pixel
+	glm::ivec2 ScaledSize(const Controller& controller, glm::ivec2 size);
+}
+
+#endif // !DYNAMIC_RESOLUTION
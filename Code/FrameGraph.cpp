@@ -0,0 +1,284 @@
+#include "FrameGraph.h"
+
+#include <algorithm>
+
+#define FRAME_GRAPH_NONE 0xFFFFFFFFu
+
+namespace FrameGraph {
+
+    static GLbitfield BarrierBit(Access access)
+    {
+        switch (access)
+        {
+        case Access_Texture:      return GL_TEXTURE_FETCH_BARRIER_BIT;
+        case Access_RenderTarget: return GL_FRAMEBUFFER_BARRIER_BIT;
+        case Access_Image:        return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+        default:                  return 0;
+        }
+    }
+
+    void Reset(Graph& graph)
+    {
+        graph.resources.clear();
+        graph.passes.clear();
+        graph.order.clear();
+        graph.physicalDescs.clear();
+        graph.physicalTextures.clear();
+    }
+
+    u32 CreateTexture(Graph& graph, const char* name, const RenderTargetPool::TargetDesc& desc, GLuint* binding)
+    {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resource.binding = binding;
+        resource.output = false;
+        resource.firstPass = FRAME_GRAPH_NONE;
+        resource.lastPass = 0;
+        resource.physical = FRAME_GRAPH_NONE;
+        graph.resources.push_back(resource);
+        return (u32)graph.resources.size() - 1;
+    }
+
+    void MarkOutput(Graph& graph, u32 resource)
+    {
+        graph.resources[resource].output = true;
+    }
+
+    u32 AddPass(Graph& graph, const char* name, const std::function<void()>& execute)
+    {
+        Pass pass;
+        pass.name = name;
+        pass.execute = execute;
+        pass.barriers = 0;
+        pass.culled = false;
+        graph.passes.push_back(pass);
+        return (u32)graph.passes.size() - 1;
+    }
+
+    void Read(Graph& graph, u32 pass, u32 resource, Access access)
+    {
+        graph.passes[pass].reads.push_back(ResourceUse{ resource, access });
+    }
+
+    void Write(Graph& graph, u32 pass, u32 resource, Access access)
+    {
+        graph.passes[pass].writes.push_back(ResourceUse{ resource, access });
+    }
+
+    void Compile(Graph& graph)
+    {
+        u32 passCount = (u32)graph.passes.size();
+        u32 resourceCount = (u32)graph.resources.size();
+
+        // Walk back from the outputs. Writes are not assumed to cover the whole texture, so
+        // every earlier writer of a needed texture is kept too.
+        {
+            std::vector<bool> needed(resourceCount, false);
+            for (u32 r = 0; r < resourceCount; ++r)
+                needed[r] = graph.resources[r].output;
+
+            for (u32 p = passCount; p-- > 0;)
+            {
+                Pass& pass = graph.passes[p];
+                pass.culled = true;
+                for (const ResourceUse& use : pass.writes)
+                    if (needed[use.resource])
+                        pass.culled = false;
+
+                if (!pass.culled)
+                    for (const ResourceUse& use : pass.reads)
+                        needed[use.resource] = true;
+            }
+        }
+
+        u32 keptCount = 0;
+        for (const Pass& pass : graph.passes)
+            if (!pass.culled)
+                keptCount++;
+
+        // A pass waits for the last writer of everything it uses, and a writer for the
+        // readers since the previous write
+        std::vector<std::vector<u32>> dependents(passCount);
+        std::vector<u32> dependencyCount(passCount, 0);
+        {
+            std::vector<u32> lastWriter(resourceCount, FRAME_GRAPH_NONE);
+            std::vector<std::vector<u32>> readers(resourceCount);
+
+            auto addEdge = [&](u32 from, u32 to) {
+                if (from == FRAME_GRAPH_NONE || from == to)
+                    return;
+                if (std::find(dependents[from].begin(), dependents[from].end(), to) != dependents[from].end())
+                    return;
+                dependents[from].push_back(to);
+                dependencyCount[to]++;
+            };
+
+            for (u32 p = 0; p < passCount; ++p)
+            {
+                const Pass& pass = graph.passes[p];
+                if (pass.culled)
+                    continue;
+
+                for (const ResourceUse& use : pass.reads)
+                    addEdge(lastWriter[use.resource], p);
+                for (const ResourceUse& use : pass.writes)
+                {
+                    addEdge(lastWriter[use.resource], p);
+                    for (u32 reader : readers[use.resource])
+                        addEdge(reader, p);
+                }
+
+                for (const ResourceUse& use : pass.reads)
+                    readers[use.resource].push_back(p);
+                for (const ResourceUse& use : pass.writes)
+                {
+                    lastWriter[use.resource] = p;
+                    readers[use.resource].clear();
+                }
+            }
+        }
+
+        // Topological order, the earliest declared ready pass first
+        graph.order.clear();
+        std::vector<bool> scheduled(passCount, false);
+        while (graph.order.size() < keptCount)
+        {
+            u32 next = FRAME_GRAPH_NONE;
+            for (u32 p = 0; p < passCount && next == FRAME_GRAPH_NONE; ++p)
+                if (!graph.passes[p].culled && !scheduled[p] && dependencyCount[p] == 0)
+                    next = p;
+
+            // Dependencies only point to later declarations, so this cannot happen
+            if (next == FRAME_GRAPH_NONE)
+                break;
+
+            scheduled[next] = true;
+            graph.order.push_back(next);
+            for (u32 dependent : dependents[next])
+                dependencyCount[dependent]--;
+        }
+
+        // Lifetimes in execution order, outputs live until the end of the frame
+        for (u32 i = 0; i < graph.order.size(); ++i)
+        {
+            const Pass& pass = graph.passes[graph.order[i]];
+            for (u32 k = 0; k < 2; ++k)
+            {
+                const std::vector<ResourceUse>& uses = k == 0 ? pass.reads : pass.writes;
+                for (const ResourceUse& use : uses)
+                {
+                    Resource& resource = graph.resources[use.resource];
+                    resource.firstPass = glm::min(resource.firstPass, i);
+                    resource.lastPass = glm::max(resource.lastPass, i);
+                }
+            }
+        }
+
+        // Alias the transients in order of first use: same description, lifetimes apart
+        std::vector<u32> byFirstPass;
+        for (u32 r = 0; r < resourceCount; ++r)
+        {
+            Resource& resource = graph.resources[r];
+            if (resource.firstPass == FRAME_GRAPH_NONE)
+                continue;
+            if (resource.output)
+                resource.lastPass = passCount;
+            byFirstPass.push_back(r);
+        }
+        std::stable_sort(byFirstPass.begin(), byFirstPass.end(), [&graph](u32 l, u32 r) {
+            return graph.resources[l].firstPass < graph.resources[r].firstPass;
+        });
+
+        graph.physicalDescs.clear();
+        std::vector<u32> physicalLastPass;
+        for (u32 r : byFirstPass)
+        {
+            Resource& resource = graph.resources[r];
+            for (u32 slot = 0; slot < graph.physicalDescs.size() && resource.physical == FRAME_GRAPH_NONE; ++slot)
+            {
+                if (physicalLastPass[slot] < resource.firstPass && RenderTargetPool::Matches(graph.physicalDescs[slot], resource.desc))
+                {
+                    resource.physical = slot;
+                    physicalLastPass[slot] = resource.lastPass;
+                }
+            }
+
+            if (resource.physical == FRAME_GRAPH_NONE)
+            {
+                resource.physical = (u32)graph.physicalDescs.size();
+                graph.physicalDescs.push_back(resource.desc);
+                physicalLastPass.push_back(resource.lastPass);
+            }
+        }
+
+        // Image stores are incoherent: each later kind of access needs its own barrier bit
+        std::vector<GLbitfield> pendingBarriers(resourceCount, 0);
+        for (u32 i = 0; i < graph.order.size(); ++i)
+        {
+            Pass& pass = graph.passes[graph.order[i]];
+            pass.barriers = 0;
+            for (u32 k = 0; k < 2; ++k)
+            {
+                const std::vector<ResourceUse>& uses = k == 0 ? pass.reads : pass.writes;
+                for (const ResourceUse& use : uses)
+                {
+                    GLbitfield bit = BarrierBit(use.access);
+                    pass.barriers |= pendingBarriers[use.resource] & bit;
+                    pendingBarriers[use.resource] &= ~bit;
+                }
+            }
+
+            for (const ResourceUse& use : pass.writes)
+                if (use.access == Access_Image)
+                    pendingBarriers[use.resource] = GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+        }
+    }
+
+    void Acquire(Graph& graph, RenderTargetPool::Pool& pool)
+    {
+        graph.physicalTextures.resize(graph.physicalDescs.size());
+        for (u32 slot = 0; slot < graph.physicalDescs.size(); ++slot)
+            graph.physicalTextures[slot] = RenderTargetPool::Acquire(pool, graph.physicalDescs[slot]);
+
+        for (const Resource& resource : graph.resources)
+            if (resource.binding)
+                *resource.binding = resource.physical == FRAME_GRAPH_NONE ? 0 : graph.physicalTextures[resource.physical];
+    }
+
+    void Execute(Graph& graph)
+    {
+        for (u32 p : graph.order)
+        {
+            Pass& pass = graph.passes[p];
+            if (pass.barriers != 0)
+                glMemoryBarrier(pass.barriers);
+            pass.execute();
+        }
+    }
+
+    void Release(Graph& graph, RenderTargetPool::Pool& pool)
+    {
+        for (GLuint texture : graph.physicalTextures)
+            RenderTargetPool::Release(pool, texture);
+        graph.physicalTextures.clear();
+    }
+
+    u64 GetAllocatedBytes(const Graph& graph)
+    {
+        u64 bytes = 0;
+        for (const RenderTargetPool::TargetDesc& desc : graph.physicalDescs)
+            bytes += RenderTargetPool::GetBytes(desc);
+        return bytes;
+    }
+
+    u64 GetUnaliasedBytes(const Graph& graph)
+    {
+        u64 bytes = 0;
+        for (const Resource& resource : graph.resources)
+            if (resource.physical != FRAME_GRAPH_NONE)
+                bytes += RenderTargetPool::GetBytes(resource.desc);
+        return bytes;
+    }
+
+}
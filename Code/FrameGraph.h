@@ -0,0 +1,96 @@
+#ifndef FRAME_GRAPH
+#define FRAME_GRAPH
+
+#include "platform.h"
+#include "RenderTargetPool.h"
+#include <functional>
+
+namespace FrameGraph
+{
+	// How a pass touches a texture, decides the memory barriers after image stores
+	enum Access
+	{
+		Access_Texture,
+		Access_RenderTarget,
+		Access_Image
+	};
+
+	struct ResourceUse
+	{
+		u32    resource;
+		Access access;
+	};
+
+	// Transient texture, only alive from its first to its last pass. OpenGL cannot place two
+	// textures in the same memory, so aliasing means handing the same pooled texture to
+	// transients of the same description whose lifetimes do not overlap.
+	struct Resource
+	{
+		const char*                  name;
+		RenderTargetPool::TargetDesc desc;
+
+		// Receives the texture for the frame, so the passes keep reading their App fields
+		GLuint*                      binding;
+
+		// Read after the graph ran, by the Scene window
+		bool                         output;
+
+		u32                          firstPass;
+		u32                          lastPass;
+		u32                          physical;
+	};
+
+	struct Pass
+	{
+		const char*              name;
+		std::vector<ResourceUse> reads;
+		std::vector<ResourceUse> writes;
+		std::function<void()>    execute;
+
+		// glMemoryBarrier bits issued before the pass
+		GLbitfield               barriers;
+
+		// Writes nothing an output depends on, left out of the frame
+		bool                     culled;
+	};
+
+	struct Graph
+	{
+		std::vector<Resource> resources;
+		std::vector<Pass>     passes;
+
+		// Compiled: passes in execution order and the textures behind the transients
+		std::vector<u32>                          order;
+		std::vector<RenderTargetPool::TargetDesc> physicalDescs;
+		std::vector<GLuint>                       physicalTextures;
+	};
+
+	// Forgets the passes and resources of the last frame
+	void Reset(Graph& graph);
+
+	u32  CreateTexture(Graph& graph, const char* name, const RenderTargetPool::TargetDesc& desc, GLuint* binding);
+	void MarkOutput(Graph& graph, u32 resource);
+
+	u32  AddPass(Graph& graph, const char* name, const std::function<void()>& execute);
+	void Read(Graph& graph, u32 pass, u32 resource, Access access);
+	void Write(Graph& graph, u32 pass, u32 resource, Access access);
+
+	// Culls the passes the outputs do not depend on, orders the rest after the ones writing
+	// what they use, declaration order otherwise, then works out the lifetimes, the aliasing
+	// and the barriers
+	void Compile(Graph& graph);
+
+	// Takes a texture from the pool for every physical slot and fills the bindings
+	void Acquire(Graph& graph, RenderTargetPool::Pool& pool);
+
+	void Execute(Graph& graph);
+
+	// Hands the textures back, they are acquired again in the same order next frame
+	void Release(Graph& graph, RenderTargetPool::Pool& pool);
+
+	// Bytes of the transients as allocated, and as they would be without aliasing
+	u64  GetAllocatedBytes(const Graph& graph);
+	u64  GetUnaliasedBytes(const Graph& graph);
+}
+
+#endif // !FRAME_GRAPH
@@ -0,0 +1,107 @@
+#include "IrradianceProbes.h"
+#include "JobSystem.h"
+
+#define PROBE_GRID_MAX_DIM 16
+
+namespace IrradianceProbes {
+
+    static void EvaluateBasis(const glm::vec3& d, float basis[PROBE_SH_COEFFICIENTS])
+    {
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * d.y;
+        basis[2] = 0.488603f * d.z;
+        basis[3] = 0.488603f * d.x;
+        basis[4] = 1.092548f * d.x * d.y;
+        basis[5] = 1.092548f * d.y * d.z;
+        basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+        basis[7] = 1.092548f * d.x * d.z;
+        basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+    }
+
+    // Spherical Fibonacci point, evenly spread without any randomness so probes do not flicker
+    static glm::vec3 SphereDirection(u32 i, u32 count)
+    {
+        const float goldenAngle = 2.39996323f;
+        float z = 1.0f - (2.0f * i + 1.0f) / count;
+        float r = sqrtf(glm::max(1.0f - z * z, 0.0f));
+        float phi = goldenAngle * i;
+        return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+    }
+
+    void Init(ProbeGrid& grid, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float cellSize, Lightmapper::Scene&& scene)
+    {
+        glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.001f));
+        glm::ivec3 dims = glm::ivec3(glm::ceil(extent / glm::max(cellSize, 0.001f))) + 1;
+        grid.dims = glm::uvec3(glm::clamp(dims, glm::ivec3(2), glm::ivec3(PROBE_GRID_MAX_DIM)));
+        grid.boundsMin = boundsMin;
+        grid.cellSize = extent / glm::vec3(grid.dims - 1u);
+
+        grid.coefficients.assign(GetProbeCount(grid) * PROBE_SH_COEFFICIENTS, glm::vec4(0.0f));
+        grid.nextProbe = 0;
+
+        grid.scene = std::move(scene);
+        Raytracer::Build(grid.bvh, grid.scene.positions);
+        grid.bias = grid.scene.positions.empty() ? 0.0f : glm::length(grid.bvh.nodes[0].boundsMax - grid.bvh.nodes[0].boundsMin) * 1e-4f;
+    }
+
+    u32 GetProbeCount(const ProbeGrid& grid)
+    {
+        return grid.dims.x * grid.dims.y * grid.dims.z;
+    }
+
+    void UpdateProbe(ProbeGrid& grid, u32 probe, u32 rayCount)
+    {
+        glm::uvec3 cell(probe % grid.dims.x, (probe / grid.dims.x) % grid.dims.y, probe / (grid.dims.x * grid.dims.y));
+        glm::vec3 position = grid.boundsMin + glm::vec3(cell) * grid.cellSize;
+
+        glm::vec3 sh[PROBE_SH_COEFFICIENTS] = {};
+        if (!grid.scene.positions.empty())
+        {
+            for (u32 i = 0; i < rayCount; ++i)
+            {
+                glm::vec3 direction = SphereDirection(i, rayCount);
+                glm::vec3 radiance = Lightmapper::TraceRadiance(grid.scene, grid.bvh, position, direction, grid.bias);
+
+                float basis[PROBE_SH_COEFFICIENTS];
+                EvaluateBasis(direction, basis);
+                for (u32 k = 0; k < PROBE_SH_COEFFICIENTS; ++k)
+                    sh[k] += radiance * basis[k];
+            }
+        }
+        else
+        {
+            // Nothing to hit, every ray sees the sky
+            sh[0] = grid.scene.skyColor * 0.282095f * (float)rayCount;
+        }
+
+        // Uniform sphere samples weigh 4pi / rayCount, then the cosine lobe bands pi, 2pi/3
+        // and pi/4, all divided by pi
+        const float band[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+        float weight = 4.0f * glm::pi<float>() / glm::max(rayCount, 1u);
+        for (u32 k = 0; k < PROBE_SH_COEFFICIENTS; ++k)
+        {
+            u32 l = k == 0 ? 0 : (k < 4 ? 1 : 2);
+            grid.coefficients[probe * PROBE_SH_COEFFICIENTS + k] = glm::vec4(sh[k] * weight * band[l], 0.0f);
+        }
+    }
+
+    void UpdateNext(ProbeGrid& grid, u32 count, u32 rayCount)
+    {
+        u32 probeCount = GetProbeCount(grid);
+        for (u32 i = 0; i < count && i < probeCount; ++i)
+        {
+            UpdateProbe(grid, grid.nextProbe, rayCount);
+            grid.nextProbe = (grid.nextProbe + 1) % probeCount;
+        }
+    }
+
+    void UpdateAll(ProbeGrid& grid, u32 rayCount)
+    {
+        // Each probe only writes its own coefficients
+        JobSystem::ParallelFor(GetProbeCount(grid), [&grid, rayCount](u32 probe) {
+            UpdateProbe(grid, probe, rayCount);
+        });
+        grid.nextProbe = 0;
+    }
+
+}
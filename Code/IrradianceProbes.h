@@ -0,0 +1,46 @@
+#ifndef IRRADIANCE_PROBES
+#define IRRADIANCE_PROBES
+
+#include "platform.h"
+#include "Lightmapper.h"
+
+// Second order spherical harmonics, rgb in xyz
+#define PROBE_SH_COEFFICIENTS 9
+
+namespace IrradianceProbes
+{
+	// Regular grid of probes over a box, probe x + y * dims.x + z * dims.x * dims.y
+	struct ProbeGrid
+	{
+		glm::vec3  boundsMin = glm::vec3(0.0f);
+		glm::vec3  cellSize = glm::vec3(1.0f);
+		glm::uvec3 dims = glm::uvec3(0);
+
+		// PROBE_SH_COEFFICIENTS per probe, already convolved with the cosine lobe and divided
+		// by pi, so the shaders get the diffuse light of a normal with a single dot product
+		std::vector<glm::vec4> coefficients;
+		u32                    nextProbe = 0;
+
+		// What the probes see, lights refreshed by the caller every frame
+		Lightmapper::Scene scene;
+		Raytracer::Bvh     bvh;
+		float              bias = 0.0f;
+	};
+
+	// Places about cellSize spaced probes over the box, at least two per axis and no more
+	// than PROBE_GRID_MAX_DIM, and builds the BVH of scene. Probes start black.
+	void Init(ProbeGrid& grid, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float cellSize, Lightmapper::Scene&& scene);
+
+	// Traces rayCount directions from the probe and projects what they see
+	void UpdateProbe(ProbeGrid& grid, u32 probe, u32 rayCount);
+
+	// Round robin over the grid, count probes per call
+	void UpdateNext(ProbeGrid& grid, u32 count, u32 rayCount);
+
+	// Every probe at once, on the job system
+	void UpdateAll(ProbeGrid& grid, u32 rayCount);
+
+	u32 GetProbeCount(const ProbeGrid& grid);
+}
+
+#endif // !IRRADIANCE_PROBES
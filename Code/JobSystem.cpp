@@ -0,0 +1,134 @@
+#include "JobSystem.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace JobSystem {
+
+    struct Batch
+    {
+        const std::function<void(u32)>* job;
+        u32 count;
+        u32 id;
+    };
+
+    static std::vector<std::thread> workers;
+    static std::mutex               mutex;
+    static std::condition_variable  wakeCondition;
+    static std::condition_variable  doneCondition;
+
+    // Batch parameters, only touched while holding the mutex
+    static Batch currentBatch = {};
+    static bool  quit = false;
+
+    // High 32 bits: batch id, low 32 bits: next index to claim
+    static std::atomic<u64> claim(0);
+    static std::atomic<u32> finishedCount(0);
+
+    static void RunJobs(const Batch& batch)
+    {
+        u64 current = claim.load();
+        for (;;)
+        {
+            if ((u32)(current >> 32) != batch.id || (u32)current >= batch.count)
+                break;
+
+            if (!claim.compare_exchange_weak(current, current + 1))
+                continue;
+
+            (*batch.job)((u32)current);
+
+            if (finishedCount.fetch_add(1) + 1 == batch.count)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                doneCondition.notify_all();
+            }
+            current = claim.load();
+        }
+    }
+
+    static void WorkerLoop()
+    {
+        u32 seenBatch = 0;
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] { return quit || currentBatch.id != seenBatch; });
+            if (quit)
+                return;
+            Batch batch = currentBatch;
+            seenBatch = batch.id;
+            lock.unlock();
+
+            RunJobs(batch);
+        }
+    }
+
+    void Init(u32 workerCount)
+    {
+        if (workerCount == 0)
+        {
+            u32 hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+        }
+
+        quit = false;
+        for (u32 i = 0; i < workerCount; ++i)
+            workers.push_back(std::thread(WorkerLoop));
+    }
+
+    void Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wakeCondition.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    u32 GetWorkerCount()
+    {
+        return (u32)workers.size();
+    }
+
+    void ParallelFor(u32 count, const std::function<void(u32 index)>& job)
+    {
+        if (count == 0)
+            return;
+
+        if (workers.empty() || count == 1)
+        {
+            for (u32 i = 0; i < count; ++i)
+                job(i);
+            return;
+        }
+
+        Batch batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentBatch.job = &job;
+            currentBatch.count = count;
+            currentBatch.id++;
+            if (currentBatch.id == 0)
+                currentBatch.id = 1;
+            batch = currentBatch;
+
+            finishedCount.store(0);
+            claim.store((u64)batch.id << 32);
+        }
+        wakeCondition.notify_all();
+
+        // The calling thread helps instead of idling
+        RunJobs(batch);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return finishedCount.load() == count; });
+    }
+
+}
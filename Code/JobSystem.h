@@ -0,0 +1,21 @@
+#ifndef JOB_SYSTEM
+#define JOB_SYSTEM
+
+#include "platform.h"
+#include <functional>
+
+namespace JobSystem
+{
+	// Spawns the worker threads. A workerCount of 0 uses one worker per hardware
+	// thread minus the calling thread.
+	void Init(u32 workerCount = 0);
+	void Shutdown();
+
+	u32  GetWorkerCount();
+
+	// Runs job(i) for every i in [0, count) on the workers and the calling thread,
+	// and returns once all of them have finished.
+	void ParallelFor(u32 count, const std::function<void(u32 index)>& job);
+}
+
+#endif // !JOB_SYSTEM
@@ -0,0 +1,250 @@
+#include "LightCulling.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <float.h>
+
+// Keeps the light grid small when lights are spread far apart
+#define LIGHT_GRID_MAX_CELLS 32
+
+namespace LightCulling {
+
+    void Init(ClusterGrid& grid, u32 countX, u32 countY, u32 countZ)
+    {
+        grid.countX = countX;
+        grid.countY = countY;
+        grid.countZ = countZ;
+        grid.zNear = 0.1f;
+        grid.zFar = 1.0f;
+
+        grid.clusters.resize(countX * countY * countZ);
+        grid.lightIndices.clear();
+
+        grid.sliceLights.resize(countZ);
+        for (u32 i = 0; i < countZ; ++i)
+            grid.sliceLights[i].resize(countX * countY);
+    }
+
+    static glm::ivec3 CellOf(const LightGrid& grid, const glm::vec3& position)
+    {
+        glm::ivec3 cell = glm::ivec3(glm::floor((position - grid.origin) / grid.cellSize));
+        return glm::clamp(cell, glm::ivec3(0), grid.dims - 1);
+    }
+
+    void BuildGrid(LightGrid& grid, const std::vector<glm::vec4>& packedLights, u32 firstPointLight)
+    {
+        u32 lightCount = (u32)packedLights.size() / 2;
+
+        glm::vec3 boundsMin(FLT_MAX);
+        glm::vec3 boundsMax(-FLT_MAX);
+        float radiusSum = 0.0f;
+        for (u32 i = firstPointLight; i < lightCount; ++i)
+        {
+            glm::vec4 positionRadius = packedLights[i * 2];
+            boundsMin = glm::min(boundsMin, glm::vec3(positionRadius) - positionRadius.w);
+            boundsMax = glm::max(boundsMax, glm::vec3(positionRadius) + positionRadius.w);
+            radiusSum += positionRadius.w;
+        }
+
+        if (lightCount <= firstPointLight)
+        {
+            boundsMin = glm::vec3(0.0f);
+            boundsMax = glm::vec3(1.0f);
+        }
+
+        // Cells about the size of a light, but no more than LIGHT_GRID_MAX_CELLS per axis
+        glm::vec3 extent = boundsMax - boundsMin;
+        float maxExtent = glm::max(extent.x, glm::max(extent.y, extent.z));
+        float averageRadius = lightCount > firstPointLight ? radiusSum / (lightCount - firstPointLight) : 1.0f;
+        grid.cellSize = glm::max(glm::max(averageRadius, maxExtent / LIGHT_GRID_MAX_CELLS), 0.001f);
+        grid.origin = boundsMin;
+        grid.dims = glm::clamp(glm::ivec3(glm::ceil(extent / grid.cellSize)), glm::ivec3(1), glm::ivec3(LIGHT_GRID_MAX_CELLS));
+
+        u32 cellCount = grid.dims.x * grid.dims.y * grid.dims.z;
+        grid.cellOffsets.assign(cellCount + 1, 0);
+
+        // Count, prefix sum, then fill
+        for (u32 pass = 0; pass < 2; ++pass)
+        {
+            for (u32 i = firstPointLight; i < lightCount; ++i)
+            {
+                glm::vec4 positionRadius = packedLights[i * 2];
+                if (positionRadius.w <= 0.0f)
+                    continue;
+
+                glm::ivec3 cellMin = CellOf(grid, glm::vec3(positionRadius) - positionRadius.w);
+                glm::ivec3 cellMax = CellOf(grid, glm::vec3(positionRadius) + positionRadius.w);
+                for (i32 z = cellMin.z; z <= cellMax.z; ++z)
+                    for (i32 y = cellMin.y; y <= cellMax.y; ++y)
+                        for (i32 x = cellMin.x; x <= cellMax.x; ++x)
+                        {
+                            u32 cell = x + y * grid.dims.x + z * grid.dims.x * grid.dims.y;
+                            if (pass == 0)
+                                grid.cellOffsets[cell + 1]++;
+                            else
+                                grid.cellLights[grid.cellOffsets[cell]++] = i;
+                        }
+            }
+
+            if (pass == 0)
+            {
+                for (u32 cell = 0; cell < cellCount; ++cell)
+                    grid.cellOffsets[cell + 1] += grid.cellOffsets[cell];
+                grid.cellLights.resize(grid.cellOffsets[cellCount]);
+            }
+            else
+            {
+                // The fill moved every offset to the start of the next cell
+                for (u32 cell = cellCount; cell > 0; --cell)
+                    grid.cellOffsets[cell] = grid.cellOffsets[cell - 1];
+                grid.cellOffsets[0] = 0;
+            }
+        }
+
+        grid.visited.assign(lightCount, 0);
+        grid.visitStamp = 0;
+    }
+
+    u32 GatherLights(LightGrid& grid, const std::vector<glm::vec4>& packedLights, const glm::vec3& center, float radius, u32 maxLights, u32* result)
+    {
+        if (grid.cellOffsets.empty() || grid.cellLights.empty())
+            return 0;
+
+        // Wrapped around, forget every old visit
+        if (++grid.visitStamp == 0)
+        {
+            std::fill(grid.visited.begin(), grid.visited.end(), 0);
+            grid.visitStamp = 1;
+        }
+
+        grid.candidates.clear();
+
+        glm::ivec3 cellMin = CellOf(grid, center - radius);
+        glm::ivec3 cellMax = CellOf(grid, center + radius);
+        for (i32 z = cellMin.z; z <= cellMax.z; ++z)
+            for (i32 y = cellMin.y; y <= cellMax.y; ++y)
+                for (i32 x = cellMin.x; x <= cellMax.x; ++x)
+                {
+                    u32 cell = x + y * grid.dims.x + z * grid.dims.x * grid.dims.y;
+                    for (u32 k = grid.cellOffsets[cell]; k < grid.cellOffsets[cell + 1]; ++k)
+                    {
+                        u32 lightIndex = grid.cellLights[k];
+                        if (grid.visited[lightIndex] == grid.visitStamp)
+                            continue;
+                        grid.visited[lightIndex] = grid.visitStamp;
+
+                        glm::vec4 positionRadius = packedLights[lightIndex * 2];
+                        float distance = glm::length(glm::vec3(positionRadius) - center);
+                        if (distance > radius + positionRadius.w)
+                            continue;
+
+                        // Same attenuation as the shaders
+                        glm::vec3 color = glm::vec3(packedLights[lightIndex * 2 + 1]);
+                        float closest = glm::max(distance - radius, 0.0f);
+                        float attenuation = 1.0f / (1.0f + 0.09f * closest + 0.032f * closest * closest);
+                        float score = glm::max(color.r, glm::max(color.g, color.b)) * attenuation;
+                        grid.candidates.push_back(std::make_pair(score, lightIndex));
+                    }
+                }
+
+        u32 count = glm::min((u32)grid.candidates.size(), maxLights);
+        std::partial_sort(grid.candidates.begin(), grid.candidates.begin() + count, grid.candidates.end(),
+            [](const std::pair<float, u32>& l, const std::pair<float, u32>& r) { return l.first > r.first; });
+
+        for (u32 i = 0; i < count; ++i)
+            result[i] = grid.candidates[i].second;
+        return count;
+    }
+
+    static float SliceDepth(const ClusterGrid& grid, u32 slice)
+    {
+        return grid.zNear * powf(grid.zFar / grid.zNear, (float)slice / (float)grid.countZ);
+    }
+
+    glm::vec2 DepthSliceScaleBias(const ClusterGrid& grid)
+    {
+        float logRange = logf(grid.zFar / grid.zNear);
+        return glm::vec2(grid.countZ / logRange, -(grid.countZ * logf(grid.zNear)) / logRange);
+    }
+
+    void Build(ClusterGrid& grid, const std::vector<glm::vec4>& packedLights, u32 firstPointLight,
+        const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar)
+    {
+        grid.zNear = zNear;
+        grid.zFar = zFar;
+
+        // View space spheres, shared by every slice
+        u32 lightCount = (u32)packedLights.size() / 2;
+        std::vector<glm::vec4> spheres;
+        spheres.reserve(lightCount - glm::min(firstPointLight, lightCount));
+        for (u32 i = firstPointLight; i < lightCount; ++i)
+        {
+            glm::vec4 positionRadius = packedLights[i * 2];
+            glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(positionRadius), 1.0f));
+            spheres.push_back(glm::vec4(center, positionRadius.w));
+        }
+
+        float scaleX = projection[0][0];
+        float scaleY = projection[1][1];
+
+        JobSystem::ParallelFor(grid.countZ, [&grid, &spheres, firstPointLight, scaleX, scaleY](u32 slice) {
+            std::vector<std::vector<u32>>& clusterLights = grid.sliceLights[slice];
+            for (u32 i = 0; i < clusterLights.size(); ++i)
+                clusterLights[i].clear();
+
+            float sliceNear = SliceDepth(grid, slice);
+            float sliceFar = SliceDepth(grid, slice + 1);
+
+            for (u32 i = 0; i < spheres.size(); ++i)
+            {
+                glm::vec3 center = glm::vec3(spheres[i]);
+                float radius = spheres[i].w;
+
+                // Depth range of the sphere clipped to the slice
+                float depthMin = glm::max(-center.z - radius, sliceNear);
+                float depthMax = glm::min(-center.z + radius, sliceFar);
+                if (depthMin > depthMax)
+                    continue;
+
+                // Screen rectangle of the clipped bounding box, from its corners
+                float ndcMinX = FLT_MAX, ndcMaxX = -FLT_MAX;
+                float ndcMinY = FLT_MAX, ndcMaxY = -FLT_MAX;
+                for (u32 corner = 0; corner < 4; ++corner)
+                {
+                    float depth = (corner & 1) ? depthMax : depthMin;
+                    float x = (corner & 2) ? center.x + radius : center.x - radius;
+                    float y = (corner & 2) ? center.y + radius : center.y - radius;
+                    ndcMinX = glm::min(ndcMinX, scaleX * x / depth);
+                    ndcMaxX = glm::max(ndcMaxX, scaleX * x / depth);
+                    ndcMinY = glm::min(ndcMinY, scaleY * y / depth);
+                    ndcMaxY = glm::max(ndcMaxY, scaleY * y / depth);
+                }
+                if (ndcMaxX < -1.0f || ndcMinX > 1.0f || ndcMaxY < -1.0f || ndcMinY > 1.0f)
+                    continue;
+
+                i32 tileMinX = glm::clamp((i32)floorf((ndcMinX * 0.5f + 0.5f) * grid.countX), 0, (i32)grid.countX - 1);
+                i32 tileMaxX = glm::clamp((i32)floorf((ndcMaxX * 0.5f + 0.5f) * grid.countX), 0, (i32)grid.countX - 1);
+                i32 tileMinY = glm::clamp((i32)floorf((ndcMinY * 0.5f + 0.5f) * grid.countY), 0, (i32)grid.countY - 1);
+                i32 tileMaxY = glm::clamp((i32)floorf((ndcMaxY * 0.5f + 0.5f) * grid.countY), 0, (i32)grid.countY - 1);
+
+                for (i32 y = tileMinY; y <= tileMaxY; ++y)
+                    for (i32 x = tileMinX; x <= tileMaxX; ++x)
+                        clusterLights[x + y * grid.countX].push_back(firstPointLight + i);
+            }
+        });
+
+        // Flatten into the layout the shaders index
+        grid.lightIndices.clear();
+        u32 clustersPerSlice = grid.countX * grid.countY;
+        for (u32 slice = 0; slice < grid.countZ; ++slice)
+        {
+            for (u32 i = 0; i < clustersPerSlice; ++i)
+            {
+                const std::vector<u32>& lights = grid.sliceLights[slice][i];
+                grid.clusters[slice * clustersPerSlice + i] = glm::uvec2((u32)grid.lightIndices.size(), (u32)lights.size());
+                grid.lightIndices.insert(grid.lightIndices.end(), lights.begin(), lights.end());
+            }
+        }
+    }
+
+}
@@ -0,0 +1,62 @@
+#ifndef LIGHT_CULLING
+#define LIGHT_CULLING
+
+#include "platform.h"
+
+namespace LightCulling
+{
+	// View space clusters: screen tiles times exponential depth slices
+	struct ClusterGrid
+	{
+		u32   countX;
+		u32   countY;
+		u32   countZ;
+		float zNear;
+		float zFar;
+
+		// Offset and count into lightIndices, cluster x + y * countX + z * countX * countY
+		std::vector<glm::uvec2> clusters;
+		std::vector<u32>        lightIndices;
+
+		// Per slice lists of every cluster, filled by the workers
+		std::vector<std::vector<std::vector<u32>>> sliceLights;
+	};
+
+	// World space uniform grid over the point lights, for per object light lists
+	struct LightGrid
+	{
+		glm::vec3  origin;
+		float      cellSize;
+		glm::ivec3 dims;
+
+		// Offset into cellLights per cell, one extra entry at the end
+		std::vector<u32> cellOffsets;
+		std::vector<u32> cellLights;
+
+		// Query scratch, so a light spanning several cells is only ranked once
+		std::vector<u32> visited;
+		u32              visitStamp;
+		std::vector<std::pair<float, u32>> candidates;
+	};
+
+	void Init(ClusterGrid& grid, u32 countX, u32 countY, u32 countZ);
+
+	// Bins the point lights of the packed light buffer (two vec4 per light, position + radius
+	// first) into the clusters, one depth slice per job. Lights before firstPointLight are
+	// directional and left out.
+	void Build(ClusterGrid& grid, const std::vector<glm::vec4>& packedLights, u32 firstPointLight,
+		const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar);
+
+	// Inserts every point light of the packed light buffer in the cells its sphere overlaps
+	void BuildGrid(LightGrid& grid, const std::vector<glm::vec4>& packedLights, u32 firstPointLight);
+
+	// Writes up to maxLights indices of the point lights reaching the sphere, strongest
+	// first: brightest channel times the attenuation at the closest point of the sphere.
+	// Returns how many were written.
+	u32 GatherLights(LightGrid& grid, const std::vector<glm::vec4>& packedLights, const glm::vec3& center, float radius, u32 maxLights, u32* result);
+
+	// slice = log(depth) * scale + bias
+	glm::vec2 DepthSliceScaleBias(const ClusterGrid& grid);
+}
+
+#endif // !LIGHT_CULLING
@@ -0,0 +1,491 @@
+#include "Lightmapper.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <float.h>
+
+// Gap around every chart, in texels
+#define LIGHTMAP_CHART_PADDING 1.0f
+
+// Faces of a chart stay within about 45 degrees of its first one
+#define LIGHTMAP_CHART_MIN_COSINE 0.7f
+
+// Passes growing the baked texels into the gutters
+#define LIGHTMAP_DILATE_PASSES 2
+
+namespace Lightmapper {
+
+    static u64 EdgeKey(u32 a, u32 b)
+    {
+        return a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+    }
+
+    bool PackRects(const std::vector<glm::uvec2>& sizes, u32 width, std::vector<glm::uvec2>& positions, u32& height)
+    {
+        std::vector<u32> order(sizes.size());
+        for (u32 i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&sizes](u32 l, u32 r) { return sizes[l].y > sizes[r].y; });
+
+        positions.resize(sizes.size());
+        u32 x = 0;
+        u32 y = 0;
+        u32 rowHeight = 0;
+        for (u32 i : order)
+        {
+            if (sizes[i].x > width)
+                return false;
+
+            if (x + sizes[i].x > width)
+            {
+                y += rowHeight;
+                x = 0;
+                rowHeight = 0;
+            }
+
+            positions[i] = glm::uvec2(x, y);
+            x += sizes[i].x;
+            rowHeight = glm::max(rowHeight, sizes[i].y);
+        }
+
+        height = y + rowHeight;
+        return true;
+    }
+
+    void GenerateUVs(const std::vector<glm::vec3>& positions, float texelsPerUnit, std::vector<glm::vec2>& uvs, glm::uvec2& size)
+    {
+        u32 triangleCount = (u32)positions.size() / 3;
+        uvs.resize(triangleCount * 3);
+
+        // Corners sharing a position, the mesh splits them on other attributes
+        std::vector<u32> positionId(triangleCount * 3);
+        {
+            struct PositionHash
+            {
+                size_t operator()(const glm::vec3& p) const
+                {
+                    const u32* bits = (const u32*)&p;
+                    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+                }
+            };
+
+            std::unordered_map<glm::vec3, u32, PositionHash> firstCorner;
+            firstCorner.reserve(positions.size());
+            for (u32 i = 0; i < triangleCount * 3; ++i)
+                positionId[i] = firstCorner.insert(std::make_pair(positions[i], i)).first->second;
+        }
+
+        // The triangle across every edge, only the first two users of an edge are linked
+        std::vector<u32> neighbours(triangleCount * 3, UINT32_MAX);
+        {
+            std::unordered_map<u64, u32> openEdges;
+            openEdges.reserve(positions.size());
+            for (u32 i = 0; i < triangleCount * 3; ++i)
+            {
+                u32 a = positionId[i];
+                u32 b = positionId[i - i % 3 + (i + 1) % 3];
+                if (a == b)
+                    continue;
+
+                u64 key = EdgeKey(a, b);
+                auto open = openEdges.find(key);
+                if (open == openEdges.end())
+                {
+                    openEdges[key] = i;
+                }
+                else
+                {
+                    neighbours[i] = open->second / 3;
+                    neighbours[open->second] = i / 3;
+                    openEdges.erase(open);
+                }
+            }
+        }
+
+        std::vector<glm::vec3> faceNormals(triangleCount);
+        for (u32 t = 0; t < triangleCount; ++t)
+        {
+            const glm::vec3* p = &positions[t * 3];
+            glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+            faceNormals[t] = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+
+        // Grow a chart from every free triangle across shared edges while the faces stay
+        // within a cone of the first one, so the projection on its plane does not fold.
+        // Inside a chart the texels are shared across the edges, only chart borders are seams.
+        std::vector<u32> chartOf(triangleCount, UINT32_MAX);
+        std::vector<glm::uvec2> chartSizes;
+        std::vector<glm::vec2> chartOrigins;
+        std::vector<u32> stack;
+        for (u32 seed = 0; seed < triangleCount; ++seed)
+        {
+            if (chartOf[seed] != UINT32_MAX)
+                continue;
+
+            u32 chart = (u32)chartSizes.size();
+            glm::vec3 axis = faceNormals[seed];
+            glm::vec3 helper = fabsf(axis.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+            glm::vec3 tangent = glm::normalize(glm::cross(helper, axis));
+            glm::vec3 bitangent = glm::cross(axis, tangent);
+
+            glm::vec2 boundsMin(FLT_MAX);
+            glm::vec2 boundsMax(-FLT_MAX);
+            chartOf[seed] = chart;
+            stack.push_back(seed);
+            while (!stack.empty())
+            {
+                u32 t = stack.back();
+                stack.pop_back();
+
+                // World area sets the texels, the same for every chart of the mesh
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    const glm::vec3& p = positions[t * 3 + k];
+                    glm::vec2 uv = glm::vec2(glm::dot(p, tangent), glm::dot(p, bitangent)) * texelsPerUnit;
+                    uvs[t * 3 + k] = uv;
+                    boundsMin = glm::min(boundsMin, uv);
+                    boundsMax = glm::max(boundsMax, uv);
+                }
+
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    u32 neighbour = neighbours[t * 3 + k];
+                    if (neighbour != UINT32_MAX && chartOf[neighbour] == UINT32_MAX && glm::dot(faceNormals[neighbour], axis) > LIGHTMAP_CHART_MIN_COSINE)
+                    {
+                        chartOf[neighbour] = chart;
+                        stack.push_back(neighbour);
+                    }
+                }
+            }
+
+            // Whole texels with the gutter on every side, so the dilation of two charts never meets
+            glm::vec2 extent = boundsMax - boundsMin + 2.0f * LIGHTMAP_CHART_PADDING;
+            chartSizes.push_back(glm::uvec2((u32)ceilf(extent.x), (u32)ceilf(extent.y)));
+            chartOrigins.push_back(boundsMin - LIGHTMAP_CHART_PADDING);
+        }
+
+        // Roughly square, shelves leave some of each row empty
+        u64 chartArea = 0;
+        u32 width = 1;
+        for (const glm::uvec2& chartSize : chartSizes)
+        {
+            chartArea += (u64)chartSize.x * chartSize.y;
+            width = glm::max(width, chartSize.x);
+        }
+        width = glm::max(width, (u32)ceilf(sqrtf((float)chartArea * 1.1f)));
+
+        std::vector<glm::uvec2> chartPositions;
+        u32 height = 0;
+        PackRects(chartSizes, width, chartPositions, height);
+
+        for (u32 t = 0; t < triangleCount; ++t)
+            for (u32 k = 0; k < 3; ++k)
+                uvs[t * 3 + k] += glm::vec2(chartPositions[chartOf[t]]) - chartOrigins[chartOf[t]];
+
+        // The rows rarely fill up to width
+        size = glm::uvec2(1u, glm::max(height, 1u));
+        for (u32 chart = 0; chart < chartSizes.size(); ++chart)
+            size.x = glm::max(size.x, chartPositions[chart].x + chartSizes[chart].x);
+    }
+
+    // A point on a static surface the lightmap stores
+    struct Texel
+    {
+        u32       index;
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 faceNormal;
+    };
+
+    // PCG hash, one independent stream per texel
+    static u32 NextRandom(u32& state)
+    {
+        state = state * 747796405u + 2891336453u;
+        u32 word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    static float RandomFloat(u32& state)
+    {
+        return (NextRandom(state) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static glm::vec3 CosineSample(const glm::vec3& normal, u32& state)
+    {
+        float r1 = RandomFloat(state);
+        float r2 = RandomFloat(state);
+        float radius = sqrtf(r1);
+        float phi = 6.28318530718f * r2;
+
+        glm::vec3 helper = fabsf(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+        return glm::normalize(tangent * (radius * cosf(phi)) + bitangent * (radius * sinf(phi)) + normal * sqrtf(glm::max(1.0f - r1, 0.0f)));
+    }
+
+    // Same terms as CalculateDirLight / CalculatePointLight, without the specular
+    static glm::vec3 DirectLight(const Scene& scene, const Raytracer::Bvh& bvh, const glm::vec3& position, const glm::vec3& normal, const glm::vec3& faceNormal, float bias)
+    {
+        glm::vec3 origin = position + faceNormal * bias;
+        glm::vec3 result(0.0f);
+
+        for (const Light& light : scene.lights)
+        {
+            glm::vec3 lightDirection;
+            float distance;
+            float attenuation;
+            if (light.directional)
+            {
+                lightDirection = glm::normalize(-light.direction);
+                distance = FLT_MAX;
+                attenuation = 1.0f;
+            }
+            else
+            {
+                glm::vec3 toLight = light.position - position;
+                distance = glm::length(toLight);
+                if (distance > light.radius || distance <= 0.0f)
+                    continue;
+
+                lightDirection = toLight / distance;
+                attenuation = 1.0f / (1.0f + 0.09f * distance + 0.032f * distance * distance);
+            }
+
+            float diffuse = glm::dot(normal, lightDirection);
+            if (diffuse <= 0.0f)
+                continue;
+
+            if (!Raytracer::Occluded(bvh, origin, lightDirection, distance - bias))
+                result += diffuse * light.color * attenuation;
+        }
+
+        return result;
+    }
+
+    static glm::vec3 IndirectLight(const Scene& scene, const Raytracer::Bvh& bvh, const Texel& texel, const Settings& settings, float bias, u32& state)
+    {
+        glm::vec3 sum(0.0f);
+        for (u32 sample = 0; sample < settings.samples; ++sample)
+        {
+            glm::vec3 origin = texel.position + texel.faceNormal * bias;
+            glm::vec3 direction = CosineSample(texel.normal, state);
+            glm::vec3 throughput(1.0f);
+
+            for (u32 bounce = 0; bounce < settings.bounces; ++bounce)
+            {
+                Raytracer::Hit hit;
+                if (!Raytracer::Intersect(bvh, origin, direction, FLT_MAX, hit))
+                {
+                    sum += throughput * scene.skyColor;
+                    break;
+                }
+
+                const glm::vec3* p = &scene.positions[hit.triangle * 3];
+                const glm::vec3* n = &scene.normals[hit.triangle * 3];
+                glm::vec3 faceNormal = glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+
+                // The inside of a closed mesh receives nothing
+                if (glm::dot(faceNormal, direction) > 0.0f)
+                    break;
+
+                float w = 1.0f - hit.u - hit.v;
+                glm::vec3 position = p[0] * w + p[1] * hit.u + p[2] * hit.v;
+                glm::vec3 normal = n[0] * w + n[1] * hit.u + n[2] * hit.v;
+                normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : faceNormal;
+
+                // With cosine sampling the pdf cancels, the surface reflects albedo times its lighting
+                throughput *= scene.albedos[hit.triangle];
+                sum += throughput * DirectLight(scene, bvh, position, normal, faceNormal, bias);
+
+                origin = position + faceNormal * bias;
+                direction = CosineSample(normal, state);
+            }
+        }
+
+        return settings.samples > 0 ? sum / (float)settings.samples : glm::vec3(0.0f);
+    }
+
+    static void RasterizeTexels(const Scene& scene, const Settings& settings, std::vector<Texel>& texels, std::vector<bool>& covered)
+    {
+        glm::vec2 size((float)settings.width, (float)settings.height);
+        u32 triangleCount = (u32)scene.positions.size() / 3;
+
+        for (u32 i = 0; i < triangleCount; ++i)
+        {
+            const glm::vec3* p = &scene.positions[i * 3];
+            const glm::vec3* n = &scene.normals[i * 3];
+            glm::vec2 t[3] = { scene.uvs[i * 3 + 0] * size, scene.uvs[i * 3 + 1] * size, scene.uvs[i * 3 + 2] * size };
+
+            float area = (t[1].x - t[0].x) * (t[2].y - t[0].y) - (t[2].x - t[0].x) * (t[1].y - t[0].y);
+            if (fabsf(area) < 1e-8f)
+                continue;
+
+            glm::vec3 faceNormal = glm::cross(p[1] - p[0], p[2] - p[0]);
+            if (glm::length(faceNormal) <= 0.0f)
+                continue;
+            faceNormal = glm::normalize(faceNormal);
+
+            glm::vec2 boundsMin = glm::min(t[0], glm::min(t[1], t[2]));
+            glm::vec2 boundsMax = glm::max(t[0], glm::max(t[1], t[2]));
+            i32 minX = glm::max((i32)floorf(boundsMin.x), 0);
+            i32 minY = glm::max((i32)floorf(boundsMin.y), 0);
+            i32 maxX = glm::min((i32)ceilf(boundsMax.x), (i32)settings.width - 1);
+            i32 maxY = glm::min((i32)ceilf(boundsMax.y), (i32)settings.height - 1);
+
+            bool hitCenter = false;
+            for (i32 y = minY; y <= maxY; ++y)
+            {
+                for (i32 x = minX; x <= maxX; ++x)
+                {
+                    // Barycentrics of the texel center
+                    glm::vec2 c((float)x + 0.5f, (float)y + 0.5f);
+                    float w1 = ((c.x - t[0].x) * (t[2].y - t[0].y) - (t[2].x - t[0].x) * (c.y - t[0].y)) / area;
+                    float w2 = ((t[1].x - t[0].x) * (c.y - t[0].y) - (c.x - t[0].x) * (t[1].y - t[0].y)) / area;
+                    float w0 = 1.0f - w1 - w2;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        continue;
+
+                    hitCenter = true;
+                    Texel texel;
+                    texel.index = x + y * settings.width;
+                    texel.position = p[0] * w0 + p[1] * w1 + p[2] * w2;
+                    texel.normal = n[0] * w0 + n[1] * w1 + n[2] * w2;
+                    texel.normal = glm::length(texel.normal) > 0.0f ? glm::normalize(texel.normal) : faceNormal;
+                    texel.faceNormal = faceNormal;
+
+                    if (!covered[texel.index])
+                    {
+                        covered[texel.index] = true;
+                        texels.push_back(texel);
+                    }
+                }
+            }
+
+            // Slivers between texel centers still light the texel under their middle,
+            // otherwise a chart of them would stay black
+            if (!hitCenter)
+            {
+                glm::vec2 center = (t[0] + t[1] + t[2]) / 3.0f;
+                i32 x = glm::clamp((i32)floorf(center.x), 0, (i32)settings.width - 1);
+                i32 y = glm::clamp((i32)floorf(center.y), 0, (i32)settings.height - 1);
+
+                Texel texel;
+                texel.index = x + y * settings.width;
+                texel.position = (p[0] + p[1] + p[2]) / 3.0f;
+                texel.normal = n[0] + n[1] + n[2];
+                texel.normal = glm::length(texel.normal) > 0.0f ? glm::normalize(texel.normal) : faceNormal;
+                texel.faceNormal = faceNormal;
+
+                if (!covered[texel.index])
+                {
+                    covered[texel.index] = true;
+                    texels.push_back(texel);
+                }
+            }
+        }
+    }
+
+    static void Dilate(const Settings& settings, std::vector<glm::vec3>& result, std::vector<bool>& covered)
+    {
+        for (u32 pass = 0; pass < LIGHTMAP_DILATE_PASSES; ++pass)
+        {
+            std::vector<glm::vec3> source = result;
+            std::vector<bool> sourceCovered = covered;
+
+            for (i32 y = 0; y < (i32)settings.height; ++y)
+            {
+                for (i32 x = 0; x < (i32)settings.width; ++x)
+                {
+                    u32 index = x + y * settings.width;
+                    if (sourceCovered[index])
+                        continue;
+
+                    glm::vec3 sum(0.0f);
+                    u32 count = 0;
+                    for (i32 dy = -1; dy <= 1; ++dy)
+                    {
+                        for (i32 dx = -1; dx <= 1; ++dx)
+                        {
+                            i32 nx = x + dx;
+                            i32 ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= (i32)settings.width || ny >= (i32)settings.height)
+                                continue;
+
+                            u32 neighbour = nx + ny * settings.width;
+                            if (sourceCovered[neighbour])
+                            {
+                                sum += source[neighbour];
+                                count++;
+                            }
+                        }
+                    }
+
+                    if (count > 0)
+                    {
+                        result[index] = sum / (float)count;
+                        covered[index] = true;
+                    }
+                }
+            }
+        }
+    }
+
+    void Bake(const Scene& scene, const Settings& settings, std::vector<glm::vec3>& result)
+    {
+        result.assign(settings.width * settings.height, glm::vec3(0.0f));
+
+        Raytracer::Bvh bvh;
+        Raytracer::Build(bvh, scene.positions);
+
+        // Ray offset relative to the size of the scene
+        const Raytracer::BvhNode& root = bvh.nodes[0];
+        float bias = scene.positions.empty() ? 0.0f : glm::length(root.boundsMax - root.boundsMin) * 1e-4f;
+
+        std::vector<Texel> texels;
+        std::vector<bool> covered(settings.width * settings.height, false);
+        RasterizeTexels(scene, settings, texels, covered);
+
+        // Small batches keep the workers balanced, some texels trace far more than others
+        const u32 batchSize = 64;
+        u32 batchCount = ((u32)texels.size() + batchSize - 1) / batchSize;
+        JobSystem::ParallelFor(batchCount, [&](u32 batch) {
+            u32 end = glm::min((batch + 1) * batchSize, (u32)texels.size());
+            for (u32 i = batch * batchSize; i < end; ++i)
+            {
+                const Texel& texel = texels[i];
+                u32 state = texel.index * 9781u + 1u;
+
+                glm::vec3 light = DirectLight(scene, bvh, texel.position, texel.normal, texel.faceNormal, bias);
+                if (settings.bounces > 0)
+                    light += IndirectLight(scene, bvh, texel, settings, bias, state);
+
+                // Each texel is written by one batch only
+                result[texel.index] = light;
+            }
+        });
+
+        Dilate(settings, result, covered);
+    }
+
+    glm::vec3 TraceRadiance(const Scene& scene, const Raytracer::Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float bias)
+    {
+        Raytracer::Hit hit;
+        if (!Raytracer::Intersect(bvh, origin, direction, FLT_MAX, hit))
+            return scene.skyColor;
+
+        const glm::vec3* p = &scene.positions[hit.triangle * 3];
+        const glm::vec3* n = &scene.normals[hit.triangle * 3];
+        glm::vec3 faceNormal = glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+        if (glm::dot(faceNormal, direction) > 0.0f)
+            return glm::vec3(0.0f);
+
+        float w = 1.0f - hit.u - hit.v;
+        glm::vec3 position = p[0] * w + p[1] * hit.u + p[2] * hit.v;
+        glm::vec3 normal = n[0] * w + n[1] * hit.u + n[2] * hit.v;
+        normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : faceNormal;
+
+        return scene.albedos[hit.triangle] * DirectLight(scene, bvh, position, normal, faceNormal, bias);
+    }
+
+}
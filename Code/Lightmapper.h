@@ -0,0 +1,61 @@
+#ifndef LIGHTMAPPER
+#define LIGHTMAPPER
+
+#include "platform.h"
+#include "Raytracer.h"
+
+namespace Lightmapper
+{
+	// Shelf packing, tallest first, into rows width texels wide. positions follow the order
+	// of sizes, height is the height used. Fails when a rectangle is wider than a row.
+	bool PackRects(const std::vector<glm::uvec2>& sizes, u32 width, std::vector<glm::uvec2>& positions, u32& height);
+
+	// Charts of one mesh, positions holds three corners per triangle. Triangles joined by
+	// an edge that face about the same way share a chart projected on its plane at
+	// texelsPerUnit, so the texels follow the surface area. The charts are packed with a
+	// gutter around each one so bilinear lookups never mix two of them. Writes three
+	// coordinates per triangle in texels of a size rectangle.
+	void GenerateUVs(const std::vector<glm::vec3>& positions, float texelsPerUnit, std::vector<glm::vec2>& uvs, glm::uvec2& size);
+
+	struct Light
+	{
+		glm::vec3 position;
+		glm::vec3 direction;
+		glm::vec3 color; // Already scaled by the intensity
+		float     radius;
+		bool      directional;
+	};
+
+	// Triangle soup of every static instance, world space, lightmap coordinates in [0, 1]
+	// over the whole atlas
+	struct Scene
+	{
+		std::vector<glm::vec3> positions; // Three per triangle
+		std::vector<glm::vec3> normals;   // Three per triangle
+		std::vector<glm::vec2> uvs;       // Three per triangle
+		std::vector<glm::vec3> albedos;   // One per triangle, used by the bounces
+		std::vector<Light>     lights;
+		glm::vec3              skyColor = glm::vec3(0.0f); // Light of the rays that escape
+	};
+
+	struct Settings
+	{
+		u32 width;
+		u32 height;
+		u32 samples; // Indirect rays per texel
+		u32 bounces; // 0 bakes direct light only
+	};
+
+	// Direct light with shadows plus path traced bounces and sky, in the same units as the
+	// light loops of the shaders before they multiply by the albedo (diffuse only, no
+	// specular). Texels are baked in batches on the job system, then the chart gutters are
+	// filled from their neighbours. result holds width * height texels.
+	void Bake(const Scene& scene, const Settings& settings, std::vector<glm::vec3>& result);
+
+	// Light arriving at origin along direction: the sky colour when the ray escapes, the
+	// direct light the surface reflects when it hits, black on back faces. bvh is built over
+	// scene.positions, bias is the offset of the shadow rays.
+	glm::vec3 TraceRadiance(const Scene& scene, const Raytracer::Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float bias);
+}
+
+#endif // !LIGHTMAPPER
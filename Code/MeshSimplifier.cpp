@@ -0,0 +1,256 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <float.h>
+
+namespace MeshSimplifier {
+
+    // Symmetric 4x4 matrix, upper triangle
+    struct Quadric
+    {
+        double a00, a01, a02, a03;
+        double      a11, a12, a13;
+        double           a22, a23;
+        double                a33;
+    };
+
+    struct Collapse
+    {
+        u32   from;
+        u32   to;
+        float error;
+    };
+
+    static void AddPlane(Quadric& q, const glm::dvec3& n, double d, double weight)
+    {
+        q.a00 += weight * n.x * n.x; q.a01 += weight * n.x * n.y; q.a02 += weight * n.x * n.z; q.a03 += weight * n.x * d;
+        q.a11 += weight * n.y * n.y; q.a12 += weight * n.y * n.z; q.a13 += weight * n.y * d;
+        q.a22 += weight * n.z * n.z; q.a23 += weight * n.z * d;
+        q.a33 += weight * d * d;
+    }
+
+    static void AddQuadric(Quadric& q, const Quadric& other)
+    {
+        q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02; q.a03 += other.a03;
+        q.a11 += other.a11; q.a12 += other.a12; q.a13 += other.a13;
+        q.a22 += other.a22; q.a23 += other.a23;
+        q.a33 += other.a33;
+    }
+
+    static double Evaluate(const Quadric& q, const glm::dvec3& p)
+    {
+        return q.a00 * p.x * p.x + 2.0 * q.a01 * p.x * p.y + 2.0 * q.a02 * p.x * p.z + 2.0 * q.a03 * p.x
+             + q.a11 * p.y * p.y + 2.0 * q.a12 * p.y * p.z + 2.0 * q.a13 * p.y
+             + q.a22 * p.z * p.z + 2.0 * q.a23 * p.z
+             + q.a33;
+    }
+
+    static glm::dvec3 Position(const float* vertices, u32 vertexStride, u32 index)
+    {
+        const float* p = vertices + index * vertexStride;
+        return glm::dvec3(p[0], p[1], p[2]);
+    }
+
+    static u64 EdgeKey(u32 a, u32 b)
+    {
+        return a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+    }
+
+    float Simplify(const float* vertices, u32 vertexCount, u32 vertexStride, const u32* indices, u32 indexCount, u32 targetIndexCount, std::vector<u32>& result)
+    {
+        result.assign(indices, indices + indexCount);
+
+        // Vertices sharing a position, split by other attributes
+        std::vector<u32> positionId(vertexCount);
+        std::vector<u32> wedgeCount(vertexCount, 0);
+        {
+            struct PositionHash
+            {
+                size_t operator()(const glm::vec3& p) const
+                {
+                    const u32* bits = (const u32*)&p;
+                    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+                }
+            };
+
+            std::unordered_map<glm::vec3, u32, PositionHash> firstVertex;
+            firstVertex.reserve(vertexCount);
+            for (u32 i = 0; i < vertexCount; ++i)
+            {
+                const float* p = vertices + i * vertexStride;
+                auto inserted = firstVertex.insert(std::make_pair(glm::vec3(p[0], p[1], p[2]), i));
+                positionId[i] = inserted.first->second;
+                wedgeCount[positionId[i]]++;
+            }
+        }
+
+        // Edges used by a single triangle, counted by position so seams do not show up as borders
+        std::vector<bool> locked(vertexCount, false);
+        {
+            std::unordered_map<u64, u32> edgeUses;
+            edgeUses.reserve(indexCount);
+            for (u32 i = 0; i + 2 < indexCount; i += 3)
+                for (u32 j = 0; j < 3; ++j)
+                    edgeUses[EdgeKey(positionId[indices[i + j]], positionId[indices[i + (j + 1) % 3]])]++;
+
+            std::vector<bool> borderPosition(vertexCount, false);
+            for (auto& edge : edgeUses)
+            {
+                if (edge.second == 1)
+                {
+                    borderPosition[(u32)(edge.first >> 32)] = true;
+                    borderPosition[(u32)edge.first] = true;
+                }
+            }
+
+            for (u32 i = 0; i < vertexCount; ++i)
+                locked[i] = wedgeCount[positionId[i]] > 1 || borderPosition[positionId[i]];
+        }
+
+        // Area weighted plane quadrics
+        std::vector<Quadric> quadrics(vertexCount, Quadric{});
+        for (u32 i = 0; i + 2 < indexCount; i += 3)
+        {
+            glm::dvec3 p0 = Position(vertices, vertexStride, indices[i + 0]);
+            glm::dvec3 p1 = Position(vertices, vertexStride, indices[i + 1]);
+            glm::dvec3 p2 = Position(vertices, vertexStride, indices[i + 2]);
+
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(normal);
+            if (length <= 0.0)
+                continue;
+
+            normal /= length;
+            double d = -glm::dot(normal, p0);
+            for (u32 j = 0; j < 3; ++j)
+                AddPlane(quadrics[indices[i + j]], normal, d, length * 0.5);
+        }
+
+        float maxError = 0.0f;
+
+        std::vector<u32>      remap(vertexCount);
+        std::vector<bool>     touched(vertexCount);
+        std::vector<u32>      adjacencyOffsets(vertexCount + 1);
+        std::vector<u32>      adjacency;
+        std::vector<Collapse> collapses;
+
+        while (result.size() > targetIndexCount)
+        {
+            u32 triangleCount = (u32)result.size() / 3;
+
+            // Triangles around each vertex
+            std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+            for (u32 i = 0; i < result.size(); ++i)
+                adjacencyOffsets[result[i] + 1]++;
+            for (u32 i = 0; i < vertexCount; ++i)
+                adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+            adjacency.resize(result.size());
+            {
+                std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+                for (u32 i = 0; i < result.size(); ++i)
+                    adjacency[fill[result[i]]++] = i / 3;
+            }
+
+            // Cheapest direction of every edge
+            collapses.clear();
+            for (u32 i = 0; i < result.size(); i += 3)
+            {
+                for (u32 j = 0; j < 3; ++j)
+                {
+                    u32 a = result[i + j];
+                    u32 b = result[i + (j + 1) % 3];
+                    if (locked[a] && locked[b])
+                        continue;
+
+                    Quadric q = quadrics[a];
+                    AddQuadric(q, quadrics[b]);
+
+                    double errorToB = locked[a] ? DBL_MAX : Evaluate(q, Position(vertices, vertexStride, b));
+                    double errorToA = locked[b] ? DBL_MAX : Evaluate(q, Position(vertices, vertexStride, a));
+                    if (errorToB <= errorToA)
+                        collapses.push_back(Collapse{ a, b, (float)glm::max(errorToB, 0.0) });
+                    else
+                        collapses.push_back(Collapse{ b, a, (float)glm::max(errorToA, 0.0) });
+                }
+            }
+
+            if (collapses.empty())
+                break;
+
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& l, const Collapse& r) { return l.error < r.error; });
+
+            // Every collapse removes about two triangles
+            u32 collapseBudget = (triangleCount - targetIndexCount / 3) / 2 + 1;
+            u32 collapseCount = 0;
+
+            for (u32 i = 0; i < vertexCount; ++i)
+                remap[i] = i;
+            std::fill(touched.begin(), touched.end(), false);
+
+            for (const Collapse& collapse : collapses)
+            {
+                if (collapseCount >= collapseBudget)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+
+                // Reject collapses that flip a remaining triangle around the removed vertex
+                glm::dvec3 target = Position(vertices, vertexStride, collapse.to);
+                bool flips = false;
+                for (u32 k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1] && !flips; ++k)
+                {
+                    const u32* triangle = &result[adjacency[k] * 3];
+                    if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                        continue;
+
+                    glm::dvec3 p[3];
+                    for (u32 j = 0; j < 3; ++j)
+                        p[j] = Position(vertices, vertexStride, triangle[j]);
+                    glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+                    for (u32 j = 0; j < 3; ++j)
+                        if (triangle[j] == collapse.from)
+                            p[j] = target;
+                    glm::dvec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+                    flips = glm::dot(before, after) <= 0.0;
+                }
+                if (flips)
+                    continue;
+
+                remap[collapse.from] = collapse.to;
+                AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+                maxError = glm::max(maxError, collapse.error);
+                collapseCount++;
+
+                // The neighbourhood changed, leave it for the next pass
+                for (u32 k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1]; ++k)
+                    for (u32 j = 0; j < 3; ++j)
+                        touched[result[adjacency[k] * 3 + j]] = true;
+            }
+
+            if (collapseCount == 0)
+                break;
+
+            // Drop the triangles that became degenerate
+            u32 writeIndex = 0;
+            for (u32 i = 0; i < result.size(); i += 3)
+            {
+                u32 a = remap[result[i + 0]];
+                u32 b = remap[result[i + 1]];
+                u32 c = remap[result[i + 2]];
+                if (a == b || b == c || c == a)
+                    continue;
+
+                result[writeIndex++] = a;
+                result[writeIndex++] = b;
+                result[writeIndex++] = c;
+            }
+            result.resize(writeIndex);
+        }
+
+        return maxError;
+    }
+
+}
@@ -0,0 +1,16 @@
+#ifndef MESH_SIMPLIFIER
+#define MESH_SIMPLIFIER
+
+#include "platform.h"
+
+namespace MeshSimplifier
+{
+	// Quadric error edge collapse. Edges are only collapsed onto one of their existing
+	// vertices, so the result indexes the same vertex data as the input. Vertices on
+	// open borders or UV/normal seams (same position, different attributes) are kept.
+	// Vertices are interleaved, vertexStride floats apart, position first.
+	// Returns the largest collapse error, in squared object space units.
+	float Simplify(const float* vertices, u32 vertexCount, u32 vertexStride, const u32* indices, u32 indexCount, u32 targetIndexCount, std::vector<u32>& result);
+}
+
+#endif // !MESH_SIMPLIFIER
@@ -1,7 +1,10 @@
 #include "ModelLoadHelper.h"
 #include "engine.h"
+#include "MeshSimplifier.h"
+#include "Lightmapper.h"
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <float.h>
 
 
 namespace ModelHelper {
@@ -14,9 +17,16 @@ namespace ModelHelper {
         bool hasTexCoords = false;
         bool hasTangentSpace = false;
 
+        vec3 aabbMin = vec3(FLT_MAX);
+        vec3 aabbMax = vec3(-FLT_MAX);
+
         // process vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
+            vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            aabbMin = glm::min(aabbMin, position);
+            aabbMax = glm::max(aabbMax, position);
+
             vertices.push_back(mesh->mVertices[i].x);
             vertices.push_back(mesh->mVertices[i].y);
             vertices.push_back(mesh->mVertices[i].z);
@@ -84,11 +94,24 @@ namespace ModelHelper {
             vertexBufferLayout.stride += 3 * sizeof(float);
         }
 
+        // bounding sphere around the box center
+        vec3 sphereCenter = (aabbMin + aabbMax) * 0.5f;
+        float sphereRadius = 0.0f;
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            sphereRadius = glm::max(sphereRadius, glm::length(position - sphereCenter));
+        }
+
         // add the submesh into the mesh
         Submesh submesh = {};
         submesh.vertexBufferLayout = vertexBufferLayout;
         submesh.vertices.swap(vertices);
         submesh.indices.swap(indices);
+        submesh.aabbMin = aabbMin;
+        submesh.aabbMax = aabbMax;
+        submesh.sphereCenter = sphereCenter;
+        submesh.sphereRadius = sphereRadius;
         myMesh->submeshes.push_back(submesh);
     }
 
@@ -166,6 +189,197 @@ namespace ModelHelper {
         }
     }
 
+    void GenerateMeshLods(Mesh& mesh)
+    {
+        mesh.lodCount = 1;
+        for (u32 i = 0; i < MAX_MESH_LODS; ++i)
+            mesh.lodTriangleCount[i] = 0;
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            Submesh& submesh = mesh.submeshes[i];
+            submesh.lods.clear();
+            submesh.lodIndices.clear();
+            submesh.lods.push_back(SubmeshLod{ 0, (u32)submesh.indices.size() });
+
+            // Small submeshes are not worth the extra draw ranges
+            if (submesh.indices.size() / 3 >= LOD_MIN_TRIANGLES)
+            {
+                u32 vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+                u32 vertexCount = submesh.vertices.size() / vertexStride;
+
+                // Each level is simplified from the previous one, to half its triangles
+                std::vector<u32> previous = submesh.indices;
+                std::vector<u32> simplified;
+                for (u32 level = 1; level < MAX_MESH_LODS; ++level)
+                {
+                    u32 targetIndexCount = (u32)(previous.size() / 6) * 3;
+                    MeshSimplifier::Simplify(submesh.vertices.data(), vertexCount, vertexStride, previous.data(), previous.size(), targetIndexCount, simplified);
+
+                    // Stop when locked borders and seams keep it from getting meaningfully smaller
+                    if (simplified.size() > previous.size() * 9 / 10)
+                        break;
+
+                    submesh.lods.push_back(SubmeshLod{ 0, (u32)simplified.size() });
+                    submesh.lodIndices.insert(submesh.lodIndices.end(), simplified.begin(), simplified.end());
+                    previous.swap(simplified);
+                }
+            }
+
+            mesh.lodCount = glm::max(mesh.lodCount, (u32)submesh.lods.size());
+        }
+
+        // Submeshes with fewer levels keep drawing their coarsest one
+        for (u32 level = 0; level < mesh.lodCount; ++level)
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+                mesh.lodTriangleCount[level] += mesh.submeshes[i].lods[glm::min(level, (u32)mesh.submeshes[i].lods.size() - 1)].indexCount / 3;
+    }
+
+    void UploadMesh(Mesh& mesh)
+    {
+        u32 vertexBufferSize = 0;
+        u32 indexBufferSize = 0;
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
+            indexBufferSize += (mesh.submeshes[i].indices.size() + mesh.submeshes[i].lodIndices.size()) * sizeof(u32);
+        }
+
+        glGenBuffers(1, &mesh.vertexBufferHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &mesh.indexBufferHandle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+
+        u32 indicesOffset = 0;
+        u32 verticesOffset = 0;
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const void* verticesData = mesh.submeshes[i].vertices.data();
+            const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
+            glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
+            mesh.submeshes[i].vertexOffset = verticesOffset;
+            verticesOffset += verticesSize;
+
+            const void* indicesData = mesh.submeshes[i].indices.data();
+            const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
+            mesh.submeshes[i].indexOffset = indicesOffset;
+            indicesOffset += indicesSize;
+
+            // Simplified levels right after the full one
+            std::vector<SubmeshLod>& lods = mesh.submeshes[i].lods;
+            lods[0].indexOffset = mesh.submeshes[i].indexOffset;
+            u32 lodOffset = indicesOffset;
+            for (u32 j = 1; j < lods.size(); ++j)
+            {
+                lods[j].indexOffset = lodOffset;
+                lodOffset += lods[j].indexCount * sizeof(u32);
+            }
+
+            if (!mesh.submeshes[i].lodIndices.empty())
+            {
+                const u32 lodIndicesSize = mesh.submeshes[i].lodIndices.size() * sizeof(u32);
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, lodIndicesSize, mesh.submeshes[i].lodIndices.data());
+                indicesOffset += lodIndicesSize;
+            }
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void BuildLightmapMesh(App* app, u32 meshIdx, float texelsPerUnit)
+    {
+        if (app->meshes[meshIdx].lightmapMeshIdx != UINT32_MAX && app->meshes[meshIdx].lightmapTexelsPerUnit == texelsPerUnit)
+            return;
+
+        // Reuse the slot of an older layout
+        u32 lightmapMeshIdx = app->meshes[meshIdx].lightmapMeshIdx;
+        if (lightmapMeshIdx == UINT32_MAX)
+        {
+            lightmapMeshIdx = (u32)app->meshes.size();
+            app->meshes.push_back(Mesh{});
+        }
+        else
+        {
+            Mesh& old = app->meshes[lightmapMeshIdx];
+            glDeleteBuffers(1, &old.vertexBufferHandle);
+            glDeleteBuffers(1, &old.indexBufferHandle);
+            for (Submesh& submesh : old.submeshes)
+                for (Vao& vao : submesh.vaos)
+                    glDeleteVertexArrays(1, &vao.handle);
+        }
+
+        Mesh& mesh = app->meshes[meshIdx];
+        Mesh& lightmapMesh = app->meshes[lightmapMeshIdx];
+        lightmapMesh = Mesh{};
+        lightmapMesh.aabbMin = mesh.aabbMin;
+        lightmapMesh.aabbMax = mesh.aabbMax;
+        lightmapMesh.triangleCount = mesh.triangleCount;
+
+        std::vector<glm::vec3> positions;
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            u32 vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+            for (u32 index : submesh.indices)
+            {
+                const float* vertex = &submesh.vertices[index * vertexStride];
+                positions.push_back(glm::vec3(vertex[0], vertex[1], vertex[2]));
+            }
+        }
+
+        std::vector<glm::vec2> uvs;
+        glm::uvec2 size;
+        Lightmapper::GenerateUVs(positions, texelsPerUnit, uvs, size);
+
+        // Unindexed, a position can sit on two charts. Coordinates in [0, 1] over the tile.
+        u32 triangle = 0;
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const Submesh& submesh = mesh.submeshes[i];
+            u32 vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+
+            Submesh lightmapSubmesh = {};
+            lightmapSubmesh.vertexBufferLayout = submesh.vertexBufferLayout;
+            lightmapSubmesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ LIGHTMAP_TEXCOORD_LOCATION, 2, submesh.vertexBufferLayout.stride });
+            lightmapSubmesh.vertexBufferLayout.stride += 2 * sizeof(float);
+            lightmapSubmesh.aabbMin = submesh.aabbMin;
+            lightmapSubmesh.aabbMax = submesh.aabbMax;
+            lightmapSubmesh.sphereCenter = submesh.sphereCenter;
+            lightmapSubmesh.sphereRadius = submesh.sphereRadius;
+
+            for (u32 j = 0; j < submesh.indices.size(); ++j)
+            {
+                const float* vertex = &submesh.vertices[submesh.indices[j] * vertexStride];
+                lightmapSubmesh.vertices.insert(lightmapSubmesh.vertices.end(), vertex, vertex + vertexStride);
+
+                glm::vec2 uv = uvs[triangle * 3 + j % 3] / glm::vec2(size);
+                lightmapSubmesh.vertices.push_back(uv.x);
+                lightmapSubmesh.vertices.push_back(uv.y);
+                lightmapSubmesh.indices.push_back(j);
+                if (j % 3 == 2)
+                    triangle++;
+            }
+
+            // Baked entities always draw the full detail, their lighting is tied to it
+            lightmapSubmesh.lods.push_back(SubmeshLod{ 0, (u32)lightmapSubmesh.indices.size() });
+            lightmapMesh.submeshes.push_back(lightmapSubmesh);
+        }
+
+        lightmapMesh.lodCount = 1;
+        lightmapMesh.lodTriangleCount[0] = lightmapMesh.triangleCount;
+        UploadMesh(lightmapMesh);
+
+        mesh.lightmapMeshIdx = lightmapMeshIdx;
+        mesh.lightmapTexelsPerUnit = texelsPerUnit;
+        mesh.lightmapSize = size;
+    }
+
     u32 LoadModel(App* app, const char* filename)
     {
         const aiScene* scene = aiImportFile(filename,
@@ -208,44 +422,20 @@ namespace ModelHelper {
 
         aiReleaseImport(scene);
 
-        u32 vertexBufferSize = 0;
-        u32 indexBufferSize = 0;
-
+        mesh.aabbMin = vec3(FLT_MAX);
+        mesh.aabbMax = vec3(-FLT_MAX);
+        mesh.triangleCount = 0;
         for (u32 i = 0; i < mesh.submeshes.size(); ++i)
         {
-            vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-            indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+            mesh.aabbMin = glm::min(mesh.aabbMin, mesh.submeshes[i].aabbMin);
+            mesh.aabbMax = glm::max(mesh.aabbMax, mesh.submeshes[i].aabbMax);
+            mesh.triangleCount += mesh.submeshes[i].indices.size() / 3;
         }
 
-        glGenBuffers(1, &mesh.vertexBufferHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+        GenerateMeshLods(mesh);
 
-        glGenBuffers(1, &mesh.indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
-
-        u32 indicesOffset = 0;
-        u32 verticesOffset = 0;
+        UploadMesh(mesh);
 
-        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-        {
-            const void* verticesData = mesh.submeshes[i].vertices.data();
-            const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-            glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-            mesh.submeshes[i].vertexOffset = verticesOffset;
-            verticesOffset += verticesSize;
-
-            const void* indicesData = mesh.submeshes[i].indices.data();
-            const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-            mesh.submeshes[i].indexOffset = indicesOffset;
-            indicesOffset += indicesSize;
-        }
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        
         return modelIdx;
     }
 
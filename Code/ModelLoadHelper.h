@@ -7,6 +7,9 @@
 
 #include <vector>
 
+// Submeshes below this triangle count only keep their full detail level
+#define LOD_MIN_TRIANGLES 256
+
 struct App; 
 struct Mesh;
 struct Material;
@@ -19,6 +22,17 @@ namespace ModelHelper {
 
 	void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
 
+	// Fills the simplified levels of every submesh, before the buffers are uploaded
+	void GenerateMeshLods(Mesh& mesh);
+
+	// Creates the vertex and index buffers of a mesh whose submeshes are filled in
+	void UploadMesh(Mesh& mesh);
+
+	// Unindexed copy of the mesh with a second set of texture coordinates, charts laid out
+	// at texelsPerUnit object space texels per unit, stored in Mesh::lightmapMeshIdx. Kept
+	// while the density does not change.
+	void BuildLightmapMesh(App* app, u32 meshIdx, float texelsPerUnit);
+
 	u32 LoadModel(App* app, const char* filename);
 
 	//u32 LoadTexture2D(App* app, const char* filepath);
@@ -0,0 +1,298 @@
+#include "Raytracer.h"
+
+#include <float.h>
+
+#define BVH_BIN_COUNT 12
+#define BVH_MAX_LEAF_TRIANGLES 4
+#define BVH_STACK_SIZE 64
+
+namespace Raytracer {
+
+    struct BuildTriangle
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        glm::vec3 centroid;
+    };
+
+    struct Bin
+    {
+        glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+        glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+        u32       count = 0;
+    };
+
+    static float HalfArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        glm::vec3 extent = boundsMax - boundsMin;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    static void UpdateBounds(BvhNode& node, const std::vector<BuildTriangle>& build, const std::vector<u32>& order)
+    {
+        node.boundsMin = glm::vec3(FLT_MAX);
+        node.boundsMax = glm::vec3(-FLT_MAX);
+        for (u32 i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+        {
+            node.boundsMin = glm::min(node.boundsMin, build[order[i]].boundsMin);
+            node.boundsMax = glm::max(node.boundsMax, build[order[i]].boundsMax);
+        }
+    }
+
+    static void Subdivide(Bvh& bvh, u32 nodeIndex, const std::vector<BuildTriangle>& build, std::vector<u32>& order)
+    {
+        BvhNode node = bvh.nodes[nodeIndex];
+        if (node.count <= BVH_MAX_LEAF_TRIANGLES)
+            return;
+
+        glm::vec3 centroidMin(FLT_MAX);
+        glm::vec3 centroidMax(-FLT_MAX);
+        for (u32 i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+        {
+            centroidMin = glm::min(centroidMin, build[order[i]].centroid);
+            centroidMax = glm::max(centroidMax, build[order[i]].centroid);
+        }
+
+        // Cheapest bin boundary over the three axes
+        float bestCost = FLT_MAX;
+        i32   bestAxis = -1;
+        u32   bestSplit = 0;
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            Bin bins[BVH_BIN_COUNT];
+            float scale = BVH_BIN_COUNT / extent;
+            for (u32 i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+            {
+                const BuildTriangle& triangle = build[order[i]];
+                u32 binIndex = glm::min((u32)((triangle.centroid[axis] - centroidMin[axis]) * scale), (u32)BVH_BIN_COUNT - 1);
+                bins[binIndex].count++;
+                bins[binIndex].boundsMin = glm::min(bins[binIndex].boundsMin, triangle.boundsMin);
+                bins[binIndex].boundsMax = glm::max(bins[binIndex].boundsMax, triangle.boundsMax);
+            }
+
+            // Sweep from both sides
+            float leftArea[BVH_BIN_COUNT - 1];
+            u32   leftCount[BVH_BIN_COUNT - 1];
+            Bin accumulated;
+            for (u32 i = 0; i < BVH_BIN_COUNT - 1; ++i)
+            {
+                accumulated.count += bins[i].count;
+                accumulated.boundsMin = glm::min(accumulated.boundsMin, bins[i].boundsMin);
+                accumulated.boundsMax = glm::max(accumulated.boundsMax, bins[i].boundsMax);
+                leftCount[i] = accumulated.count;
+                leftArea[i] = accumulated.count > 0 ? HalfArea(accumulated.boundsMin, accumulated.boundsMax) : 0.0f;
+            }
+
+            accumulated = Bin();
+            for (u32 i = BVH_BIN_COUNT - 1; i > 0; --i)
+            {
+                accumulated.count += bins[i].count;
+                accumulated.boundsMin = glm::min(accumulated.boundsMin, bins[i].boundsMin);
+                accumulated.boundsMax = glm::max(accumulated.boundsMax, bins[i].boundsMax);
+                float rightArea = accumulated.count > 0 ? HalfArea(accumulated.boundsMin, accumulated.boundsMax) : 0.0f;
+
+                float cost = leftCount[i - 1] * leftArea[i - 1] + accumulated.count * rightArea;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        // Splitting has to beat testing every triangle of the node
+        float leafCost = node.count * HalfArea(node.boundsMin, node.boundsMax);
+        if (bestAxis < 0 || bestCost >= leafCost)
+            return;
+
+        float scale = BVH_BIN_COUNT / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        u32 first = node.leftOrFirst;
+        u32 last = node.leftOrFirst + node.count;
+        u32 middle = first;
+        for (u32 i = first; i < last; ++i)
+        {
+            u32 binIndex = glm::min((u32)((build[order[i]].centroid[bestAxis] - centroidMin[bestAxis]) * scale), (u32)BVH_BIN_COUNT - 1);
+            if (binIndex < bestSplit)
+                std::swap(order[i], order[middle++]);
+        }
+
+        if (middle == first || middle == last)
+            return;
+
+        u32 leftIndex = (u32)bvh.nodes.size();
+        BvhNode left = {};
+        left.leftOrFirst = first;
+        left.count = middle - first;
+        UpdateBounds(left, build, order);
+
+        BvhNode right = {};
+        right.leftOrFirst = middle;
+        right.count = last - middle;
+        UpdateBounds(right, build, order);
+
+        bvh.nodes.push_back(left);
+        bvh.nodes.push_back(right);
+        bvh.nodes[nodeIndex].leftOrFirst = leftIndex;
+        bvh.nodes[nodeIndex].count = 0;
+
+        Subdivide(bvh, leftIndex, build, order);
+        Subdivide(bvh, leftIndex + 1, build, order);
+    }
+
+    void Build(Bvh& bvh, const std::vector<glm::vec3>& positions)
+    {
+        u32 triangleCount = (u32)positions.size() / 3;
+
+        std::vector<BuildTriangle> build(triangleCount);
+        std::vector<u32> order(triangleCount);
+        for (u32 i = 0; i < triangleCount; ++i)
+        {
+            const glm::vec3* p = &positions[i * 3];
+            build[i].boundsMin = glm::min(p[0], glm::min(p[1], p[2]));
+            build[i].boundsMax = glm::max(p[0], glm::max(p[1], p[2]));
+            build[i].centroid = (p[0] + p[1] + p[2]) / 3.0f;
+            order[i] = i;
+        }
+
+        bvh.nodes.clear();
+        bvh.nodes.reserve(triangleCount * 2 + 1);
+
+        BvhNode root = {};
+        root.leftOrFirst = 0;
+        root.count = triangleCount;
+        UpdateBounds(root, build, order);
+        bvh.nodes.push_back(root);
+
+        if (triangleCount > 0)
+            Subdivide(bvh, 0, build, order);
+
+        // Leaves index the triangles in build order
+        bvh.triangles.resize(triangleCount);
+        bvh.triangleIds.swap(order);
+        for (u32 i = 0; i < triangleCount; ++i)
+        {
+            const glm::vec3* p = &positions[bvh.triangleIds[i] * 3];
+            bvh.triangles[i].v0 = p[0];
+            bvh.triangles[i].edge1 = p[1] - p[0];
+            bvh.triangles[i].edge2 = p[2] - p[0];
+        }
+    }
+
+    // Entry distance into the box, FLT_MAX when missed or further than tMax
+    static float IntersectBounds(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float tMax)
+    {
+        glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+        glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float entry = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+        float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, tMax));
+        return entry <= exit ? entry : FLT_MAX;
+    }
+
+    // Moller-Trumbore
+    static bool IntersectTriangle(const Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float tMax, float& t, float& u, float& v)
+    {
+        glm::vec3 p = glm::cross(direction, triangle.edge2);
+        float determinant = glm::dot(triangle.edge1, p);
+        if (fabsf(determinant) < 1e-12f)
+            return false;
+
+        float inverseDeterminant = 1.0f / determinant;
+        glm::vec3 s = origin - triangle.v0;
+        u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        glm::vec3 q = glm::cross(s, triangle.edge1);
+        v = glm::dot(direction, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+        return t > 1e-5f && t < tMax;
+    }
+
+    template <bool anyHit>
+    static bool Traverse(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit& hit)
+    {
+        if (bvh.triangles.empty())
+            return false;
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        bool found = false;
+        hit.t = tMax;
+
+        u32 stack[BVH_STACK_SIZE];
+        u32 stackSize = 0;
+        u32 nodeIndex = 0;
+        if (IntersectBounds(bvh.nodes[0], origin, inverseDirection, tMax) == FLT_MAX)
+            return false;
+
+        for (;;)
+        {
+            const BvhNode& node = bvh.nodes[nodeIndex];
+            if (node.count > 0)
+            {
+                for (u32 i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+                {
+                    float t, u, v;
+                    if (IntersectTriangle(bvh.triangles[i], origin, direction, hit.t, t, u, v))
+                    {
+                        hit.t = t;
+                        hit.u = u;
+                        hit.v = v;
+                        hit.triangle = bvh.triangleIds[i];
+                        found = true;
+                        if (anyHit)
+                            return true;
+                    }
+                }
+            }
+            else
+            {
+                // Nearest child first, the other one waits on the stack
+                u32 nearIndex = node.leftOrFirst;
+                u32 farIndex = node.leftOrFirst + 1;
+                float nearEntry = IntersectBounds(bvh.nodes[nearIndex], origin, inverseDirection, hit.t);
+                float farEntry = IntersectBounds(bvh.nodes[farIndex], origin, inverseDirection, hit.t);
+                if (farEntry < nearEntry)
+                {
+                    std::swap(nearIndex, farIndex);
+                    std::swap(nearEntry, farEntry);
+                }
+
+                if (nearEntry != FLT_MAX)
+                {
+                    if (farEntry != FLT_MAX && stackSize < BVH_STACK_SIZE)
+                        stack[stackSize++] = farIndex;
+                    nodeIndex = nearIndex;
+                    continue;
+                }
+            }
+
+            if (stackSize == 0)
+                break;
+            nodeIndex = stack[--stackSize];
+        }
+
+        return found;
+    }
+
+    bool Intersect(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit& hit)
+    {
+        return Traverse<false>(bvh, origin, direction, tMax, hit);
+    }
+
+    bool Occluded(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax)
+    {
+        Hit hit;
+        return Traverse<true>(bvh, origin, direction, tMax, hit);
+    }
+
+}
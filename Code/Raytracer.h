@@ -0,0 +1,53 @@
+#ifndef RAYTRACER
+#define RAYTRACER
+
+#include "platform.h"
+
+namespace Raytracer
+{
+	// Triangle stored as one vertex and two edges, ready for the intersection test
+	struct Triangle
+	{
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+	};
+
+	// Leaves have count > 0 and index their first triangle, inner nodes index their
+	// left child and the right one follows it
+	struct BvhNode
+	{
+		glm::vec3 boundsMin;
+		u32       leftOrFirst;
+		glm::vec3 boundsMax;
+		u32       count;
+	};
+
+	struct Bvh
+	{
+		std::vector<BvhNode>  nodes;
+		std::vector<Triangle> triangles;
+
+		// Input index of every triangle, in the order the leaves store them
+		std::vector<u32>      triangleIds;
+	};
+
+	struct Hit
+	{
+		float t;
+		float u;
+		float v;
+		u32   triangle; // Input index
+	};
+
+	// Binned SAH build over a triangle soup, three positions per triangle
+	void Build(Bvh& bvh, const std::vector<glm::vec3>& positions);
+
+	// Closest hit in (0, tMax). Safe to call from several threads at once.
+	bool Intersect(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax, Hit& hit);
+
+	// Any hit in (0, tMax), for shadow rays
+	bool Occluded(const Bvh& bvh, const glm::vec3& origin, const glm::vec3& direction, float tMax);
+}
+
+#endif // !RAYTRACER
@@ -0,0 +1,152 @@
+#include "RenderTargetPool.h"
+
+namespace RenderTargetPool {
+
+    bool Matches(const TargetDesc& l, const TargetDesc& r)
+    {
+        return l.internalFormat == r.internalFormat && l.format == r.format && l.type == r.type
+            && l.width == r.width && l.height == r.height && l.levels == r.levels
+            && l.minFilter == r.minFilter && l.magFilter == r.magFilter;
+    }
+
+    static u32 BytesPerPixel(GLenum internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_R8:                 return 1;
+        case GL_R16F:               return 2;
+        case GL_RGBA8:
+        case GL_RG16:
+        case GL_RG16F:
+        case GL_R32F:
+        case GL_R11F_G11F_B10F:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32F:
+        case GL_DEPTH24_STENCIL8:   return 4;
+        case GL_RGBA16F:            return 8;
+        case GL_RGBA32F:            return 16;
+        default:                    return 4;
+        }
+    }
+
+    static GLuint CreateTexture(const TargetDesc& desc)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (i32 level = 0; level < desc.levels; ++level)
+        {
+            i32 width = glm::max(desc.width >> level, 1);
+            i32 height = glm::max(desc.height >> level, 1);
+            glTexImage2D(GL_TEXTURE_2D, level, desc.internalFormat, width, height, 0, desc.format, desc.type, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.magFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, desc.levels - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    TargetDesc Desc(GLenum internalFormat, GLenum format, GLenum type, i32 width, i32 height, i32 levels, GLenum minFilter, GLenum magFilter)
+    {
+        TargetDesc desc;
+        desc.internalFormat = internalFormat;
+        desc.format = format;
+        desc.type = type;
+        desc.width = glm::max(width, 1);
+        desc.height = glm::max(height, 1);
+        desc.levels = glm::max(levels, 1);
+        desc.minFilter = minFilter;
+        desc.magFilter = magFilter;
+        return desc;
+    }
+
+    GLuint Acquire(Pool& pool, const TargetDesc& desc)
+    {
+        for (Target& target : pool.targets)
+        {
+            if (!target.inUse && Matches(target.desc, desc))
+            {
+                target.inUse = true;
+                target.lastUsedFrame = pool.frame;
+                return target.texture;
+            }
+        }
+
+        Target target;
+        target.desc = desc;
+        target.texture = CreateTexture(desc);
+        target.inUse = true;
+        target.lastUsedFrame = pool.frame;
+        pool.targets.push_back(target);
+        return target.texture;
+    }
+
+    void Release(Pool& pool, GLuint texture)
+    {
+        if (texture == 0)
+            return;
+
+        for (Target& target : pool.targets)
+        {
+            if (target.texture == texture)
+            {
+                target.inUse = false;
+                target.lastUsedFrame = pool.frame;
+                return;
+            }
+        }
+    }
+
+    void EndFrame(Pool& pool)
+    {
+        for (u32 i = 0; i < pool.targets.size();)
+        {
+            Target& target = pool.targets[i];
+            if (!target.inUse && pool.frame - target.lastUsedFrame > pool.maxIdleFrames)
+            {
+                glDeleteTextures(1, &target.texture);
+                target = pool.targets.back();
+                pool.targets.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        pool.frame++;
+    }
+
+    void Clear(Pool& pool)
+    {
+        for (Target& target : pool.targets)
+            glDeleteTextures(1, &target.texture);
+        pool.targets.clear();
+    }
+
+    u64 GetBytes(const TargetDesc& desc)
+    {
+        u64 bytes = 0;
+        for (i32 level = 0; level < desc.levels; ++level)
+            bytes += (u64)glm::max(desc.width >> level, 1) * glm::max(desc.height >> level, 1) * BytesPerPixel(desc.internalFormat);
+        return bytes;
+    }
+
+    u64 GetAllocatedBytes(const Pool& pool)
+    {
+        u64 bytes = 0;
+        for (const Target& target : pool.targets)
+            bytes += GetBytes(target.desc);
+        return bytes;
+    }
+
+    u32 GetTargetCount(const Pool& pool)
+    {
+        return (u32)pool.targets.size();
+    }
+
+}
@@ -0,0 +1,63 @@
+#ifndef RENDER_TARGET_POOL
+#define RENDER_TARGET_POOL
+
+#include "platform.h"
+#include <glad/glad.h>
+
+namespace RenderTargetPool
+{
+	// Everything a texture is matched on, levels > 1 allocates a mip chain halving from width x height
+	struct TargetDesc
+	{
+		GLenum internalFormat;
+		GLenum format;
+		GLenum type;
+		i32    width;
+		i32    height;
+		i32    levels;
+		GLenum minFilter;
+		GLenum magFilter;
+	};
+
+	struct Target
+	{
+		TargetDesc desc;
+		GLuint     texture;
+		bool       inUse;
+		u32        lastUsedFrame;
+	};
+
+	struct Pool
+	{
+		std::vector<Target> targets;
+		u32                 frame = 0;
+
+		// Released targets unused for this many frames are deleted
+		u32                 maxIdleFrames = 60;
+	};
+
+	TargetDesc Desc(GLenum internalFormat, GLenum format, GLenum type, i32 width, i32 height,
+		i32 levels = 1, GLenum minFilter = GL_NEAREST, GLenum magFilter = GL_NEAREST);
+
+	bool   Matches(const TargetDesc& l, const TargetDesc& r);
+
+	// Bytes of a texture of that description, mips included
+	u64    GetBytes(const TargetDesc& desc);
+
+	// Returns a released texture matching desc, or creates one
+	GLuint Acquire(Pool& pool, const TargetDesc& desc);
+
+	// Hands the texture back, it stays allocated until it goes idle. Zero is ignored.
+	void   Release(Pool& pool, GLuint texture);
+
+	// Deletes the targets released more than maxIdleFrames ago
+	void   EndFrame(Pool& pool);
+
+	void   Clear(Pool& pool);
+
+	// Bytes held by the pool, in use or not
+	u64    GetAllocatedBytes(const Pool& pool);
+	u32    GetTargetCount(const Pool& pool);
+}
+
+#endif // !RENDER_TARGET_POOL
@@ -0,0 +1,238 @@
+#include "SoftwareOcclusion.h"
+#include "JobSystem.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <float.h>
+
+namespace SoftwareOcclusion {
+
+    void Init(DepthBuffer& buffer, i32 width, i32 height)
+    {
+        buffer.tilesX = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+        buffer.tilesY = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+        buffer.width = buffer.tilesX * OCCLUSION_TILE_WIDTH;
+        buffer.height = buffer.tilesY * OCCLUSION_TILE_HEIGHT;
+
+        buffer.depth.resize(buffer.width * buffer.height);
+        buffer.tileMaxDepth.resize(buffer.tilesX * buffer.tilesY);
+        buffer.tileBins.resize(buffer.tilesX * buffer.tilesY);
+
+        Clear(buffer);
+    }
+
+    void Clear(DepthBuffer& buffer)
+    {
+        std::fill(buffer.depth.begin(), buffer.depth.end(), 1.0f);
+        std::fill(buffer.tileMaxDepth.begin(), buffer.tileMaxDepth.end(), 1.0f);
+
+        buffer.triangles.clear();
+        for (u32 i = 0; i < buffer.tileBins.size(); ++i)
+            buffer.tileBins[i].clear();
+    }
+
+    void AddOccluder(DepthBuffer& buffer, const float* vertices, u32 vertexCount, u32 vertexStride, const u32* indices, u32 indexCount, const glm::mat4& worldViewProjection)
+    {
+        std::vector<glm::vec4> clipPositions(vertexCount);
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            const float* p = vertices + i * vertexStride;
+            clipPositions[i] = worldViewProjection * glm::vec4(p[0], p[1], p[2], 1.0f);
+        }
+
+        for (u32 i = 0; i + 2 < indexCount; i += 3)
+        {
+            ScreenTriangle triangle;
+            bool crossesNearPlane = false;
+
+            for (u32 j = 0; j < 3; ++j)
+            {
+                const glm::vec4& clip = clipPositions[indices[i + j]];
+
+                // Clipping is not worth it for occluders, dropping the triangle is conservative
+                if (clip.w <= 1e-5f || clip.z < -clip.w)
+                {
+                    crossesNearPlane = true;
+                    break;
+                }
+
+                glm::vec3 ndc = glm::vec3(clip) / clip.w;
+                triangle.v[j] = glm::vec3((ndc.x * 0.5f + 0.5f) * buffer.width,
+                                          (ndc.y * 0.5f + 0.5f) * buffer.height,
+                                          ndc.z * 0.5f + 0.5f);
+            }
+
+            if (crossesNearPlane)
+                continue;
+
+            float minX = std::min(triangle.v[0].x, std::min(triangle.v[1].x, triangle.v[2].x));
+            float maxX = std::max(triangle.v[0].x, std::max(triangle.v[1].x, triangle.v[2].x));
+            float minY = std::min(triangle.v[0].y, std::min(triangle.v[1].y, triangle.v[2].y));
+            float maxY = std::max(triangle.v[0].y, std::max(triangle.v[1].y, triangle.v[2].y));
+
+            if (maxX < 0.0f || maxY < 0.0f || minX >= (float)buffer.width || minY >= (float)buffer.height)
+                continue;
+
+            i32 tileMinX = std::max(0, (i32)minX / OCCLUSION_TILE_WIDTH);
+            i32 tileMaxX = std::min(buffer.tilesX - 1, (i32)maxX / OCCLUSION_TILE_WIDTH);
+            i32 tileMinY = std::max(0, (i32)minY / OCCLUSION_TILE_HEIGHT);
+            i32 tileMaxY = std::min(buffer.tilesY - 1, (i32)maxY / OCCLUSION_TILE_HEIGHT);
+
+            u32 triangleIdx = (u32)buffer.triangles.size();
+            buffer.triangles.push_back(triangle);
+
+            for (i32 ty = tileMinY; ty <= tileMaxY; ++ty)
+                for (i32 tx = tileMinX; tx <= tileMaxX; ++tx)
+                    buffer.tileBins[ty * buffer.tilesX + tx].push_back(triangleIdx);
+        }
+    }
+
+    static void RasterizeTile(DepthBuffer& buffer, u32 tileIdx)
+    {
+        const i32 tileX0 = (tileIdx % buffer.tilesX) * OCCLUSION_TILE_WIDTH;
+        const i32 tileY0 = (tileIdx / buffer.tilesX) * OCCLUSION_TILE_HEIGHT;
+        const i32 tileX1 = tileX0 + OCCLUSION_TILE_WIDTH - 1;
+        const i32 tileY1 = tileY0 + OCCLUSION_TILE_HEIGHT - 1;
+
+        const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+
+        const std::vector<u32>& bin = buffer.tileBins[tileIdx];
+        for (u32 i = 0; i < bin.size(); ++i)
+        {
+            glm::vec3 a = buffer.triangles[bin[i]].v[0];
+            glm::vec3 b = buffer.triangles[bin[i]].v[1];
+            glm::vec3 c = buffer.triangles[bin[i]].v[2];
+
+            // Occluders are rasterized double sided, so make the winding counter-clockwise
+            float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+            if (area == 0.0f)
+                continue;
+            if (area < 0.0f)
+            {
+                std::swap(b, c);
+                area = -area;
+            }
+
+            i32 minX = std::max(tileX0, (i32)std::floor(std::min(a.x, std::min(b.x, c.x))));
+            i32 maxX = std::min(tileX1, (i32)std::ceil(std::max(a.x, std::max(b.x, c.x))));
+            i32 minY = std::max(tileY0, (i32)std::floor(std::min(a.y, std::min(b.y, c.y))));
+            i32 maxY = std::min(tileY1, (i32)std::ceil(std::max(a.y, std::max(b.y, c.y))));
+            if (minX > maxX || minY > maxY)
+                continue;
+            minX &= ~3;
+
+            // Edge functions, each one is the barycentric weight of the opposite vertex
+            const float a0 = b.y - c.y, b0 = c.x - b.x, c0 = b.x * c.y - b.y * c.x;
+            const float a1 = c.y - a.y, b1 = a.x - c.x, c1 = c.x * a.y - c.y * a.x;
+            const float a2 = a.y - b.y, b2 = b.x - a.x, c2 = a.x * b.y - a.y * b.x;
+
+            const float invArea = 1.0f / area;
+            const __m128 z0 = _mm_set1_ps(a.z * invArea);
+            const __m128 z1 = _mm_set1_ps(b.z * invArea);
+            const __m128 z2 = _mm_set1_ps(c.z * invArea);
+
+            for (i32 y = minY; y <= maxY; ++y)
+            {
+                const float py = (float)y + 0.5f;
+                const __m128 row0 = _mm_set1_ps(b0 * py + c0);
+                const __m128 row1 = _mm_set1_ps(b1 * py + c1);
+                const __m128 row2 = _mm_set1_ps(b2 * py + c2);
+                float* depthRow = &buffer.depth[y * buffer.width];
+
+                for (i32 x = minX; x <= maxX; x += 4)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+                    __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), row0);
+                    __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), row1);
+                    __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), row2);
+
+                    __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+
+                    __m128 z = _mm_add_ps(_mm_mul_ps(w0, z0), _mm_add_ps(_mm_mul_ps(w1, z1), _mm_mul_ps(w2, z2)));
+                    __m128 previous = _mm_loadu_ps(depthRow + x);
+                    __m128 closest = _mm_min_ps(previous, z);
+                    _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, previous)));
+                }
+            }
+        }
+
+        // Conservative depth of the whole tile for the hierarchical test
+        __m128 tileMax = zero;
+        for (i32 y = tileY0; y <= tileY1; ++y)
+            for (i32 x = tileX0; x <= tileX1; x += 4)
+                tileMax = _mm_max_ps(tileMax, _mm_loadu_ps(&buffer.depth[y * buffer.width + x]));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, tileMax);
+        buffer.tileMaxDepth[tileIdx] = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+
+    void Rasterize(DepthBuffer& buffer)
+    {
+        JobSystem::ParallelFor((u32)buffer.tileBins.size(), [&buffer](u32 tileIdx) {
+            if (!buffer.tileBins[tileIdx].empty())
+                RasterizeTile(buffer, tileIdx);
+        });
+    }
+
+    bool IsAABBVisible(const DepthBuffer& buffer, const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::mat4& worldViewProjection)
+    {
+        float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+        float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+        for (u32 i = 0; i < 8; ++i)
+        {
+            glm::vec3 corner((i & 1) ? aabbMax.x : aabbMin.x,
+                             (i & 2) ? aabbMax.y : aabbMin.y,
+                             (i & 4) ? aabbMax.z : aabbMin.z);
+            glm::vec4 clip = worldViewProjection * glm::vec4(corner, 1.0f);
+
+            // Boxes touching the near plane are always considered visible
+            if (clip.w <= 1e-5f || clip.z < -clip.w)
+                return true;
+
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            float x = (ndc.x * 0.5f + 0.5f) * buffer.width;
+            float y = (ndc.y * 0.5f + 0.5f) * buffer.height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            minZ = std::min(minZ, ndc.z * 0.5f + 0.5f);
+        }
+
+        if (maxX < 0.0f || maxY < 0.0f || minX >= (float)buffer.width || minY >= (float)buffer.height || minZ > 1.0f)
+            return false;
+
+        i32 pixelMinX = std::max(0, (i32)std::floor(minX));
+        i32 pixelMaxX = std::min(buffer.width - 1, (i32)std::ceil(maxX));
+        i32 pixelMinY = std::max(0, (i32)std::floor(minY));
+        i32 pixelMaxY = std::min(buffer.height - 1, (i32)std::ceil(maxY));
+
+        for (i32 ty = pixelMinY / OCCLUSION_TILE_HEIGHT; ty <= pixelMaxY / OCCLUSION_TILE_HEIGHT; ++ty)
+        {
+            for (i32 tx = pixelMinX / OCCLUSION_TILE_WIDTH; tx <= pixelMaxX / OCCLUSION_TILE_WIDTH; ++tx)
+            {
+                // Every pixel of the tile is in front of the box
+                if (buffer.tileMaxDepth[ty * buffer.tilesX + tx] <= minZ)
+                    continue;
+
+                i32 x0 = std::max(pixelMinX, tx * OCCLUSION_TILE_WIDTH);
+                i32 x1 = std::min(pixelMaxX, tx * OCCLUSION_TILE_WIDTH + OCCLUSION_TILE_WIDTH - 1);
+                i32 y0 = std::max(pixelMinY, ty * OCCLUSION_TILE_HEIGHT);
+                i32 y1 = std::min(pixelMaxY, ty * OCCLUSION_TILE_HEIGHT + OCCLUSION_TILE_HEIGHT - 1);
+
+                for (i32 y = y0; y <= y1; ++y)
+                    for (i32 x = x0; x <= x1; ++x)
+                        if (buffer.depth[y * buffer.width + x] > minZ)
+                            return true;
+            }
+        }
+
+        return false;
+    }
+
+}
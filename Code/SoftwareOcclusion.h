@@ -0,0 +1,48 @@
+#ifndef SOFTWARE_OCCLUSION
+#define SOFTWARE_OCCLUSION
+
+#include "platform.h"
+
+// Tiles are 32x8 pixels so a tile row is a whole number of 4-wide SIMD steps
+#define OCCLUSION_TILE_WIDTH  32
+#define OCCLUSION_TILE_HEIGHT 8
+
+namespace SoftwareOcclusion
+{
+	struct ScreenTriangle
+	{
+		glm::vec3 v[3]; // x, y in pixels, z in [0, 1]
+	};
+
+	// Low resolution depth buffer filled with a few occluder meshes on the CPU.
+	// Depth is stored as window-space z, so 1.0 is the far plane.
+	struct DepthBuffer
+	{
+		i32 width;
+		i32 height;
+		i32 tilesX;
+		i32 tilesY;
+
+		std::vector<float> depth;
+		std::vector<float> tileMaxDepth;
+
+		std::vector<ScreenTriangle>   triangles;
+		std::vector<std::vector<u32>> tileBins;
+	};
+
+	// The width and height are rounded up to a whole number of tiles
+	void Init(DepthBuffer& buffer, i32 width, i32 height);
+	void Clear(DepthBuffer& buffer);
+
+	// Transforms and bins the triangles of an occluder. Vertices are interleaved,
+	// vertexStride floats apart, with the position in the first three floats.
+	void AddOccluder(DepthBuffer& buffer, const float* vertices, u32 vertexCount, u32 vertexStride, const u32* indices, u32 indexCount, const glm::mat4& worldViewProjection);
+
+	// Rasterizes the binned triangles, one tile per job on the JobSystem workers
+	void Rasterize(DepthBuffer& buffer);
+
+	// False when the box is completely behind the occluders or outside the view
+	bool IsAABBVisible(const DepthBuffer& buffer, const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::mat4& worldViewProjection);
+}
+
+#endif // !SOFTWARE_OCCLUSION
@@ -6,14 +6,18 @@
 //
 
 #include "engine.h"
+#include "JobSystem.h"
+#include "Lightmapper.h"
 #include <imgui.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <float.h>
+#include <chrono>
 
-#define MIPMAP_BASE_LEVEL 0
-#define MIPMAP_MAX_LEVEL  4
+#define OCCLUSION_BUFFER_WIDTH  320
+#define OCCLUSION_BUFFER_HEIGHT 176
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, const char* defines)
 {
     GLchar  infoLogBuffer[1024] = {};
     GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
@@ -29,24 +33,28 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     const GLchar* vertexShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         vertexShaderDefine,
         programSource.str
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(vertexShaderDefine),
         (GLint) programSource.len
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         fragmentShaderDefine,
         programSource.str
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(fragmentShaderDefine),
         (GLint) programSource.len
     };
@@ -92,12 +100,102 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
 {
-    String programSource = ReadTextFile(filepath);
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf_s(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(computeShaderDefine),
+        (GLint) programSource.len
+    };
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
+
+    return programHandle;
+}
+
+// GLSL has no includes: each #include "file" line is replaced by the file, one level deep
+std::string ExpandShaderIncludes(String source)
+{
+    std::string expanded(source.str, source.len);
+    const std::string directive = "#include \"";
+    size_t start = 0;
+    while ((start = expanded.find(directive, start)) != std::string::npos) {
+        size_t nameStart = start + directive.size();
+        size_t nameEnd = expanded.find('"', nameStart);
+        if (nameEnd == std::string::npos)
+            break;
+
+        std::string filename = expanded.substr(nameStart, nameEnd - nameStart);
+        String included = ReadTextFile(filename.c_str());
+        std::string includedText = included.str ? std::string(included.str, included.len) : std::string();
+        expanded.replace(start, nameEnd + 1 - start, includedText);
+        start += includedText.size();
+    }
+    return expanded;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+    std::string source = ExpandShaderIncludes(ReadTextFile(filepath));
+    String programSource = { &source[0], (u32)source.size() };
+
+    Program program = {};
+    program.handle = CreateComputeProgramFromSource(programSource, programName);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+// Defines are extra lines after the program name, for the variants of one program
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const char* defines = "")
+{
+    std::string source = ExpandShaderIncludes(ReadTextFile(filepath));
+    String programSource = { &source[0], (u32)source.size() };
 
     Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
+    program.handle = CreateProgramFromSource(programSource, programName, defines);
     program.filepath = filepath;
     program.programName = programName;
     program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
@@ -113,8 +211,12 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
         GLchar name[256];
 		glGetActiveAttrib(program.handle, i, ARRAY_COUNT(name), &length, &size, &type, name);
 
-        u8 location = glGetAttribLocation(program.handle, name);
-        program.vertexInputLayout.attributes.push_back({ location, (u8)size });
+        // Built-ins such as gl_InstanceID can be listed too, they have no location
+        GLint location = glGetAttribLocation(program.handle, name);
+        if (location < 0)
+            continue;
+
+        program.vertexInputLayout.attributes.push_back({ (u8)location, (u8)size });
     }
 
     app->programs.push_back(program);
@@ -231,7 +333,8 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program) {
                 break;
             }
         }
-        assert(attributeWasLinked);
+        // Lightmap coordinates are optional, meshes without them read zero
+        assert(attributeWasLinked || program.vertexInputLayout.attributes[i].location == LIGHTMAP_TEXCOORD_LOCATION);
     }
 
     glBindVertexArray(0);
@@ -280,6 +383,9 @@ void Init(App* app)
     InitFramebuffers(app);
 	InitCamera(app);
 
+    JobSystem::Init();
+    SoftwareOcclusion::Init(app->occlusionBuffer, OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+
     app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
 	app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
 	app->blackTexIdx = LoadTexture2D(app, "color_black.png");
@@ -329,6 +435,8 @@ void Init(App* app)
     pond.modelIndex = pondModel;
     pond.worldMatrix = TransformPositionRotationScale(pond.position, pond.rotation, pond.scale);
     pond.name = "Pond";
+    pond.isOccluder = true;
+    pond.isStatic = true;
     app->entities.push_back(pond);
 
     // Pond scene
@@ -395,6 +503,7 @@ void Init(App* app)
     // Lights
     // Directional
 	app->lights.push_back(Light(LightType_Directional, vec3(1.0f, 1.0f, 1.0f), vec3(-1.0f, -0.3f, -1.0f), vec3(0.0f, -10.0f, 0.0f), 1.0f, "Directional Light Init"));
+    app->lights.back().isStatic = true;
 
 	// Point
 	app->lights.push_back(Light(LightType_Point, vec3(1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f), vec3(14.0f, 2.0f, 13.0f), 1.0f, "Point Light Init 1"));
@@ -416,18 +525,81 @@ void Init(App* app)
     // Forward program and uniforms
     app->forwardProgramIdx = LoadProgram(app, "RENDER_GEOMETRY.glsl", "RENDER_GEOMETRY");
 	app->forwardProgram_uTexture = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uTexture");
+    app->forwardProgram_uLightList = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uLightList");
+    app->forwardProgram_uLightmap = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uLightmap");
+    app->forwardProgram_uDirectionalLightCount = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uDirectionalLightCount");
+    app->forwardProgram_uClusterCount = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uClusterCount");
+    app->forwardProgram_uClusterTileSize = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uClusterTileSize");
+    app->forwardProgram_uClusterDepthScaleBias = glGetUniformLocation(app->programs[app->forwardProgramIdx].handle, "uClusterDepthScaleBias");
 
 	// Deferred programs and uniforms
 	// Geometry pass + Lighting pass + Debug lights programs
 	app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "GEOMETRY_RENDER");
     app->texturedMeshProgram_uTexture = glGetUniformLocation(app->programs[app->texturedMeshProgramIdx].handle, "uTexture");
-	app->texturedMeshProgram_uNear = glGetUniformLocation(app->programs[app->texturedMeshProgramIdx].handle, "uNear");
-	app->texturedMeshProgram_uFar = glGetUniformLocation(app->programs[app->texturedMeshProgramIdx].handle, "uFar");
+    app->texturedMeshProgram_uLightmap = glGetUniformLocation(app->programs[app->texturedMeshProgramIdx].handle, "uLightmap");
+
+    app->depthPrepassProgramIdx = LoadProgram(app, "shaders.glsl", "DEPTH_PREPASS", "#define ALPHA_TEST\n");
+    app->depthPrepassPositionProgramIdx = LoadProgram(app, "shaders.glsl", "DEPTH_PREPASS");
+    app->depthPrepassProgram_uTexture = glGetUniformLocation(app->programs[app->depthPrepassProgramIdx].handle, "uTexture");
+    glGenQueries(1, &app->overdrawQuery);
+    glGenQueries(1, &app->waterOcclusionQuery);
+    DynamicResolution::Init(app->dynamicResolution);
+
+    glGenBuffers(1, &app->lightStorageBuffer);
+
+    LightCulling::Init(app->clusterGrid, CLUSTER_COUNT_X, CLUSTER_COUNT_Y, CLUSTER_COUNT_Z);
+    glGenBuffers(1, &app->clusterBuffer);
+    glGenBuffers(1, &app->clusterLightIndexBuffer);
+    glGenBuffers(1, &app->probeBuffer);
+    glGenBuffers(1, &app->blurKernelBuffer);
+
+    app->occlusionProxyProgramIdx = LoadProgram(app, "shaders.glsl", "OCCLUSION_PROXY");
+    app->occlusionProxyProgram_uWorldViewProjection = glGetUniformLocation(app->programs[app->occlusionProxyProgramIdx].handle, "uWorldViewProjectionMatrix");
+
+    app->tiledLightingProgramIdx = LoadComputeProgram(app, "shaders.glsl", "TILED_LIGHTING");
+    app->tiledLightingProgram_uAlbedo = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uAlbedo");
+    app->tiledLightingProgram_uInverseViewProjection = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uInverseViewProjection");
+    app->tiledLightingProgram_uNormal = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uNormal");
+    app->tiledLightingProgram_uDepth = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uDepth");
+    app->tiledLightingProgram_uView = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uView");
+    app->tiledLightingProgram_uProjection = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uProjection");
+    app->tiledLightingProgram_uBakedLight = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uBakedLight");
+    app->tiledLightingProgram_uSampleScale = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uSampleScale");
+    app->tiledLightingProgram_uViewportSize = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uViewportSize");
+    app->tiledLightingProgram_uFusedBloom = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uFusedBloom");
+    app->tiledLightingProgram_uBloomThreshold = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uBloomThreshold");
+    app->tiledLightingProgram_uSkybox = glGetUniformLocation(app->programs[app->tiledLightingProgramIdx].handle, "uSkybox");
+
+    app->lightUpsampleProgramIdx = LoadProgram(app, "shaders.glsl", "LIGHT_UPSAMPLE");
+    app->lightUpsampleProgram_uLight = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uLight");
+    app->lightUpsampleProgram_uAlbedo = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uAlbedo");
+    app->lightUpsampleProgram_uNormal = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uNormal");
+    app->lightUpsampleProgram_uDepth = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uDepth");
+    app->lightUpsampleProgram_uBakedLight = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uBakedLight");
+    app->lightUpsampleProgram_uProjection = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uProjection");
+    app->lightUpsampleProgram_uViewportSize = glGetUniformLocation(app->programs[app->lightUpsampleProgramIdx].handle, "uViewportSize");
+
+    app->lightVolumeProgramIdx = LoadProgram(app, "shaders.glsl", "LIGHT_VOLUME");
+    app->lightVolumeProgram_uAlbedo = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uAlbedo");
+    app->lightVolumeProgram_uDepth = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uDepth");
+    app->lightVolumeProgram_uInverseViewProjection = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uInverseViewProjection");
+    app->lightVolumeProgram_uNormal = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uNormal");
+    app->lightVolumeProgram_uViewProjection = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uViewProjection");
+    app->lightVolumeProgram_uProxyScale = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uProxyScale");
+    app->lightVolumeProgram_uFirstLight = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uFirstLight");
+    app->lightVolumeProgram_uBakedLight = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uBakedLight");
+    app->lightVolumeProgram_uViewportSize = glGetUniformLocation(app->programs[app->lightVolumeProgramIdx].handle, "uViewportSize");
 
     app->lightProgramIdx = LoadProgram(app, "shaders.glsl", "LIGHTING_RENDER");
 	app->lightProgram_uAlbedo = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uAlbedo");
 	app->lightProgram_uNormal = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uNormal");
-	app->lightProgram_uPosition = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uPosition");
+    app->lightProgram_uDirectionalOnly = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uDirectionalOnly");
+    app->lightProgram_uDirectionalLightCount = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uDirectionalLightCount");
+    app->lightProgram_uBakedLight = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uBakedLight");
+    app->lightProgram_uSampleScale = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uSampleScale");
+	app->lightProgram_uDepth = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uDepth");
+	app->lightProgram_uInverseViewProjection = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uInverseViewProjection");
+	app->lightProgram_uViewportSize = glGetUniformLocation(app->programs[app->lightProgramIdx].handle, "uViewportSize");
 
     app->debugLightProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_LIGHTS");
 	app->uProjectionMatrix = glGetUniformLocation(app->programs[app->debugLightProgramIdx].handle, "uProjectionMatrix");
@@ -436,18 +608,45 @@ void Init(App* app)
     app->blitBrightestPixelProgramIdx = LoadProgram(app, "BLIT_BRIGHTEST.glsl", "BLIT_BRIGHTEST");
 	app->colorTexture = glGetUniformLocation(app->programs[app->blitBrightestPixelProgramIdx].handle, "uTexture");
 	app->threshold = glGetUniformLocation(app->programs[app->blitBrightestPixelProgramIdx].handle, "threshold");
+	app->blitBrightestProgram_uRenderScale = glGetUniformLocation(app->programs[app->blitBrightestPixelProgramIdx].handle, "uRenderScale");
 
 	app->blurProgramIdx = LoadProgram(app, "shaders.glsl", "BLUR");
 	app->colorMap = glGetUniformLocation(app->programs[app->blurProgramIdx].handle, "uColorMap");
     app->dir = glGetUniformLocation(app->programs[app->blurProgramIdx].handle, "uDir");
-	app->kernelRadius = glGetUniformLocation(app->programs[app->blurProgramIdx].handle, "kernelRadius");
 	app->inputLod = glGetUniformLocation(app->programs[app->blurProgramIdx].handle, "uInputLod");
 	app->inputLodIntensity = glGetUniformLocation(app->programs[app->blurProgramIdx].handle, "uLodIntensity");
 
-    app->bloomProgramIdx = LoadProgram(app, "shaders.glsl", "BLOOM");
-	app->mainTexture = glGetUniformLocation(app->programs[app->bloomProgramIdx].handle, "uMainTexture");
-    app->colorMapBlend = glGetUniformLocation(app->programs[app->bloomProgramIdx].handle, "uColorMap");
-    app->maxLod = glGetUniformLocation(app->programs[app->bloomProgramIdx].handle, "uMaxLod");
+    // One variant per view, the uniforms a variant does not use have no location
+    const char* compositeDefines[CompositeView_Count] = {
+        "#define VIEW_MAIN\n", "#define VIEW_TEXTURE\n", "#define VIEW_POSITION\n", "#define VIEW_NORMAL\n", "#define VIEW_DEPTH\n"
+    };
+    for (u32 view = 0; view < CompositeView_Count; ++view) {
+        CompositeProgram& compositeProgram = app->compositePrograms[view];
+        compositeProgram.programIdx = LoadProgram(app, "shaders.glsl", "COMPOSITE", compositeDefines[view]);
+        GLuint handle = app->programs[compositeProgram.programIdx].handle;
+        compositeProgram.uSource = glGetUniformLocation(handle, "uSource");
+        compositeProgram.uSourceScale = glGetUniformLocation(handle, "uSourceScale");
+        compositeProgram.uBloom = glGetUniformLocation(handle, "uBloom");
+        compositeProgram.uBloomLevels = glGetUniformLocation(handle, "uBloomLevels");
+        compositeProgram.uBloomScale = glGetUniformLocation(handle, "uBloomScale");
+        compositeProgram.uDepth = glGetUniformLocation(handle, "uDepth");
+        compositeProgram.uInverseViewProjection = glGetUniformLocation(handle, "uInverseViewProjection");
+        compositeProgram.uNear = glGetUniformLocation(handle, "uNear");
+        compositeProgram.uFar = glGetUniformLocation(handle, "uFar");
+        compositeProgram.uViewportSize = glGetUniformLocation(handle, "uViewportSize");
+    }
+
+    app->bloomBlurProgramIdx = LoadComputeProgram(app, "shaders.glsl", "BLOOM_BLUR");
+    app->bloomBlurProgram_uSource = glGetUniformLocation(app->programs[app->bloomBlurProgramIdx].handle, "uSource");
+    app->bloomBlurProgram_uDir = glGetUniformLocation(app->programs[app->bloomBlurProgramIdx].handle, "uDir");
+    app->bloomBlurProgram_uIntensities = glGetUniformLocation(app->programs[app->bloomBlurProgramIdx].handle, "uIntensities");
+
+    app->bloomDownsampleProgramIdx = LoadProgram(app, "shaders.glsl", "BLOOM_DOWNSAMPLE");
+    app->bloomDownsampleProgram_uSource = glGetUniformLocation(app->programs[app->bloomDownsampleProgramIdx].handle, "uSource");
+
+    app->bloomUpsampleProgramIdx = LoadProgram(app, "shaders.glsl", "BLOOM_UPSAMPLE");
+    app->bloomUpsampleProgram_uSource = glGetUniformLocation(app->programs[app->bloomUpsampleProgramIdx].handle, "uSource");
+    app->bloomUpsampleProgram_uIntensity = glGetUniformLocation(app->programs[app->bloomUpsampleProgramIdx].handle, "uIntensity");
 
     app->cubemapProgramIdx = LoadProgram(app, "CUBEMAP.glsl", "CUBEMAP");
     app->uSkybox = glGetUniformLocation(app->programs[app->cubemapProgramIdx].handle, "skybox");
@@ -470,6 +669,12 @@ void Init(App* app)
     app->mode = Mode_Deferred;
 }
 
+void Shutdown(App* app)
+{
+    RenderTargetPool::Clear(app->renderTargetPool);
+    JobSystem::Shutdown();
+}
+
 void InitBuffers(App* app) 
 {
     // Geometry
@@ -497,35 +702,24 @@ void InitBuffers(App* app)
 
 void InitFramebuffers(App* app)
 {
-    // Albedo Texture
-    app->colorAttachmentTexture = CreateTextureAttachment(GL_RGBA16F, GL_RGBA, GL_UNSIGNED_BYTE, app->displaySize.x, app->displaySize.y);
-
-    // Position Texture
-	app->positionAttachmentTexture = CreateTextureAttachment(GL_RGBA16F, GL_RGB, GL_FLOAT, app->displaySize.x, app->displaySize.y);
-
-	// Normal Texture
-	app->normalAttachmentTexture = CreateTextureAttachment(GL_RGBA16F, GL_RGB, GL_FLOAT, app->displaySize.x, app->displaySize.y);
-
-	// Depth Texture
-	app->depthAttachmentTexture = CreateTextureAttachment(GL_RGBA16F, GL_RGBA, GL_UNSIGNED_BYTE, app->displaySize.x, app->displaySize.y);
-
-    // Depth Component
-    GLuint depthAttachmentHandle;
-	depthAttachmentHandle = CreateTextureAttachment(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, app->displaySize.x, app->displaySize.y);
-
-    //gBuffer
     glGenFramebuffers(1, &app->gBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->gBuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->colorAttachmentTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, app->positionAttachmentTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, app->normalAttachmentTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, app->depthAttachmentTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthAttachmentHandle, 0);
-
-    CheckFramebufferStatus();
+    glGenFramebuffers(1, &app->lightBuffer);
+    glGenFramebuffers(1, &app->halfLightBuffer);
+    glGenFramebuffers(1, &app->forwardBuffer);
+    glGenFramebuffers(1, &app->compositeBuffer);
+    glGenFramebuffers(BLOOM_MAX_MIPS, app->bloomMipBuffers);
+    glGenFramebuffers(1, &app->reflectionBuffer);
+    glGenFramebuffers(1, &app->refractionBuffer);
 
-    GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+    // Draw buffers belong to the framebuffer, the textures are attached once the frame graph handed them out
+    GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glBindFramebuffer(GL_FRAMEBUFFER, app->gBuffer);
     glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
+
+    for (GLuint fbo : app->bloomMipBuffers) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glDrawBuffers(2, drawBuffers);
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glGenFramebuffers(1, &app->skyboxVBO);
@@ -546,156 +740,97 @@ void InitFramebuffers(App* app)
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Final texture
-	app->mainAttachmentTexture = CreateTextureAttachment(GL_RGBA16F, GL_RGBA, GL_FLOAT, app->displaySize.x, app->displaySize.y);
-
-	app->bloomAttachmentTexture = CreateTextureAttachment(GL_RGBA16F, GL_RGBA, GL_FLOAT, app->displaySize.x, app->displaySize.y);
-
-    // Depth component 
-    GLuint depthLightAttachmentHandle;
-	depthLightAttachmentHandle = CreateTextureAttachment(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, app->displaySize.x, app->displaySize.y);
-
-    // Light buffer
-    glGenFramebuffers(1, &app->lightBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->mainAttachmentTexture, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthLightAttachmentHandle, 0);
-
-	CheckFramebufferStatus();
-
-	GLuint drawBuffersLight[] = { GL_COLOR_ATTACHMENT0};
-	glDrawBuffers(ARRAY_COUNT(drawBuffersLight), drawBuffersLight);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Forward buffer
-	glGenFramebuffers(1, &app->forwardBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->forwardBuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->mainAttachmentTexture, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthLightAttachmentHandle, 0);
-
-	CheckFramebufferStatus();
+    app->sceneViewportSize = app->displaySize;
+    UpdateRenderSize(app);
 
-	GLuint drawBuffersForward[] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(ARRAY_COUNT(drawBuffersForward), drawBuffersForward);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Set default attachment
+	app->currentAttachment = "Main";
+}
 
-	// Bloom Framebuffer
-	glGenFramebuffers(1, &app->bloomBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->bloomBuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->bloomAttachmentTexture, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthLightAttachmentHandle, 0);
+void AttachFramebuffer(GLuint fbo, const GLuint* colors, u32 colorCount, GLuint depth, GLint level)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
-    InitBloomMipmap(app);
-    GenBloomFramebuffers(app);
+    bool attached = true;
+    for (u32 i = 0; i < colorCount; ++i) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], level);
+        attached = attached && colors[i] != 0;
+    }
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
 
-	// Water Effect FBO and textures
+    // The framebuffers of passes that do not run this frame are left incomplete
+    if (attached)
+        CheckFramebufferStatus();
 
-    glGenTextures(1, &app->rtReflection);
-    glBindTexture(GL_TEXTURE_2D, app->rtReflection);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    glGenTextures(1, &app->rtRefraction);
-    glBindTexture(GL_TEXTURE_2D, app->rtRefraction);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-	glGenTextures(1, &app->rtRefractionDepth);
-	glBindTexture(GL_TEXTURE_2D, app->rtRefractionDepth);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-	glGenTextures(1, &app->rtReflectionDepth);
-	glBindTexture(GL_TEXTURE_2D, app->rtReflectionDepth);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    // Water effect FBO
-    glGenFramebuffers(1, &app->reflectionBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->reflectionBuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtReflection, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, app->rtReflectionDepth, 0);
+void AttachRenderTargets(App* app)
+{
+    // Aliasing hands out other textures when the passes or the size change, otherwise nothing to do
+    std::vector<GLuint> targets = {
+        app->colorAttachmentTexture, app->normalAttachmentTexture, app->bakedLightAttachmentTexture, app->gBufferDepthTexture,
+        app->mainAttachmentTexture, app->compositeTexture, app->depthLightAttachmentTexture, app->halfLightTexture,
+        app->rtBright, app->rtBloomH,
+        app->rtReflection, app->rtRefraction, app->rtReflectionDepth, app->rtRefractionDepth
+    };
+    if (targets == app->attachedRenderTargets)
+        return;
+    app->attachedRenderTargets = targets;
 
-    CheckFramebufferStatus();
+    GLuint gBufferColors[] = { app->colorAttachmentTexture, app->normalAttachmentTexture, app->bakedLightAttachmentTexture };
+    AttachFramebuffer(app->gBuffer, gBufferColors, ARRAY_COUNT(gBufferColors), app->gBufferDepthTexture, 0);
 
-    GLuint drawReflectionBuffer[] = { GL_COLOR_ATTACHMENT0 };
-    glDrawBuffers(ARRAY_COUNT(drawReflectionBuffer), drawReflectionBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // The light and forward framebuffers share one depth
+    AttachFramebuffer(app->lightBuffer, &app->mainAttachmentTexture, 1, app->depthLightAttachmentTexture, 0);
+    AttachFramebuffer(app->forwardBuffer, &app->mainAttachmentTexture, 1, app->depthLightAttachmentTexture, 0);
+    AttachFramebuffer(app->compositeBuffer, &app->compositeTexture, 1, 0, 0);
 
-    glGenFramebuffers(1, &app->refractionBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->refractionBuffer);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtRefraction, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, app->rtRefractionDepth, 0);
+    // Half resolution light buffer, no depth, the upsample reads the G-buffer one
+    AttachFramebuffer(app->halfLightBuffer, &app->halfLightTexture, 1, 0, 0);
 
-    CheckFramebufferStatus();
+    // One framebuffer per bloom mip, the levels past the mip count stay detached
+    GLuint bloomColors[] = { app->rtBright, app->rtBloomH };
+    GLuint noColors[] = { 0, 0 };
+    for (u32 level = 0; level < BLOOM_MAX_MIPS; ++level)
+        AttachFramebuffer(app->bloomMipBuffers[level], (int)level < app->bloomMipCount ? bloomColors : noColors, ARRAY_COUNT(bloomColors), 0, level);
 
-    GLuint drawRefractionBuffer[] = { GL_COLOR_ATTACHMENT0 };
-    glDrawBuffers(ARRAY_COUNT(drawRefractionBuffer), drawRefractionBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    AttachFramebuffer(app->reflectionBuffer, &app->rtReflection, 1, app->rtReflectionDepth, 0);
+    AttachFramebuffer(app->refractionBuffer, &app->rtRefraction, 1, app->rtRefractionDepth, 0);
 
-	// Set default attachment
-	app->currentAttachment = "Main";
 	app->renderSelector["Color"] = app->colorAttachmentTexture;
 	app->renderSelector["WithoutBloom"] = app->mainAttachmentTexture;
-	app->renderSelector["Position"] = app->positionAttachmentTexture;
+	app->renderSelector["Position"] = app->gBufferDepthTexture;
 	app->renderSelector["Normal"] = app->normalAttachmentTexture;
-	app->renderSelector["Depth"] = app->depthAttachmentTexture;
-	app->renderSelector["Main"] = app->bloomAttachmentTexture;
+	app->renderSelector["Depth"] = app->gBufferDepthTexture;
+	app->renderSelector["Main"] = app->mainAttachmentTexture;
 	app->renderSelector["Reflection"] = app->rtReflection;
 	app->renderSelector["Refraction"] = app->rtRefraction;
 }
 
-void InitBloomMipmap(App* app) 
-{
-    // Bloom
-    if (app->rtBright != 0)
-        glDeleteTextures(1, &app->rtBright);
-	glGenTextures(1, &app->rtBright);
-	glBindTexture(GL_TEXTURE_2D, app->rtBright);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, MIPMAP_BASE_LEVEL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MIPMAP_MAX_LEVEL);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x/2, app->displaySize.y/2, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, app->displaySize.x / 4, app->displaySize.y / 4, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexImage2D(GL_TEXTURE_2D, 2, GL_RGBA16F, app->displaySize.x / 8, app->displaySize.y / 8, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexImage2D(GL_TEXTURE_2D, 3, GL_RGBA16F, app->displaySize.x / 16, app->displaySize.y / 16, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexImage2D(GL_TEXTURE_2D, 4, GL_RGBA16F, app->displaySize.x / 32, app->displaySize.y / 32, 0, GL_RGBA, GL_FLOAT, NULL);
-	//glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+void ResizeRenderTargets(App* app)
+{
+    // A collapsed or minimized Scene window reports an empty region, keep the last size
+    ivec2 size = app->sceneViewportSize;
+    if (size.x <= 0 || size.y <= 0 || size == app->displaySize)
+        return;
 
-	// Bloom Mipmap
-	if (app->rtBloomH != 0)
-		glDeleteTextures(1, &app->rtBloomH);
-	glGenTextures(1, &app->rtBloomH);
-	glBindTexture(GL_TEXTURE_2D, app->rtBloomH);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, MIPMAP_BASE_LEVEL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, MIPMAP_MAX_LEVEL);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x / 2, app->displaySize.y / 2, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, app->displaySize.x / 4, app->displaySize.y / 4, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 2, GL_RGBA16F, app->displaySize.x / 8, app->displaySize.y / 8, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 3, GL_RGBA16F, app->displaySize.x / 16, app->displaySize.y / 16, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexImage2D(GL_TEXTURE_2D, 4, GL_RGBA16F, app->displaySize.x / 32, app->displaySize.y / 32, 0, GL_RGBA, GL_FLOAT, NULL);
-	//glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // The frame graph asks for the new size, the old targets idle out of the pool
+    app->displaySize = size;
+
+    app->camera.aspectRatio = (float)size.x / (float)size.y;
+    app->camera.projection = glm::perspective(glm::radians(app->camera.fov), app->camera.aspectRatio, app->camera.zNear, app->camera.zFar);
+
+    UpdateRenderSize(app);
+}
+
+void UpdateRenderSize(App* app)
+{
+    // Only the deferred path ends in the composite that scales back up
+    if (app->mode == Mode_Deferred)
+        app->renderSize = DynamicResolution::ScaledSize(app->dynamicResolution, app->displaySize);
+    else
+        app->renderSize = app->displaySize;
 }
 
 unsigned int LoadCubemap(std::vector<std::string> faces)
@@ -728,51 +863,6 @@ unsigned int LoadCubemap(std::vector<std::string> faces)
     return textureID;
 }
 
-void GenBloomFramebuffers(App* app) 
-{
-    GLuint drawBuffersBloom[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-    glGenFramebuffers(1, &app->fboBloom1);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom1);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtBright, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, app->rtBloomH, 0);
-    CheckFramebufferStatus();
-   
-    glDrawBuffers(ARRAY_COUNT(drawBuffersBloom), drawBuffersBloom);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glGenFramebuffers(1, &app->fboBloom2);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom2);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtBright, 1);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, app->rtBloomH, 1);
-    CheckFramebufferStatus();
-    glDrawBuffers(ARRAY_COUNT(drawBuffersBloom), drawBuffersBloom);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glGenFramebuffers(1, &app->fboBloom3);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom3);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtBright, 2);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, app->rtBloomH, 2);
-    CheckFramebufferStatus();
-    glDrawBuffers(ARRAY_COUNT(drawBuffersBloom), drawBuffersBloom);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glGenFramebuffers(1, &app->fboBloom4);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom4);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtBright, 3);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, app->rtBloomH, 3);
-    CheckFramebufferStatus();
-    glDrawBuffers(ARRAY_COUNT(drawBuffersBloom), drawBuffersBloom);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    glGenFramebuffers(1, &app->fboBloom5);
-    glBindFramebuffer(GL_FRAMEBUFFER, app->fboBloom5);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->rtBright, 4);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, app->rtBloomH, 4);
-    CheckFramebufferStatus();
-    glDrawBuffers(ARRAY_COUNT(drawBuffersBloom), drawBuffersBloom);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
 void CheckFramebufferStatus() {
     GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
@@ -797,8 +887,6 @@ void PassBlur(App* app, u32 fbo, int w, int h, GLenum colorAttachment, GLuint te
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glDrawBuffers(1, &colorAttachment);
 	glViewport(0, 0, w, h);
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glDisable(GL_DEPTH_TEST);
 	glDisable(GL_BLEND);
@@ -814,8 +902,8 @@ void PassBlur(App* app, u32 fbo, int w, int h, GLenum colorAttachment, GLuint te
 
 	glUniform1i(app->colorMap, 0);
     glUniform2f(app->dir, dirX, dirY);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 3, app->blurKernelBuffer);
 	glUniform1i(app->inputLod, inputLod);
-	glUniform1i(app->kernelRadius, app->kernelRad);
 	glUniform1f(app->inputLodIntensity, inputLodIntensity);
 
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
@@ -830,62 +918,88 @@ void PassBlitBrightPixels(App* app, u32 fbo, int w, int h, GLenum colorAttachmen
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
     glDrawBuffers(1, &colorAttachment);
     glViewport(0, 0, w, h);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	Program& blitBrightestPixelProgram = app->programs[app->blitBrightestPixelProgramIdx];
 	glUseProgram(blitBrightestPixelProgram.handle);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
 	glBindVertexArray(app->vao);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
 
     glUniform1i(app->colorTexture, 0);
     glUniform1f(app->threshold, threshold);
+    glUniform2f(app->blitBrightestProgram_uRenderScale, (float)app->renderSize.x / app->displaySize.x, (float)app->renderSize.y / app->displaySize.y);
 
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
     glBindVertexArray(0);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glUseProgram(0);
 }
 
-void PassBloom(App* app, u32 fbo, GLenum colorAttachment, GLuint texture, int maxLod)
+CompositeView GetCompositeView(const std::string& attachment)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glDrawBuffers(1, &colorAttachment);
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (attachment == "Main")
+        return CompositeView_Main;
+    if (attachment == "Position")
+        return CompositeView_Position;
+    if (attachment == "Normal")
+        return CompositeView_Normal;
+    if (attachment == "Depth")
+        return CompositeView_Depth;
+    return CompositeView_Texture;
+}
 
-    glDisable(GL_DEPTH);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
+void PassComposite(App* app)
+{
+    CompositeView view = GetCompositeView(app->currentAttachment);
+    CompositeProgram& compositeProgram = app->compositePrograms[view];
+
+    glBindFramebuffer(GL_FRAMEBUFFER, app->compositeBuffer);
+    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
 
-    Program& bloomProgram = app->programs[app->bloomProgramIdx];
-    glUseProgram(bloomProgram.handle);
+    glUseProgram(app->programs[compositeProgram.programIdx].handle);
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, app->mainAttachmentTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, texture);
+    glBindTexture(GL_TEXTURE_2D, app->renderSelector[app->currentAttachment]);
+    glUniform1i(compositeProgram.uSource, 0);
+    glUniform2f(compositeProgram.uSourceScale, (float)app->renderSize.x / app->displaySize.x, (float)app->renderSize.y / app->displaySize.y);
+
+    if (view == CompositeView_Main)
+    {
+        // The Gaussian chain averages its blurred levels, the upsample chain has summed them into level 0
+        bool gaussianBloom = app->bloomFilter == BloomFilter_Gaussian;
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, app->rtBright);
+        glUniform1i(compositeProgram.uBloom, 1);
+        glUniform1i(compositeProgram.uBloomLevels, gaussianBloom ? app->bloomMipCount : 1);
+        glUniform1f(compositeProgram.uBloomScale, 1.0f / app->bloomMipCount);
+    }
+    else if (view != CompositeView_Texture)
+    {
+        glm::mat4 inverseViewProjection = glm::inverse(app->camera.projection * app->camera.view);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, app->gBufferDepthTexture);
+        glUniform1i(compositeProgram.uDepth, 1);
+        glUniformMatrix4fv(compositeProgram.uInverseViewProjection, 1, GL_FALSE, &inverseViewProjection[0][0]);
+        glUniform1f(compositeProgram.uNear, app->camera.zNear);
+        glUniform1f(compositeProgram.uFar, app->camera.zFar);
+        glUniform2f(compositeProgram.uViewportSize, (float)app->renderSize.x, (float)app->renderSize.y);
+    }
 
     glBindVertexArray(app->vao);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
-
-	glUniform1i(app->mainTexture, 0); 
-    glUniform1i(app->colorMapBlend, 1);
-    glUniform1i(app->maxLod, maxLod);
-
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
     glBindVertexArray(0);
 
-	glEnable(GL_DEPTH);
+    glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
     glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 GLuint CreateTextureAttachment(GLenum internalFormat, GLenum format, GLenum type, int width, int height) 
@@ -946,6 +1060,17 @@ void Gui(App* app)
     ImGui::Begin("Info");
     ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
     ImGui::Text("%s", app->openGLInfo.c_str());
+
+    if (ImGui::CollapsingHeader("Profiler", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Text("Occlusion queries: %u", app->occlusionQueriesIssued);
+        ImGui::Text("Visible: %u  Hidden: %u  Pending: %u", app->occlusionQueryHits, app->occlusionQueryMisses, app->occlusionQueriesPending);
+        ImGui::Text("Triangles: %u full detail, %u with LODs", app->lodTrianglesFull, app->lodTrianglesDrawn);
+        ImGui::Text("Render size: %d x %d", app->renderSize.x, app->renderSize.y);
+        ImGui::Text("Render targets: %u (%.1f MB)", RenderTargetPool::GetTargetCount(app->renderTargetPool),
+            RenderTargetPool::GetAllocatedBytes(app->renderTargetPool) / (1024.0f * 1024.0f));
+        ImGui::Text("Frame graph: %u of %u passes, %.1f MB (%.1f MB without aliasing)", (u32)app->frameGraph.order.size(), (u32)app->frameGraph.passes.size(),
+            FrameGraph::GetAllocatedBytes(app->frameGraph) / (1024.0f * 1024.0f), FrameGraph::GetUnaliasedBytes(app->frameGraph) / (1024.0f * 1024.0f));
+    }
     ImGui::End();
 
     // Inspector
@@ -994,14 +1119,162 @@ void Gui(App* app)
 	ImGui::Checkbox("Show Debug Lights", &app->showDebugLights);
     ImGui::Separator();
 
+    if (ImGui::CollapsingHeader("Culling", ImGuiTreeNodeFlags_DefaultOpen)) {
+        if (ImGui::Checkbox("Software Occlusion Culling", &app->enableSoftwareOcclusion) && !app->enableSoftwareOcclusion) {
+            for (u32 i = 0; i < app->entities.size(); ++i)
+                app->entities[i].occluded = false;
+            app->occlusionCulledCount = 0;
+        }
+        ImGui::Text("Occluded entities: %u / %u", app->occlusionCulledCount, (u32)app->entities.size());
+        ImGui::Checkbox("GPU Occlusion Queries", &app->enableOcclusionQueries);
+        ImGui::Text("Query Triangle Threshold");
+        ImGui::SameLine();
+        ImGui::InputInt("##Query Triangle Threshold", &app->occlusionQueryTriangleThreshold, 1000, 10000);
+        app->occlusionQueryTriangleThreshold = glm::max(app->occlusionQueryTriangleThreshold, 0);
+    }
+    ImGui::Separator();
+
+    ImGui::Text("Forward lights");
+    const char* forwardLightLists[] = { "All", "Clustered", "Per Object" };
+    int currentForwardLightList = (int)app->forwardLightList;
+    if (ImGui::Combo("##Forward Lights", &currentForwardLightList, forwardLightLists, ARRAY_COUNT(forwardLightLists)))
+        app->forwardLightList = (ForwardLightList)currentForwardLightList;
+    if (app->forwardLightList == ForwardLightList_PerObject)
+        ImGui::Text("Object lights: %u (max %u per entity)", app->objectLightsAssigned, MAX_OBJECT_LIGHTS);
+    ImGui::Text("Lighting path");
+    const char* lightingPaths[] = { "Fullscreen Quad", "Tiled Compute", "Light Volumes" };
+    int currentLightingPath = (int)app->lightingPath;
+    if (ImGui::Combo("##Lighting Path", &currentLightingPath, lightingPaths, ARRAY_COUNT(lightingPaths)))
+        app->lightingPath = (LightingPath)currentLightingPath;
+    ImGui::Checkbox("Half Resolution Lighting", &app->halfResolutionLighting);
+    if (app->halfResolutionLighting && app->lightingPath == LightingPath_LightVolumes)
+        ImGui::Text("Light volumes shade at full resolution");
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Contribution Culling", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Checkbox("Enable Contribution Culling", &app->enableContributionCulling);
+        const char* passNames[WATER_SCENE_PART_COUNT] = { "Reflection", "Refraction", "Main" };
+        for (int i = 0; i < WATER_SCENE_PART_COUNT; ++i) {
+            ImGui::Text("%s Min Area (px)", passNames[i]);
+            ImGui::SameLine();
+            ImGui::DragFloat((std::string("##Contribution ") + passNames[i]).c_str(), &app->contributionCullPixels[i], 1.0f, 0.0f, 100000.0f);
+            ImGui::Text("Culled: %u", app->contributionCulledCount[i]);
+        }
+    }
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Mesh LOD", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Checkbox("Enable LODs", &app->enableLods);
+        for (int i = 0; i < MAX_MESH_LODS - 1; ++i) {
+            ImGui::Text("LOD %d Below Screen Size", i + 1);
+            ImGui::SameLine();
+            ImGui::SliderFloat(("##LOD Screen Size " + std::to_string(i + 1)).c_str(), &app->lodScreenSizes[i], 0.0f, 1.0f);
+        }
+        ImGui::Text("Hysteresis");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##LOD Hysteresis", &app->lodHysteresis, 0.0f, 0.5f);
+        ImGui::Text("Water View Size Scale");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##LOD Water View Scale", &app->lodWaterViewScale, 0.1f, 1.0f);
+    }
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Lightmaps", ImGuiTreeNodeFlags_DefaultOpen)) {
+        if (ImGui::Checkbox("Use Lightmaps", &app->useLightmaps))
+            app->lightsDirty = true;
+        ImGui::Text("Texels Per Unit");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##Lightmap Texel Density", &app->lightmapTexelDensity, 0.25f, 32.0f);
+        ImGui::Text("Max Atlas Size");
+        ImGui::SameLine();
+        ImGui::InputInt("##Atlas Size", &app->lightmapSize, 256, 1024);
+        app->lightmapSize = glm::clamp(app->lightmapSize, 64, 4096);
+        ImGui::Text("Samples");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Lightmap Samples", &app->lightmapSamples, 0, 512);
+        ImGui::Text("Bounces");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Lightmap Bounces", &app->lightmapBounces, 0, 4);
+        if (ImGui::Button("Bake"))
+            BakeLightmaps(app);
+        if (app->lightmapsBaked)
+            ImGui::Text("Baked in %.2f s", app->lightmapBakeSeconds);
+        else if (app->lightmapAtlasFull)
+            ImGui::Text("Atlas too small for the density, not baked");
+        else
+            ImGui::Text("Not baked");
+    }
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Irradiance Probes", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Checkbox("Use Probes", &app->useProbes);
+        ImGui::Text("Sky Ambient");
+        ImGui::SameLine();
+        ImGui::ColorEdit3("##Sky Ambient", &app->skyAmbient[0], ImGuiColorEditFlags_Float);
+        ImGui::Text("Spacing");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##Probe Spacing", &app->probeSpacing, 0.5f, 16.0f);
+        if (ImGui::IsItemDeactivatedAfterEdit())
+            app->probesDirty = true;
+        ImGui::Text("Rays");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Probe Rays", &app->probeRayCount, 16, 1024);
+        ImGui::Text("Updates Per Frame");
+        ImGui::SameLine();
+        ImGui::SliderInt("##Probe Updates", &app->probeUpdatesPerFrame, 0, 64);
+        if (ImGui::Button("Rebuild"))
+            app->probesDirty = true;
+        const IrradianceProbes::ProbeGrid& grid = app->probeGrid;
+        ImGui::Text("%u x %u x %u probes, traced in %.2f s", grid.dims.x, grid.dims.y, grid.dims.z, app->probeBuildSeconds);
+    }
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Depth Prepass", ImGuiTreeNodeFlags_DefaultOpen)) {
+        ImGui::Checkbox("Forward Prepass", &app->depthPrepassForward);
+        ImGui::Checkbox("Deferred Prepass", &app->depthPrepassDeferred);
+        ImGui::Checkbox("Auto Select From Overdraw", &app->depthPrepassAuto);
+        ImGui::Text("Overdraw Threshold");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##Overdraw Threshold", &app->depthPrepassOverdrawThreshold, 1.0f, 4.0f);
+        ImGui::Text("Measured overdraw: %.2f", app->measuredOverdraw);
+    }
+    ImGui::Separator();
+
+    if (ImGui::CollapsingHeader("Dynamic Resolution", ImGuiTreeNodeFlags_DefaultOpen)) {
+        DynamicResolution::Controller& dynamicResolution = app->dynamicResolution;
+        ImGui::Checkbox("Enable Dynamic Resolution", &dynamicResolution.enabled);
+        ImGui::Text("Target GPU time (ms)");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##Target GPU time", &dynamicResolution.targetMs, 4.0f, 33.0f);
+        ImGui::Text("Minimum scale");
+        ImGui::SameLine();
+        ImGui::SliderFloat("##Minimum scale", &dynamicResolution.minScale, 0.5f, 1.0f);
+        ImGui::Text("GPU time: %.2f ms", dynamicResolution.measuredMs);
+        ImGui::Text("Scale: %.0f%% (%d x %d)", dynamicResolution.scale * 100.0f, app->renderSize.x, app->renderSize.y);
+    }
+    ImGui::Separator();
+
     if (ImGui::CollapsingHeader("Bloom Variables", ImGuiTreeNodeFlags_DefaultOpen)) {
         ImGui::Text("Bloom Threshold");
         ImGui::SameLine();
         ImGui::SliderFloat("##Bloom Threshold", &app->valThreshold, 0.0f, 1.0f);
-        ImGui::Text("Kernel Radius");
+        ImGui::Text("Filter");
+        ImGui::SameLine();
+        const char* bloomFilters[] = { "Gaussian", "Downsample/Upsample" };
+        int currentBloomFilter = (int)app->bloomFilter;
+        if (ImGui::Combo("##Bloom Filter", &currentBloomFilter, bloomFilters, ARRAY_COUNT(bloomFilters)))
+            app->bloomFilter = (BloomFilter)currentBloomFilter;
+        ImGui::Text("Mip Count");
         ImGui::SameLine();
-        ImGui::InputInt("##Kernel Raduis", &app->kernelRad, 1, 72);
-        for (int i = 0; i < 5; ++i) {
+        ImGui::SliderInt("##Bloom Mip Count", &app->bloomMipCount, 1, BLOOM_MAX_MIPS);
+        if (app->bloomFilter == BloomFilter_Gaussian) {
+            ImGui::Text("Kernel Radius");
+            ImGui::SameLine();
+            ImGui::InputInt("##Kernel Raduis", &app->kernelRad, 1, 72);
+            app->kernelRad = glm::clamp(app->kernelRad, 1, BLUR_KERNEL_MAX_RADIUS);
+            ImGui::Checkbox("Compute Blur", &app->computeBloomBlur);
+        }
+        for (int i = 0; i < app->bloomMipCount; ++i) {
             ImGui::Text("LOD %d Intensity", i);
             ImGui::SameLine();
             ImGui::SliderFloat(("##LOD " + std::to_string(i) + " Intensity").c_str(), &app->intensities[i], 0.0f, 4.0f);
@@ -1014,6 +1287,9 @@ void Gui(App* app)
 
     if (ImGui::CollapsingHeader("Water Plane", ImGuiTreeNodeFlags_DefaultOpen)) {
 		ImGui::Checkbox("Enable Water Plane", &app->enableWaterPlane);
+		ImGui::Checkbox("Water Occlusion Query", &app->enableWaterOcclusionQuery);
+		ImGui::Text("Reflection/Refraction passes: %s", app->waterPassesRendered ? "rendered" : "skipped");
+		ImGui::Text("Plane culled entities: %u reflection, %u refraction", app->waterPlaneCulledCount[0], app->waterPlaneCulledCount[1]);
 		ImGui::Text("Position: ");
 		ImGui::DragFloat3("##Water Position", &app->waterPos[0], 0.5f, true);
 
@@ -1027,10 +1303,16 @@ void Gui(App* app)
     ImGui::End();
 
     if (ImGui::Begin("Scene")) {
-        if(app->mode == Mode_Deferred)
-            ImGui::Image((ImTextureID)app->renderSelector[app->currentAttachment], ImGui::GetContentRegionAvail(), ImVec2(0, 1), ImVec2(1, 0));
+        // Picked up by ResizeRenderTargets at the start of the next Update
+        ImVec2 region = ImGui::GetContentRegionAvail();
+        app->sceneViewportSize = ivec2((i32)region.x, (i32)region.y);
+
+        // Everything but the composite only fills the renderSize corner of its target
+        ImVec2 renderScale((float)app->renderSize.x / app->displaySize.x, (float)app->renderSize.y / app->displaySize.y);
+        if (app->mode == Mode_Deferred)
+            ImGui::Image((ImTextureID)app->compositeTexture, ImGui::GetContentRegionAvail(), ImVec2(0, 1), ImVec2(1, 0));
 		else if (app->mode == Mode_Forward)
-			ImGui::Image((ImTextureID)app->mainAttachmentTexture, ImGui::GetContentRegionAvail(), ImVec2(0, 1), ImVec2(1, 0));
+			ImGui::Image((ImTextureID)app->mainAttachmentTexture, ImGui::GetContentRegionAvail(), ImVec2(0, renderScale.y), ImVec2(renderScale.x, 0));
     }
 	ImGui::End();
 
@@ -1040,261 +1322,645 @@ void Gui(App* app)
 void Update(App* app)
 {
     // You can handle app->input keyboard/mouse here
+    ResizeRenderTargets(app);
+
     CameraMovement(app);
 	CameraLookAt(app);
 
+    if (app->enableSoftwareOcclusion)
+        UpdateSoftwareOcclusion(app);
+
+    UploadLights(app);
+    UpdateProbes(app);
+    UploadBlurKernel(app);
     AlignUniformBuffers(app, app->camera, false);
 }
 
 void Render(App* app)
 {
+    DynamicResolution::BeginFrame(app->dynamicResolution);
+    UpdateOverdrawMeasure(app);
+
+    app->occlusionQueriesIssued = 0;
+    app->occlusionQueryHits = 0;
+    app->occlusionQueryMisses = 0;
+    app->occlusionQueriesPending = 0;
+    app->lodTrianglesFull = 0;
+    app->lodTrianglesDrawn = 0;
+    for (u32 i = 0; i < WATER_SCENE_PART_COUNT; ++i)
+        app->contributionCulledCount[i] = 0;
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
 
-    switch (app->mode)
-    {
-        case Mode_Forward:
-        {
-            // Geometry Pass
-			glBindFramebuffer(GL_FRAMEBUFFER, app->forwardBuffer);
-            glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    BuildFrameGraph(app);
+    FrameGraph::Compile(app->frameGraph);
+    FrameGraph::Acquire(app->frameGraph, app->renderTargetPool);
+    AttachRenderTargets(app);
+    FrameGraph::Execute(app->frameGraph);
+    FrameGraph::Release(app->frameGraph, app->renderTargetPool);
 
-			glEnable(GL_DEPTH_TEST);
+    RenderTargetPool::EndFrame(app->renderTargetPool);
 
-            Program& forwardProgram = app->programs[app->forwardProgramIdx];
-            glUseProgram(forwardProgram.handle);
+    // Picks the scale of the next frame, the Gui shows it with the same size
+    DynamicResolution::EndFrame(app->dynamicResolution);
+    DynamicResolution::Update(app->dynamicResolution);
+    UpdateRenderSize(app);
+}
 
-            glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+void BuildFrameGraph(App* app)
+{
+    FrameGraph::Graph& graph = app->frameGraph;
+    FrameGraph::Reset(graph);
+
+    ivec2 size = app->displaySize;
+    ivec2 halfSize = (size + 1) / 2;
+
+    // Every texture is declared, the ones no pass touches this frame get no memory and a 0 binding
+    RenderTargetPool::TargetDesc colorDesc = RenderTargetPool::Desc(GL_RGBA16F, GL_RGBA, GL_FLOAT, size.x, size.y);
+    RenderTargetPool::TargetDesc filteredColorDesc = RenderTargetPool::Desc(GL_RGBA16F, GL_RGBA, GL_FLOAT, size.x, size.y, 1, GL_LINEAR, GL_LINEAR);
+    RenderTargetPool::TargetDesc depthDesc = RenderTargetPool::Desc(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, size.x, size.y);
+    RenderTargetPool::TargetDesc bloomMipDesc = RenderTargetPool::Desc(GL_RGBA16F, GL_RGBA, GL_FLOAT, size.x / 2, size.y / 2,
+        app->bloomMipCount, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR);
+
+    // G-buffer: RGBA8 albedo, RG16 octahedral normals and the baked light, positions come from the depth
+    u32 albedo = FrameGraph::CreateTexture(graph, "Albedo", RenderTargetPool::Desc(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, size.x, size.y), &app->colorAttachmentTexture);
+    u32 normal = FrameGraph::CreateTexture(graph, "Normal", RenderTargetPool::Desc(GL_RG16, GL_RG, GL_UNSIGNED_SHORT, size.x, size.y), &app->normalAttachmentTexture);
+    u32 bakedLight = FrameGraph::CreateTexture(graph, "Baked Light", colorDesc, &app->bakedLightAttachmentTexture);
+    u32 gBufferDepth = FrameGraph::CreateTexture(graph, "G-Buffer Depth", depthDesc, &app->gBufferDepthTexture);
+
+    // Filtered for the bright pass and the upscale in the composite
+    u32 mainColor = FrameGraph::CreateTexture(graph, "Main", filteredColorDesc, &app->mainAttachmentTexture);
+    u32 composite = FrameGraph::CreateTexture(graph, "Composite", filteredColorDesc, &app->compositeTexture);
+    u32 depthLight = FrameGraph::CreateTexture(graph, "Light Depth", depthDesc, &app->depthLightAttachmentTexture);
+    u32 halfLight = FrameGraph::CreateTexture(graph, "Half Light", RenderTargetPool::Desc(GL_RGBA16F, GL_RGBA, GL_FLOAT, halfSize.x, halfSize.y), &app->halfLightTexture);
+
+    // bloomMipCount halving levels starting at half the render size
+    u32 bright = FrameGraph::CreateTexture(graph, "Bright", bloomMipDesc, &app->rtBright);
+    u32 bloomH = FrameGraph::CreateTexture(graph, "Bloom Horizontal", bloomMipDesc, &app->rtBloomH);
+
+    // Same descriptions as the mainColor, composite and light depth targets, which they hand their memory to
+    u32 reflection = FrameGraph::CreateTexture(graph, "Reflection", filteredColorDesc, &app->rtReflection);
+    u32 refraction = FrameGraph::CreateTexture(graph, "Refraction", filteredColorDesc, &app->rtRefraction);
+    u32 reflectionDepth = FrameGraph::CreateTexture(graph, "Reflection Depth", depthDesc, &app->rtReflectionDepth);
+    u32 refractionDepth = FrameGraph::CreateTexture(graph, "Refraction Depth", depthDesc, &app->rtRefractionDepth);
+
+    if (app->mode == Mode_Forward)
+    {
+        u32 pass = FrameGraph::AddPass(graph, "Forward", [app]() { PassForward(app); });
+        FrameGraph::Write(graph, pass, mainColor, FrameGraph::Access_RenderTarget);
+        FrameGraph::Write(graph, pass, depthLight, FrameGraph::Access_RenderTarget);
 
-            for (auto it = app->entities.begin(); it != app->entities.end(); ++it) {
-                glBindBufferRange(GL_UNIFORM_BUFFER, 1, app->localUniformBuffer.handle, it->localParamsOffset, it->localParamsSize);
+        FrameGraph::MarkOutput(graph, mainColor);
+        return;
+    }
 
-                Model& model = app->models[it->modelIndex];
-                Mesh& mesh = app->meshes[model.meshIdx];
+    // Passes nothing on screen depends on are culled by the graph: the water textures when
+    // the surface does not use them, everything after the G-buffer in the attachment viewer
+    bool renderWaterPasses = UpdateWaterVisibility(app);
 
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
-                    GLuint vao = FindVAO(mesh, i, forwardProgram);
-                    glBindVertexArray(vao);
+    u32 pass = FrameGraph::AddPass(graph, "Water Reflection", [app]() { PassWaterReflection(app); });
+    FrameGraph::Write(graph, pass, reflection, FrameGraph::Access_RenderTarget);
+    FrameGraph::Write(graph, pass, reflectionDepth, FrameGraph::Access_RenderTarget);
 
-                    u32 submeshMaterialIdx = model.materialIdx[i];
-                    Material& submeshMaterial = app->materials[submeshMaterialIdx];
+    pass = FrameGraph::AddPass(graph, "Water Refraction", [app]() { PassWaterRefraction(app); });
+    FrameGraph::Write(graph, pass, refraction, FrameGraph::Access_RenderTarget);
+    FrameGraph::Write(graph, pass, refractionDepth, FrameGraph::Access_RenderTarget);
 
+    u32 gBufferTargets[] = { albedo, normal, bakedLight, gBufferDepth };
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                    glUniform1i(app->forwardProgram_uTexture, 0);
+    pass = FrameGraph::AddPass(graph, "G-Buffer", [app]() { DrawScene(app, app->texturedMeshProgramIdx, app->gBuffer, app->camera, WaterScenePart::NONE); });
+    for (u32 target : gBufferTargets)
+        FrameGraph::Write(graph, pass, target, FrameGraph::Access_RenderTarget);
 
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+    if (app->waterInView)
+    {
+        pass = FrameGraph::AddPass(graph, "Water Surface", [app, renderWaterPasses]() { PassWaterSurface(app, renderWaterPasses); });
+        if (renderWaterPasses) {
+            FrameGraph::Read(graph, pass, reflection, FrameGraph::Access_Texture);
+            FrameGraph::Read(graph, pass, reflectionDepth, FrameGraph::Access_Texture);
+            FrameGraph::Read(graph, pass, refraction, FrameGraph::Access_Texture);
+            FrameGraph::Read(graph, pass, refractionDepth, FrameGraph::Access_Texture);
+        }
+        for (u32 target : gBufferTargets)
+            FrameGraph::Write(graph, pass, target, FrameGraph::Access_RenderTarget);
+    }
 
-					glBindVertexArray(0);
-                }
-            }
+	// Light Pass. When fused the tiled lighting also writes level 0 of the bloom chain.
+    bool halfResolution = IsLightingHalfResolution(app);
+    bool fusedThreshold = IsBloomThresholdFused(app);
+    u32 lightTarget = halfResolution ? halfLight : mainColor;
+    if (app->lightingPath == LightingPath_TiledCompute) {
+        pass = FrameGraph::AddPass(graph, "Tiled Lighting", [app]() { PassTiledLighting(app); });
+        FrameGraph::Write(graph, pass, lightTarget, FrameGraph::Access_Image);
+        if (fusedThreshold)
+            FrameGraph::Write(graph, pass, bright, FrameGraph::Access_Image);
+    }
+    else if (app->lightingPath == LightingPath_LightVolumes) {
+        pass = FrameGraph::AddPass(graph, "Light Volumes", [app]() { PassLightVolumes(app); });
+        FrameGraph::Read(graph, pass, gBufferDepth, FrameGraph::Access_RenderTarget);
+        FrameGraph::Write(graph, pass, lightTarget, FrameGraph::Access_RenderTarget);
+        FrameGraph::Write(graph, pass, depthLight, FrameGraph::Access_RenderTarget);
+    }
+    else {
+        pass = FrameGraph::AddPass(graph, "Lighting", [app]() { PassLighting(app); });
+        FrameGraph::Write(graph, pass, lightTarget, FrameGraph::Access_RenderTarget);
+    }
+    for (u32 target : gBufferTargets)
+        FrameGraph::Read(graph, pass, target, FrameGraph::Access_Texture);
 
-			glUseProgram(0);
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (halfResolution)
+    {
+        pass = FrameGraph::AddPass(graph, "Light Upsample", [app]() { PassLightUpsample(app); });
+        FrameGraph::Read(graph, pass, halfLight, FrameGraph::Access_Texture);
+        for (u32 target : gBufferTargets)
+            FrameGraph::Read(graph, pass, target, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, mainColor, FrameGraph::Access_RenderTarget);
+    }
 
-        }
-        break;
-        case Mode_Deferred:
-        {
-            // Water textures
-			// Reflection
-			glBindFramebuffer(GL_FRAMEBUFFER, app->reflectionBuffer);
-			Camera reflectionCamera = app->camera;
-			reflectionCamera.position.y = 2 * (app->camera.position.y - app->waterPos.y); 
-			reflectionCamera.pitch *= -1.0f; 
-			CameraDirection(reflectionCamera);
-			reflectionCamera.view = glm::lookAt(reflectionCamera.position, reflectionCamera.position + reflectionCamera.front, reflectionCamera.up);
-
-			AlignUniformBuffers(app, reflectionCamera, true);
-
-            PassWaterScene(app,reflectionCamera, app->reflectionBuffer, WaterScenePart::REFLECTION);
-			RenderSkybox(app, reflectionCamera);
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-            // Refraction
-			glBindFramebuffer(GL_FRAMEBUFFER, app->refractionBuffer);
-
-			Camera refractionCamera = app->camera;
-			AlignUniformBuffers(app, refractionCamera, false);
-			PassWaterScene(app,refractionCamera, app->refractionBuffer, WaterScenePart::REFRACTION);
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-			// Geometry Pass
-            DrawScene(app, app->texturedMeshProgramIdx, app->gBuffer, app->camera, WaterScenePart::NONE);
-
-            // Render water
-            if (app->enableWaterPlane) 
-            {
-                Program& waterProgram = app->programs[app->waterProgramIdx];
-                glUseProgram(waterProgram.handle);
-
-                u32 waterMeshIdx = app->primitiveIdxs[4];
-                Mesh& waterMesh = app->meshes[app->models[waterMeshIdx].meshIdx];
-                GLuint vao = FindVAO(waterMesh, 0, waterProgram);
-
-                glm::mat4 waterMatrix = TransformPositionRotationScale(app->waterPos, glm::vec3(0.0), app->waterScale);
-                waterMatrix = app->camera.view * waterMatrix;
-                app->moveFactor += app->waterMoveSpeed * app->deltaTime;
-                app->moveFactor = std::fmod(app->moveFactor, 1.0f); // Keep moveFactor in range [0, 1]
-
-                glBindVertexArray(vao);
-                glUniformMatrix4fv(app->waterProgram_uProjection, 1, GL_FALSE, &app->camera.projection[0][0]);
-                glUniformMatrix4fv(app->waterProgram_uView, 1, GL_FALSE, &waterMatrix[0][0]);
-                glUniform2f(app->waterProgram_viewportSize, app->displaySize.x, app->displaySize.y);
-                glUniformMatrix4fv(app->waterProgram_uViewInverse, 1, GL_FALSE, &glm::inverse(waterMatrix)[0][0]);
-                glUniformMatrix4fv(app->waterProgram_uProjectionInverse, 1, GL_FALSE, &glm::inverse(app->camera.projection)[0][0]);
-                glUniform1f(app->waterProgram_moveFactor, app->moveFactor);
-                // Bind textures
-                glUniform1i(app->waterProgram_uReflectionMap, 0);
-                glUniform1i(app->waterProgram_uReflectionDepth, 1);
-                glUniform1i(app->waterProgram_uRefractionMap, 2);
-                glUniform1i(app->waterProgram_uRefractionDepth, 3);
-                glUniform1i(app->waterProgram_normalMap, 4);
-                glUniform1i(app->waterProgram_dudvMap, 5);
-
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, app->rtReflection);
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, app->rtReflectionDepth);
-                glActiveTexture(GL_TEXTURE2);
-                glBindTexture(GL_TEXTURE_2D, app->rtRefraction);
-                glActiveTexture(GL_TEXTURE3);
-                glBindTexture(GL_TEXTURE_2D, app->rtRefractionDepth);
-                glActiveTexture(GL_TEXTURE4);
-                GLuint normalWaterHandle = app->textures[app->normalWaterTex].handle;
-                glBindTexture(GL_TEXTURE_2D, normalWaterHandle);
-                glActiveTexture(GL_TEXTURE5);
-                GLuint dudvWaterHandle = app->textures[app->dudvWaterTex].handle;
-                glBindTexture(GL_TEXTURE_2D, dudvWaterHandle);
-
-                glDrawElements(GL_TRIANGLES, waterMesh.submeshes[0].indices.size(), GL_UNSIGNED_INT, 0);
-                glBindVertexArray(0);
-                glUseProgram(0);
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            }
-			
+    pass = FrameGraph::AddPass(graph, "Skybox", [app]() { PassSkybox(app); });
+    if (app->lightingPath != LightingPath_LightVolumes) {
+        FrameGraph::Read(graph, pass, gBufferDepth, FrameGraph::Access_RenderTarget);
+        FrameGraph::Write(graph, pass, depthLight, FrameGraph::Access_RenderTarget);
+    }
+    else {
+        FrameGraph::Read(graph, pass, depthLight, FrameGraph::Access_RenderTarget);
+    }
+    if (!fusedThreshold)
+        FrameGraph::Write(graph, pass, mainColor, FrameGraph::Access_RenderTarget);
+
+    // Blur/Bloom. Level 0 of the chain comes from the tiled lighting when fused, from the
+    // bright pass otherwise.
+    bool gaussianBloom = app->bloomFilter == BloomFilter_Gaussian;
+    if (!fusedThreshold) {
+        pass = FrameGraph::AddPass(graph, "Bright Pixels", [app]() {
+            ivec2 mipSize = BloomMipSize(app, 0);
+            PassBlitBrightPixels(app, app->bloomMipBuffers[0], mipSize.x, mipSize.y, GL_COLOR_ATTACHMENT0, app->mainAttachmentTexture, app->valThreshold);
+        });
+        FrameGraph::Read(graph, pass, mainColor, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bright, FrameGraph::Access_RenderTarget);
+    }
 
-			// Light Pass
-			glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
+    // The down/upsample chain makes its own levels
+    if (gaussianBloom) {
+        pass = FrameGraph::AddPass(graph, "Bloom Mips", [app]() {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, app->rtBright);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        });
+        FrameGraph::Read(graph, pass, bright, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bright, FrameGraph::Access_RenderTarget);
+    }
 
-            glClearColor(0.0, 0.0, 0.0, 1.0);
-            glClear(GL_COLOR_BUFFER_BIT);
+    if (gaussianBloom && app->computeBloomBlur)
+    {
+        pass = FrameGraph::AddPass(graph, "Bloom Blur Horizontal", [app]() { PassBloomBlurCompute(app, app->rtBright, app->rtBloomH, 1, 0); });
+        FrameGraph::Read(graph, pass, bright, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bloomH, FrameGraph::Access_Image);
 
-			Program& lightProgram = app->programs[app->lightProgramIdx];
-			glUseProgram(lightProgram.handle);
+        pass = FrameGraph::AddPass(graph, "Bloom Blur Vertical", [app]() { PassBloomBlurCompute(app, app->rtBloomH, app->rtBright, 0, 1); });
+        FrameGraph::Read(graph, pass, bloomH, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bright, FrameGraph::Access_Image);
+    }
+    else if (gaussianBloom)
+    {
+        pass = FrameGraph::AddPass(graph, "Bloom Blur Horizontal", [app]() { PassBloomBlur(app, app->rtBright, GL_COLOR_ATTACHMENT1, 1, 0); });
+        FrameGraph::Read(graph, pass, bright, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bloomH, FrameGraph::Access_RenderTarget);
 
-			glBindVertexArray(app->vao);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
-			glUniform1i(app->lightProgram_uAlbedo, 6);
-			glUniform1i(app->lightProgram_uPosition, 7);
-			glUniform1i(app->lightProgram_uNormal, 8);
+        pass = FrameGraph::AddPass(graph, "Bloom Blur Vertical", [app]() { PassBloomBlur(app, app->rtBloomH, GL_COLOR_ATTACHMENT0, 0, 1); });
+        FrameGraph::Read(graph, pass, bloomH, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bright, FrameGraph::Access_RenderTarget);
+    }
+    else
+    {
+        pass = FrameGraph::AddPass(graph, "Bloom Downsample", [app]() { PassBloomDownsample(app); });
+        FrameGraph::Read(graph, pass, bright, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bright, FrameGraph::Access_RenderTarget);
 
-			glActiveTexture(GL_TEXTURE6);
-            glBindTexture(GL_TEXTURE_2D, app->colorAttachmentTexture);
-			glActiveTexture(GL_TEXTURE7);
-			glBindTexture(GL_TEXTURE_2D, app->positionAttachmentTexture);
-			glActiveTexture(GL_TEXTURE8);
-			glBindTexture(GL_TEXTURE_2D, app->normalAttachmentTexture);
+        pass = FrameGraph::AddPass(graph, "Bloom Upsample", [app]() { PassBloomUpsample(app); });
+        FrameGraph::Read(graph, pass, bright, FrameGraph::Access_Texture);
+        FrameGraph::Write(graph, pass, bright, FrameGraph::Access_RenderTarget);
+    }
 
-            //Bind uniforms
+    // After the bloom chain read the main color, so the lights do not bloom
+    if (app->showDebugLights && (app->currentAttachment == "Main" || app->currentAttachment == "WithoutBloom"))
+    {
+        pass = FrameGraph::AddPass(graph, "Debug Lights", [app]() { PassDebugLights(app); });
+        FrameGraph::Read(graph, pass, depthLight, FrameGraph::Access_RenderTarget);
+        FrameGraph::Write(graph, pass, mainColor, FrameGraph::Access_RenderTarget);
+    }
 
-			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-			glBindVertexArray(0);
+    // The Scene window shows the composite, which reads the picked target or unpacks the G-buffer
+    std::pair<const char*, u32> attachments[] = {
+        { "Color", albedo }, { "WithoutBloom", mainColor }, { "Position", gBufferDepth }, { "Normal", normal },
+        { "Depth", gBufferDepth }, { "Main", mainColor }, { "Reflection", reflection }, { "Refraction", refraction }
+    };
+    CompositeView view = GetCompositeView(app->currentAttachment);
+    pass = FrameGraph::AddPass(graph, "Composite", [app]() { PassComposite(app); });
+    for (const auto& attachment : attachments)
+        if (app->currentAttachment == attachment.first)
+            FrameGraph::Read(graph, pass, attachment.second, FrameGraph::Access_Texture);
+    if (view == CompositeView_Main)
+        FrameGraph::Read(graph, pass, bright, FrameGraph::Access_Texture);
+    else if (view != CompositeView_Texture)
+        FrameGraph::Read(graph, pass, gBufferDepth, FrameGraph::Access_Texture);
+    FrameGraph::Write(graph, pass, composite, FrameGraph::Access_RenderTarget);
+
+    FrameGraph::MarkOutput(graph, composite);
+}
 
-			glBindFramebuffer(GL_READ_FRAMEBUFFER, app->gBuffer);
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->lightBuffer);
+void PassForward(App* app)
+{
+    // Geometry Pass
+	glBindFramebuffer(GL_FRAMEBUFFER, app->forwardBuffer);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
 
-			glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-			glUseProgram(0);
+	glEnable(GL_DEPTH_TEST);
 
-            RenderSkybox(app, app->camera);
+    SetupViewEntities(app, app->camera, WaterScenePart::NONE);
 
-            // Blur/Bloom
-			PassBlitBrightPixels(app, app->fboBloom1, app->displaySize.x / 2, app->displaySize.y / 2, GL_COLOR_ATTACHMENT0, app->mainAttachmentTexture, app->valThreshold);
+    // The forward lighting loop is the expensive part, so with the prepass it runs once per pixel
+    if (app->depthPrepassForward) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        PassDepthPrepass(app, app->forwardBuffer, false);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    else {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        BeginOverdrawQuery(app);
+    }
 
-            glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, app->rtBright);
-			glGenerateMipmap(GL_TEXTURE_2D);
-
-            // horizontal blur
-			PassBlur(app, app->fboBloom1, app->displaySize.x / 2, app->displaySize.y / 2, GL_COLOR_ATTACHMENT1, app->rtBright, 0, 1, 0, app->intensities[0]);
-			PassBlur(app, app->fboBloom2, app->displaySize.x / 4, app->displaySize.y / 4, GL_COLOR_ATTACHMENT1, app->rtBright, 1, 1, 0, app->intensities[1]);
-            PassBlur(app, app->fboBloom3, app->displaySize.x / 8, app->displaySize.y / 8, GL_COLOR_ATTACHMENT1, app->rtBright, 2, 1, 0, app->intensities[2]);
-			PassBlur(app, app->fboBloom4, app->displaySize.x / 16, app->displaySize.y / 16, GL_COLOR_ATTACHMENT1, app->rtBright, 3, 1, 0, app->intensities[3]);
-			PassBlur(app, app->fboBloom5, app->displaySize.x / 32, app->displaySize.y / 32, GL_COLOR_ATTACHMENT1, app->rtBright, 4, 1, 0, app->intensities[4]);
-
-			// vertical blur
-			PassBlur(app, app->fboBloom1, app->displaySize.x / 2, app->displaySize.y / 2, GL_COLOR_ATTACHMENT0, app->rtBloomH, 0, 0, 1, app->intensities[0]);
-			PassBlur(app, app->fboBloom2, app->displaySize.x / 4, app->displaySize.y / 4, GL_COLOR_ATTACHMENT0, app->rtBloomH, 1, 0, 1, app->intensities[1]);
-			PassBlur(app, app->fboBloom3, app->displaySize.x / 8, app->displaySize.y / 8, GL_COLOR_ATTACHMENT0, app->rtBloomH, 2, 0, 1, app->intensities[2]);
-			PassBlur(app, app->fboBloom4, app->displaySize.x / 16, app->displaySize.y / 16, GL_COLOR_ATTACHMENT0, app->rtBloomH, 3, 0, 1, app->intensities[3]);
-			PassBlur(app, app->fboBloom5, app->displaySize.x / 32, app->displaySize.y / 32, GL_COLOR_ATTACHMENT0, app->rtBloomH, 4, 0, 1, app->intensities[4]);
-
-            PassBloom(app, app->bloomBuffer, GL_COLOR_ATTACHMENT0, app->rtBright, MIPMAP_MAX_LEVEL);
-            
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-            if (app->showDebugLights) {
-                if(app->currentAttachment == "Main")
-                    glBindFramebuffer(GL_FRAMEBUFFER, app->bloomBuffer);
-                else 
-					glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
-                
-
-                // Show lights for debug
-                Program& debugLightProgram = app->programs[app->debugLightProgramIdx];
-                glUseProgram(debugLightProgram.handle);
-                for (int i = 0; i < app->lights.size(); ++i) {
-                    Light& light = app->lights[i];
-                    u32 meshIdx = 0;
-                    float scale = 1.0f;
-                    glm::mat4 modelMatrix;
-                    if (light.type == LightType_Directional)
-                    {
-                        meshIdx = app->primitiveIdxs[2];
-                        scale = 0.5f;
-                        glm::vec3 coneDirection = glm::vec3(0.0f, 1.0f, 0.0f);
-                        glm::vec3 lightDirection = glm::normalize(light.direction);
-                        glm::vec3 rotationAxis = glm::normalize(glm::cross(lightDirection, coneDirection));
-                        float rotationAngle = acos(glm::dot(lightDirection, coneDirection));
-                        glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), rotationAngle, rotationAxis);
-                        modelMatrix = TransformPositionRotationScale(light.position, light.direction, vec3(scale));
-                        modelMatrix = rotationMatrix * modelMatrix;
-                    }
-                    else
-                    {
-                        scale = 0.5f;
-                        modelMatrix = TransformPositionRotationScale(light.position, light.direction, vec3(scale));
-                        meshIdx = app->primitiveIdxs[1];
+    if (app->forwardLightList == ForwardLightList_Clustered)
+        UpdateLightClusters(app);
 
-                    }
-                    Mesh& mesh = app->meshes[app->models[meshIdx].meshIdx];
-                    GLuint vao = FindVAO(mesh, 0, debugLightProgram);
+    Program& forwardProgram = app->programs[app->forwardProgramIdx];
+    glUseProgram(forwardProgram.handle);
 
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-                    modelMatrix = app->camera.projection * app->camera.view * modelMatrix;
-                    glBindVertexArray(vao);
-                    glUniformMatrix4fv(app->uProjectionMatrix, 1, GL_FALSE, &modelMatrix[0][0]);
-                    glUniform3f(app->uLightColor, light.color.r, light.color.g, light.color.b);
+    LightCulling::ClusterGrid& clusterGrid = app->clusterGrid;
+    glm::vec2 depthScaleBias = LightCulling::DepthSliceScaleBias(clusterGrid);
+    glUniform1i(app->forwardProgram_uLightList, (int)app->forwardLightList);
+
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, app->lightmapTexture);
+    glUniform1i(app->forwardProgram_uLightmap, 10);
+    glUniform1ui(app->forwardProgram_uDirectionalLightCount, app->packedDirectionalLightCount);
+    glUniform3ui(app->forwardProgram_uClusterCount, clusterGrid.countX, clusterGrid.countY, clusterGrid.countZ);
+    glUniform2f(app->forwardProgram_uClusterTileSize, (float)app->renderSize.x / clusterGrid.countX, (float)app->renderSize.y / clusterGrid.countY);
+    glUniform2f(app->forwardProgram_uClusterDepthScaleBias, depthScaleBias.x, depthScaleBias.y);
+
+    for (auto it = app->entities.begin(); it != app->entities.end(); ++it) {
+        if (!IsEntityDrawn(*it, WaterScenePart::NONE))
+            continue;
+
+        bool conditional = BeginEntityConditionalRender(app, *it, app->camera, WaterScenePart::NONE);
+        DrawEntitySubmeshes(app, *it, forwardProgram, app->forwardProgram_uTexture, it->lodLevel[WaterScenePart::NONE]);
+        if (conditional)
+            glEndConditionalRender();
+    }
+
+    if (app->depthPrepassForward) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+    else {
+        EndOverdrawQuery(app);
+    }
+
+    IssueOcclusionQueries(app, app->camera, WaterScenePart::NONE);
+
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassWaterReflection(App* app)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, app->reflectionBuffer);
+	Camera reflectionCamera = app->camera;
+	reflectionCamera.position.y = 2 * (app->camera.position.y - app->waterPos.y); 
+	reflectionCamera.pitch *= -1.0f; 
+	CameraDirection(reflectionCamera);
+	reflectionCamera.view = glm::lookAt(reflectionCamera.position, reflectionCamera.position + reflectionCamera.front, reflectionCamera.up);
+
+	AlignUniformBuffers(app, reflectionCamera, true);
+
+    PassWaterScene(app,reflectionCamera, app->reflectionBuffer, WaterScenePart::REFLECTION);
+	RenderSkybox(app, reflectionCamera);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassWaterRefraction(App* app)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, app->refractionBuffer);
+
+    // Also puts the main camera back in the uniform buffer for the passes after it
+	Camera refractionCamera = app->camera;
+	AlignUniformBuffers(app, refractionCamera, false);
+	PassWaterScene(app,refractionCamera, app->refractionBuffer, WaterScenePart::REFRACTION);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassWaterSurface(App* app, bool texturesRendered)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, app->gBuffer);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+
+    Program& waterProgram = app->programs[app->waterProgramIdx];
+    glUseProgram(waterProgram.handle);
+
+    u32 waterMeshIdx = app->primitiveIdxs[4];
+    Mesh& waterMesh = app->meshes[app->models[waterMeshIdx].meshIdx];
+    GLuint vao = FindVAO(waterMesh, 0, waterProgram);
+
+    glm::mat4 waterMatrix = TransformPositionRotationScale(app->waterPos, glm::vec3(0.0), app->waterScale);
+    waterMatrix = app->camera.view * waterMatrix;
+    app->moveFactor += app->waterMoveSpeed * app->deltaTime;
+    app->moveFactor = std::fmod(app->moveFactor, 1.0f); // Keep moveFactor in range [0, 1]
+
+    glBindVertexArray(vao);
+    glUniformMatrix4fv(app->waterProgram_uProjection, 1, GL_FALSE, &app->camera.projection[0][0]);
+    glUniformMatrix4fv(app->waterProgram_uView, 1, GL_FALSE, &waterMatrix[0][0]);
+    glUniform2f(app->waterProgram_viewportSize, app->renderSize.x, app->renderSize.y);
+    glUniformMatrix4fv(app->waterProgram_uViewInverse, 1, GL_FALSE, &glm::inverse(waterMatrix)[0][0]);
+    glUniformMatrix4fv(app->waterProgram_uProjectionInverse, 1, GL_FALSE, &glm::inverse(app->camera.projection)[0][0]);
+    glUniform1f(app->waterProgram_moveFactor, app->moveFactor);
+    // Bind textures
+    glUniform1i(app->waterProgram_uReflectionMap, 0);
+    glUniform1i(app->waterProgram_uReflectionDepth, 1);
+    glUniform1i(app->waterProgram_uRefractionMap, 2);
+    glUniform1i(app->waterProgram_uRefractionDepth, 3);
+    glUniform1i(app->waterProgram_normalMap, 4);
+    glUniform1i(app->waterProgram_dudvMap, 5);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->rtReflection);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, app->rtReflectionDepth);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, app->rtRefraction);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, app->rtRefractionDepth);
+    glActiveTexture(GL_TEXTURE4);
+    GLuint normalWaterHandle = app->textures[app->normalWaterTex].handle;
+    glBindTexture(GL_TEXTURE_2D, normalWaterHandle);
+    glActiveTexture(GL_TEXTURE5);
+    GLuint dudvWaterHandle = app->textures[app->dudvWaterTex].handle;
+    glBindTexture(GL_TEXTURE_2D, dudvWaterHandle);
+
+    // When the last query found the plane hidden there are no textures this frame, so it is
+    // only drawn as a proxy to find out when it becomes visible again
+    if (!texturesRendered) {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+    }
+
+    if (app->enableWaterOcclusionQuery && !app->waterQueryPending)
+        glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, app->waterOcclusionQuery);
+
+    glDrawElements(GL_TRIANGLES, waterMesh.submeshes[0].indices.size(), GL_UNSIGNED_INT, 0);
+
+    if (app->enableWaterOcclusionQuery && !app->waterQueryPending) {
+        glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+        app->waterQueryPending = true;
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassLighting(App* app)
+{
+    if (IsLightingHalfResolution(app)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, app->halfLightBuffer);
+        glViewport(0, 0, (app->renderSize.x + 1) / 2, (app->renderSize.y + 1) / 2);
+    }
+    else {
+        glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
+        glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+    }
+
+	Program& lightProgram = app->programs[app->lightProgramIdx];
+	glUseProgram(lightProgram.handle);
+
+	glBindVertexArray(app->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
+	glUniform1i(app->lightProgram_uAlbedo, 6);
+	glUniform1i(app->lightProgram_uNormal, 8);
+	glUniform1i(app->lightProgram_uDepth, 9);
+	glUniform1i(app->lightProgram_uBakedLight, 11);
+	glUniform1i(app->lightProgram_uDirectionalOnly, 0);
+	glUniform1i(app->lightProgram_uSampleScale, IsLightingHalfResolution(app) ? 2 : 1);
+	glUniform2f(app->lightProgram_uViewportSize, (float)app->renderSize.x, (float)app->renderSize.y);
+	glm::mat4 inverseViewProjection = glm::inverse(app->camera.projection * app->camera.view);
+	glUniformMatrix4fv(app->lightProgram_uInverseViewProjection, 1, GL_FALSE, &inverseViewProjection[0][0]);
+
+	glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, app->colorAttachmentTexture);
+	glActiveTexture(GL_TEXTURE9);
+	glBindTexture(GL_TEXTURE_2D, app->gBufferDepthTexture);
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D, app->normalAttachmentTexture);
+	glActiveTexture(GL_TEXTURE11);
+	glBindTexture(GL_TEXTURE_2D, app->bakedLightAttachmentTexture);
+
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	glBindVertexArray(0);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+    glUseProgram(0);
+}
+
+void PassSkybox(App* app)
+{
+	// The light volumes already needed the scene depth
+	if (app->lightingPath != LightingPath_LightVolumes) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, app->gBuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->lightBuffer);
+
+		glBlitFramebuffer(0, 0, app->renderSize.x, app->renderSize.y, 0, 0, app->renderSize.x, app->renderSize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	}
+
+    // The tiled lighting shaded the sky already
+    if (!IsBloomThresholdFused(app)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
+        glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+        RenderSkybox(app, app->camera);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassBloomBlur(App* app, GLuint texture, GLenum colorAttachment, int dirX, int dirY)
+{
+    // One draw per mip of the bloom chain
+    for (int level = 0; level < app->bloomMipCount; ++level) {
+        ivec2 mipSize = BloomMipSize(app, level);
+        PassBlur(app, app->bloomMipBuffers[level], mipSize.x, mipSize.y, colorAttachment, texture, level, dirX, dirY, app->intensities[level]);
+    }
+}
+
+void PassBloomBlurCompute(App* app, GLuint source, GLuint destination, int dirX, int dirY)
+{
+    Program& bloomBlurProgram = app->programs[app->bloomBlurProgramIdx];
+    glUseProgram(bloomBlurProgram.handle);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glUniform1i(app->bloomBlurProgram_uSource, 0);
+    glUniform2i(app->bloomBlurProgram_uDir, dirX, dirY);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 3, app->blurKernelBuffer);
+    glUniform1fv(app->bloomBlurProgram_uIntensities, BLOOM_MAX_MIPS, app->intensities);
+
+    // Every level is its own image unit, so one dispatch blurs the whole chain
+    for (int level = 0; level < app->bloomMipCount; ++level)
+        glBindImageTexture(level, destination, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+    // One workgroup per line segment of level 0, z picks the level, the groups outside the smaller ones return
+    ivec2 size = BloomMipSize(app, 0);
+    ivec2 line = dirX != 0 ? size : ivec2(size.y, size.x);
+    glDispatchCompute((line.x + BLOOM_BLUR_GROUP_SIZE - 1) / BLOOM_BLUR_GROUP_SIZE, line.y, app->bloomMipCount);
+
+    for (int level = 0; level < app->bloomMipCount; ++level)
+        glBindImageTexture(level, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glUseProgram(0);
+}
+
+ivec2 BloomMipSize(const App* app, u32 level)
+{
+    ivec2 size = glm::max(app->displaySize / 2, ivec2(1));
+    return glm::max(ivec2(size.x >> level, size.y >> level), ivec2(1));
+}
+
+void PassBloomDownsample(App* app)
+{
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    Program& downsampleProgram = app->programs[app->bloomDownsampleProgramIdx];
+    glUseProgram(downsampleProgram.handle);
+    glUniform1i(app->bloomDownsampleProgram_uSource, 0);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->rtBright);
+    glBindVertexArray(app->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
+
+    GLenum colorAttachment = GL_COLOR_ATTACHMENT0;
+    for (int level = 1; level < app->bloomMipCount; ++level) {
+        // Only the source level can be sampled, so reading and writing the same texture is no feedback loop
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+
+        ivec2 mipSize = BloomMipSize(app, level);
+        glBindFramebuffer(GL_FRAMEBUFFER, app->bloomMipBuffers[level]);
+        glDrawBuffers(1, &colorAttachment);
+        glViewport(0, 0, mipSize.x, mipSize.y);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, app->bloomMipCount - 1);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassBloomUpsample(App* app)
+{
+    glDisable(GL_DEPTH_TEST);
+
+    // Each level is added on top of the downsampled one above it
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    Program& upsampleProgram = app->programs[app->bloomUpsampleProgramIdx];
+    glUseProgram(upsampleProgram.handle);
+    glUniform1i(app->bloomUpsampleProgram_uSource, 0);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, app->rtBright);
+    glBindVertexArray(app->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
+
+    GLenum colorAttachment = GL_COLOR_ATTACHMENT0;
+    for (int level = app->bloomMipCount - 1; level > 0; --level) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level);
+        glUniform1f(app->bloomUpsampleProgram_uIntensity, app->intensities[level]);
+
+        ivec2 mipSize = BloomMipSize(app, level - 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, app->bloomMipBuffers[level - 1]);
+        glDrawBuffers(1, &colorAttachment);
+        glViewport(0, 0, mipSize.x, mipSize.y);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, app->bloomMipCount - 1);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PassDebugLights(App* app)
+{
+    // Into the lit color, tested against the scene depth
+    glBindFramebuffer(GL_FRAMEBUFFER, app->forwardBuffer);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+    glEnable(GL_DEPTH_TEST);
+
+    // Show lights for debug
+    Program& debugLightProgram = app->programs[app->debugLightProgramIdx];
+    glUseProgram(debugLightProgram.handle);
+    for (int i = 0; i < app->lights.size(); ++i) {
+        Light& light = app->lights[i];
+        u32 meshIdx = 0;
+        float scale = 1.0f;
+        glm::mat4 modelMatrix;
+        if (light.type == LightType_Directional)
+        {
+            meshIdx = app->primitiveIdxs[2];
+            scale = 0.5f;
+            glm::vec3 coneDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::vec3 lightDirection = glm::normalize(light.direction);
+            glm::vec3 rotationAxis = glm::normalize(glm::cross(lightDirection, coneDirection));
+            float rotationAngle = acos(glm::dot(lightDirection, coneDirection));
+            glm::mat4 rotationMatrix = glm::rotate(glm::mat4(1.0f), rotationAngle, rotationAxis);
+            modelMatrix = TransformPositionRotationScale(light.position, light.direction, vec3(scale));
+            modelMatrix = rotationMatrix * modelMatrix;
+        }
+        else
+        {
+            scale = 0.5f;
+            modelMatrix = TransformPositionRotationScale(light.position, light.direction, vec3(scale));
+            meshIdx = app->primitiveIdxs[1];
 
-                    glDrawElements(GL_TRIANGLES, mesh.submeshes[0].indices.size(), GL_UNSIGNED_INT, 0);
-                    glBindVertexArray(0);
-                }
-                glUseProgram(0);
-                glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            }
-			
         }
+        Mesh& mesh = app->meshes[app->models[meshIdx].meshIdx];
+        GLuint vao = FindVAO(mesh, 0, debugLightProgram);
 
-        
-        break; 
+
+        modelMatrix = app->camera.projection * app->camera.view * modelMatrix;
+        glBindVertexArray(vao);
+        glUniformMatrix4fv(app->uProjectionMatrix, 1, GL_FALSE, &modelMatrix[0][0]);
+        glUniform3f(app->uLightColor, light.color.r, light.color.g, light.color.b);
+
+        glDrawElements(GL_TRIANGLES, mesh.submeshes[0].indices.size(), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
     }
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void AlignUniformBuffers(App* app , Camera cam, bool reflection)
@@ -1305,19 +1971,15 @@ void AlignUniformBuffers(App* app , Camera cam, bool reflection)
     app->globalParamsOffset = app->localUniformBuffer.head;
 	PushVec3(app->localUniformBuffer, cam.position);
 	PushUInt(app->localUniformBuffer, app->lights.size());
-
-    for (size_t i = 0; i < app->lights.size(); ++i) {
-        BufferManagement::AlignHead(app->localUniformBuffer, sizeof(vec4));
-
-		Light& light = app->lights[i];
-		PushUInt(app->localUniformBuffer, light.type);
-		PushVec3(app->localUniformBuffer, light.color * light.intensity);
-		PushVec3(app->localUniformBuffer, light.direction);
-		PushVec3(app->localUniformBuffer, light.position);
-    }
+    PushVec3(app->localUniformBuffer, app->probeGrid.boundsMin);
+    PushUInt(app->localUniformBuffer, app->useProbes ? 1 : 0);
+    PushVec3(app->localUniformBuffer, app->probeGrid.cellSize);
+    BufferManagement::PushAlignedData(app->localUniformBuffer, &app->probeGrid.dims, sizeof(glm::uvec3), sizeof(vec4));
 
     app->globalParamsSize = app->localUniformBuffer.head - app->globalParamsOffset;
 
+    u32 planeCulledCount = 0;
+    u32 objectLightsAssigned = 0;
     for (auto it = app->entities.begin(); it != app->entities.end(); ++it)
     {
         BufferManagement::AlignHead(app->localUniformBuffer, app->uniformBlockAlignment);
@@ -1326,12 +1988,51 @@ void AlignUniformBuffers(App* app , Camera cam, bool reflection)
 		glm::mat4 worldMatrix = entity.worldMatrix;
 		glm::mat4 worldViewProjection = cam.projection * cam.view * worldMatrix;
 
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+
+        // World space bounding sphere against the light grid
+        u32 objectLights[MAX_OBJECT_LIGHTS] = {};
+        u32 objectLightCount = 0;
+        if (app->forwardLightList == ForwardLightList_PerObject) {
+            float maxScale = glm::max(glm::length(glm::vec3(worldMatrix[0])), glm::max(glm::length(glm::vec3(worldMatrix[1])), glm::length(glm::vec3(worldMatrix[2]))));
+            glm::vec3 center = glm::vec3(worldMatrix * glm::vec4((mesh.aabbMin + mesh.aabbMax) * 0.5f, 1.0f));
+            float radius = glm::length(mesh.aabbMax - mesh.aabbMin) * 0.5f * maxScale;
+            objectLightCount = LightCulling::GatherLights(app->lightGrid, app->packedLights, center, radius, MAX_OBJECT_LIGHTS, objectLights);
+            objectLightsAssigned += objectLightCount;
+        }
+
         entity.localParamsOffset = app->localUniformBuffer.head;
 		PushMat4(app->localUniformBuffer, worldMatrix);
 		PushMat4(app->localUniformBuffer, worldViewProjection);
+        BufferManagement::PushAlignedData(app->localUniformBuffer, objectLights, sizeof(objectLights), sizeof(vec4));
+        PushUInt(app->localUniformBuffer, objectLightCount);
+        PushVec4(app->localUniformBuffer, IsEntityLightmapped(app, entity) ? entity.lightmapScaleOffset : vec4(0.0f));
         entity.localParamsSize = app->localUniformBuffer.head - entity.localParamsOffset;
 
+        // Height range of the world space bounds against the horizontal water plane
+        float minY = FLT_MAX;
+        float maxY = -FLT_MAX;
+        for (u32 i = 0; i < 8; ++i) {
+            glm::vec3 corner((i & 1) ? mesh.aabbMax.x : mesh.aabbMin.x, (i & 2) ? mesh.aabbMax.y : mesh.aabbMin.y, (i & 4) ? mesh.aabbMax.z : mesh.aabbMin.z);
+            float y = (worldMatrix * glm::vec4(corner, 1.0f)).y;
+            minY = glm::min(minY, y);
+            maxY = glm::max(maxY, y);
+        }
+
+        // Reflection keeps what is above the water, refraction what is below
+        if (reflection) {
+            entity.clipPlaneCulled = maxY < app->waterPos.y;
+            entity.clipPlaneNeeded = minY < app->waterPos.y;
+        }
+        else {
+            entity.clipPlaneCulled = minY > app->waterPos.y;
+            entity.clipPlaneNeeded = maxY > app->waterPos.y;
+        }
+        if (entity.clipPlaneCulled)
+            planeCulledCount++;
     }
+    app->waterPlaneCulledCount[reflection ? 0 : 1] = planeCulledCount;
+    app->objectLightsAssigned = objectLightsAssigned;
 
     // Clipping plane as binding
 	BufferManagement::AlignHead(app->localUniformBuffer, app->uniformBlockAlignment);
@@ -1451,11 +2152,13 @@ void GuiAddLights(App* app)
 			app->directionalLightCount++;
 			std::string name = "Directional Light " + std::to_string(app->directionalLightCount);
 			app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(1.0, -1.0, 1.0), vec3(0.0, 0.0, 0.0), 1.0, name });
+            app->lightsDirty = true;
         }
         if (ImGui::MenuItem("Point Light", nullptr)) {
 			app->pointLightCount++;
 			std::string name = "Point Light " + std::to_string(app->pointLightCount);
 			app->lights.push_back({ LightType::LightType_Point, vec3(1.0, 1.0, 1.0), vec3(1.0, 1.0, 1.0), vec3(0.0, 1.0, 1.0), 1.0, name });
+            app->lightsDirty = true;
         }
         if (ImGui::Button("Add 100 point lights")) {
             for (int i = 0; i < 100; ++i) {
@@ -1463,6 +2166,7 @@ void GuiAddLights(App* app)
                 std::string name = "Point Light " + std::to_string(app->pointLightCount);
                 app->lights.push_back({ LightType::LightType_Point, vec3(1.0, 1.0, 1.0), vec3(1.0, 1.0, 1.0), vec3(0.0, 1.0, 1.0), 1.0, name });
             }
+            app->lightsDirty = true;
         }
         if (ImGui::Button("Add 100 directional lights")) {
             for (int i = 0; i < 100; ++i) {
@@ -1470,6 +2174,7 @@ void GuiAddLights(App* app)
                 std::string name = "Directional Light " + std::to_string(app->directionalLightCount);
                 app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(1.0, -1.0, 1.0), vec3(0.0, 0.0, 0.0), 1.0, name });
             }
+            app->lightsDirty = true;
         }
         ImGui::EndMenu();
     }
@@ -1489,16 +2194,22 @@ void GuiInspectorLights(App* app)
                     ImGui::Text("Direction: ");
                     if (ImGui::DragFloat3("##Direction", &app->lights[i].direction[0], 0.01f)) {
                         app->lights[i].direction = glm::clamp(app->lights[i].direction, -10.0f, 10.0f);
+                        app->lightsDirty = true;
                     }
                 }
                 else if (app->lights[i].type == LightType_Point) {
                     ImGui::Text("Position: ");
-                    ImGui::DragFloat3("##Position", &app->lights[i].position[0], 0.1f, true);
-                    ImGui::DragFloat("##Intensity", &app->lights[i].intensity, 0.1f, 0.00001f, 1.0f);
+                    if (ImGui::DragFloat3("##Position", &app->lights[i].position[0], 0.1f, true))
+                        app->lightsDirty = true;
+                    if (ImGui::DragFloat("##Intensity", &app->lights[i].intensity, 0.1f, 0.00001f, 1.0f))
+                        app->lightsDirty = true;
                 }
 
                 ImGui::Text("Color: ");
-                ImGui::ColorEdit3("##Color", &app->lights[i].color[0], ImGuiColorEditFlags_Float);
+                if (ImGui::ColorEdit3("##Color", &app->lights[i].color[0], ImGuiColorEditFlags_Float))
+                    app->lightsDirty = true;
+                if (ImGui::Checkbox("Static", &app->lights[i].isStatic))
+                    app->lightsDirty = true;
             }
             ImGui::PopID();
         }
@@ -1514,20 +2225,23 @@ void GuiInspectorEntities(App* app) {
             ImGui::PushID(app->entities[i].name.c_str());
             if (ImGui::CollapsingHeader(app->entities[i].name.c_str(), ImGuiTreeNodeFlags_DefaultOpen)) {
                 ImGui::Text("Position: ");
+                // The probes retrace the whole grid, so only once the drag is released
                 if (ImGui::DragFloat3("##Position", &app->entities[i].position[0], 0.5f, true))
-                {
                     app->entities[i].worldMatrix = TransformPositionRotationScale(app->entities[i].position, app->entities[i].rotation, app->entities[i].scale);
-                }
+                if (ImGui::IsItemDeactivatedAfterEdit())
+                    app->probesDirty = true;
                 ImGui::Text("Rotation: ");
                 if (ImGui::DragFloat3("##Rotation", &app->entities[i].rotation[0], 1.0f, 0.0f, 360.0f))
-                {
                     app->entities[i].worldMatrix = TransformPositionRotationScale(app->entities[i].position, app->entities[i].rotation, app->entities[i].scale);
-                }
+                if (ImGui::IsItemDeactivatedAfterEdit())
+                    app->probesDirty = true;
                 ImGui::Text("Scale: ");
                 if (ImGui::DragFloat3("##Scale", &app->entities[i].scale[0], 0.01f, 0.00001f, 10000.0f))
-                {
                     app->entities[i].worldMatrix = TransformPositionRotationScale(app->entities[i].position, app->entities[i].rotation, app->entities[i].scale);
-                }
+                if (ImGui::IsItemDeactivatedAfterEdit())
+                    app->probesDirty = true;
+                ImGui::Checkbox("Occluder", &app->entities[i].isOccluder);
+                ImGui::Checkbox("Static", &app->entities[i].isStatic);
             }
             ImGui::PopID();
         }
@@ -1566,6 +2280,7 @@ void GuiAddPrimitive(App* app)
                 }
 
 				app->entities.push_back(e);
+                app->probesDirty = true;
             }
         }
         ImGui::EndMenu();
@@ -1586,51 +2301,178 @@ void GuiInspectorCamera(App* app)
     }
 }
 
-void DrawScene(App* app, u32 programIdx, GLuint fbo, Camera camera, WaterScenePart part) 
+void DrawEntitySubmeshes(App* app, const Entity& entity, Program& program, GLint textureLocation, u32 lodLevel)
 {
-   
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    Model& model = app->models[entity.modelIndex];
+
+    // Baked entities draw the copy that has the lightmap coordinates
+    u32 meshIdx = model.meshIdx;
+    if (IsEntityLightmapped(app, entity))
+        meshIdx = app->meshes[meshIdx].lightmapMeshIdx;
+    Mesh& mesh = app->meshes[meshIdx];
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 1, app->localUniformBuffer.handle, entity.localParamsOffset, entity.localParamsSize);
+
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
+        GLuint vao = FindVAO(mesh, i, program);
+        glBindVertexArray(vao);
+        u32 submeshMaterialIdx = model.materialIdx[i];
+        Material& submeshMaterial = app->materials[submeshMaterialIdx];
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
+        glUniform1i(textureLocation, 0);
+
+        Submesh& submesh = mesh.submeshes[i];
+        const SubmeshLod& lod = submesh.lods[glm::min(lodLevel, (u32)submesh.lods.size() - 1)];
+        glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (void*)(u64)lod.indexOffset);
+        glBindVertexArray(0);
+    }
+}
 
+void DrawScene(App* app, u32 programIdx, GLuint fbo, Camera camera, WaterScenePart part) 
+{
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
 
+    SetupViewEntities(app, camera, part);
+
+    // The prepass is only worth it for the main view
+    bool depthPrepass = part == WaterScenePart::NONE && app->depthPrepassDeferred;
+    if (depthPrepass) {
+        glClear(GL_COLOR_BUFFER_BIT);
+        PassDepthPrepass(app, fbo, true);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    else {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
 
     Program& texturedMeshProgram = app->programs[programIdx];
     glUseProgram(texturedMeshProgram.handle);
 
     glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glBindBufferRange(GL_UNIFORM_BUFFER, 2, app->localUniformBuffer.handle, app->clippingPlaneOffset, app->clippingPlaneSize);
+
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, app->lightmapTexture);
+    glUniform1i(app->texturedMeshProgram_uLightmap, 10);
+
+    bool measureOverdraw = part == WaterScenePart::NONE && !depthPrepass;
+    if (measureOverdraw)
+        BeginOverdrawQuery(app);
 
     for (int i = 0; i < app->entities.size(); ++i) {
-        Entity entity = app->entities[i];
-        Model& model = app->models[entity.modelIndex];
-        Mesh& mesh = app->meshes[model.meshIdx];
+        const Entity& entity = app->entities[i];
+        if (!IsEntityDrawn(entity, part))
+            continue;
+
+        // Water views only clip what crosses the plane
+        if (part != WaterScenePart::NONE) {
+            if (entity.clipPlaneNeeded)
+                glEnable(GL_CLIP_DISTANCE0);
+            else
+                glDisable(GL_CLIP_DISTANCE0);
+        }
 
-        glBindBufferRange(GL_UNIFORM_BUFFER, 1, app->localUniformBuffer.handle, entity.localParamsOffset, entity.localParamsSize);
-        glBindBufferRange(GL_UNIFORM_BUFFER, 2, app->localUniformBuffer.handle, app->clippingPlaneOffset, app->clippingPlaneSize);
+        bool conditional = BeginEntityConditionalRender(app, entity, camera, part);
+        DrawEntitySubmeshes(app, entity, texturedMeshProgram, app->texturedMeshProgram_uTexture, entity.lodLevel[part]);
+        if (conditional)
+            glEndConditionalRender();
+    }
 
-        for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
-            GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-            glBindVertexArray(vao);
-            u32 submeshMaterialIdx = model.materialIdx[i];
-            Material& submeshMaterial = app->materials[submeshMaterialIdx];
+    if (measureOverdraw)
+        EndOverdrawQuery(app);
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-            glUniform1i(app->texturedMeshProgram_uTexture, 0);
-            glUniform1f(app->texturedMeshProgram_uNear, app->camera.zNear);
-            glUniform1f(app->texturedMeshProgram_uFar, app->camera.zFar);
-
-            Submesh& submesh = mesh.submeshes[i];
-            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-            glBindVertexArray(0);
-        }
+    if (depthPrepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
     }
     glUseProgram(0);
+
+    IssueOcclusionQueries(app, camera, part);
+}
+
+void PassDepthPrepass(App* app, GLuint fbo, bool alphaTest)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    Program& depthPrepassProgram = app->programs[alphaTest ? app->depthPrepassProgramIdx : app->depthPrepassPositionProgramIdx];
+    glUseProgram(depthPrepassProgram.handle);
+
+    // The positions only variant has no texture, a location of -1 is ignored
+    GLint textureLocation = alphaTest ? app->depthPrepassProgram_uTexture : -1;
+
+    BeginOverdrawQuery(app);
+    for (int i = 0; i < app->entities.size(); ++i) {
+        const Entity& entity = app->entities[i];
+        if (!IsEntityDrawn(entity, WaterScenePart::NONE))
+            continue;
+
+        DrawEntitySubmeshes(app, entity, depthPrepassProgram, textureLocation, entity.lodLevel[WaterScenePart::NONE]);
+    }
+    EndOverdrawQuery(app);
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glUseProgram(0);
+}
+
+void BeginOverdrawQuery(App* app)
+{
+    // Only one measurement in flight, it is read back a few frames later without stalling
+    if (app->overdrawQueryPending)
+        return;
+
+    glBeginQuery(GL_SAMPLES_PASSED, app->overdrawQuery);
+    app->overdrawQueryActive = true;
+}
+
+void EndOverdrawQuery(App* app)
+{
+    if (!app->overdrawQueryActive)
+        return;
+
+    glEndQuery(GL_SAMPLES_PASSED);
+    app->overdrawQueryActive = false;
+    app->overdrawQueryPending = true;
+    app->overdrawQueryMode = app->mode;
+}
+
+void UpdateOverdrawMeasure(App* app)
+{
+    if (!app->overdrawQueryPending)
+        return;
+
+    GLuint available = 0;
+    glGetQueryObjectuiv(app->overdrawQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GLuint samplesPassed = 0;
+    glGetQueryObjectuiv(app->overdrawQuery, GL_QUERY_RESULT, &samplesPassed);
+    app->overdrawQueryPending = false;
+
+    // Fragments that passed the depth test per pixel, in submission order
+    app->measuredOverdraw = (float)samplesPassed / (float)(app->renderSize.x * app->renderSize.y);
+
+    if (app->depthPrepassAuto) {
+        bool& depthPrepass = app->overdrawQueryMode == Mode_Forward ? app->depthPrepassForward : app->depthPrepassDeferred;
+        if (app->measuredOverdraw > app->depthPrepassOverdrawThreshold)
+            depthPrepass = true;
+        else if (app->measuredOverdraw < app->depthPrepassOverdrawThreshold * 0.8f)
+            depthPrepass = false;
+    }
 }
 
 void PassWaterScene(App* app, Camera camera, GLuint fbo, WaterScenePart part) 
@@ -1669,4 +2511,818 @@ void RenderSkybox(App* app, Camera camera)
     glDepthMask(GL_TRUE);
     glDepthFunc(GL_LESS);
     glUseProgram(0);
-}
\ No newline at end of file
+}
+
+void UpdateSoftwareOcclusion(App* app)
+{
+    SoftwareOcclusion::DepthBuffer& occlusionBuffer = app->occlusionBuffer;
+    SoftwareOcclusion::Clear(occlusionBuffer);
+
+    glm::mat4 viewProjection = app->camera.projection * app->camera.view;
+
+    // Occluders
+    for (u32 i = 0; i < app->entities.size(); ++i) {
+        Entity& entity = app->entities[i];
+        if (!entity.isOccluder)
+            continue;
+
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        glm::mat4 worldViewProjection = viewProjection * entity.worldMatrix;
+        for (u32 j = 0; j < mesh.submeshes.size(); ++j) {
+            Submesh& submesh = mesh.submeshes[j];
+            u32 vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+            SoftwareOcclusion::AddOccluder(occlusionBuffer, submesh.vertices.data(), submesh.vertices.size() / vertexStride, vertexStride,
+                submesh.indices.data(), submesh.indices.size(), worldViewProjection);
+        }
+    }
+    SoftwareOcclusion::Rasterize(occlusionBuffer);
+
+    // Occludees
+    JobSystem::ParallelFor(app->entities.size(), [app, &occlusionBuffer, &viewProjection](u32 i) {
+        Entity& entity = app->entities[i];
+        if (entity.isOccluder) {
+            entity.occluded = false;
+            return;
+        }
+
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+        entity.occluded = !SoftwareOcclusion::IsAABBVisible(occlusionBuffer, mesh.aabbMin, mesh.aabbMax, viewProjection * entity.worldMatrix);
+    });
+
+    app->occlusionCulledCount = 0;
+    for (u32 i = 0; i < app->entities.size(); ++i)
+        if (app->entities[i].occluded)
+            app->occlusionCulledCount++;
+}
+
+bool IsAABBInFrustum(const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::mat4& worldViewProjection)
+{
+    // Clip space corners, the box is out when all of them are outside the same plane
+    u32 outsideMask = 0x3f;
+    for (u32 i = 0; i < 8; ++i) {
+        glm::vec3 corner((i & 1) ? aabbMax.x : aabbMin.x, (i & 2) ? aabbMax.y : aabbMin.y, (i & 4) ? aabbMax.z : aabbMin.z);
+        glm::vec4 clip = worldViewProjection * glm::vec4(corner, 1.0f);
+
+        u32 cornerMask = 0;
+        if (clip.x < -clip.w) cornerMask |= 1;
+        if (clip.x >  clip.w) cornerMask |= 2;
+        if (clip.y < -clip.w) cornerMask |= 4;
+        if (clip.y >  clip.w) cornerMask |= 8;
+        if (clip.z < -clip.w) cornerMask |= 16;
+        if (clip.z >  clip.w) cornerMask |= 32;
+        outsideMask &= cornerMask;
+    }
+    return outsideMask == 0;
+}
+
+bool UpdateWaterVisibility(App* app)
+{
+    // Result of the query issued on the water quad in a previous frame, never waited on
+    if (app->waterQueryPending) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(app->waterOcclusionQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint anySamplesPassed = 0;
+            glGetQueryObjectuiv(app->waterOcclusionQuery, GL_QUERY_RESULT, &anySamplesPassed);
+            app->waterOccluded = anySamplesPassed == 0;
+            app->waterQueryPending = false;
+        }
+    }
+    if (!app->enableWaterOcclusionQuery)
+        app->waterOccluded = false;
+
+    // The plane is seen from above only, the shader has nothing to show from below
+    app->waterInView = false;
+    if (app->enableWaterPlane && app->camera.position.y > app->waterPos.y) {
+        Mesh& waterMesh = app->meshes[app->models[app->primitiveIdxs[4]].meshIdx];
+        glm::mat4 waterMatrix = TransformPositionRotationScale(app->waterPos, glm::vec3(0.0), app->waterScale);
+        app->waterInView = IsAABBInFrustum(waterMesh.aabbMin, waterMesh.aabbMax, app->camera.projection * app->camera.view * waterMatrix);
+    }
+
+    // No query is issued while the plane is out of view, so the old result means nothing once it comes back
+    if (!app->waterInView)
+        app->waterOccluded = false;
+
+    // The frame graph still renders them for the debug views of the water textures
+    app->waterPassesRendered = app->waterInView && !app->waterOccluded;
+    return app->waterPassesRendered;
+}
+
+bool BeginEntityConditionalRender(App* app, const Entity& entity, const Camera& camera, WaterScenePart part)
+{
+    if (!app->enableOcclusionQueries || !entity.occlusionQueryIssued[part])
+        return false;
+
+    // From inside the box its faces are clipped away and the query would report it hidden
+    Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+    glm::vec3 localCamera = glm::vec3(glm::inverse(entity.worldMatrix) * glm::vec4(camera.position, 1.0f));
+    glm::vec3 margin = glm::vec3(camera.zNear * 2.0f);
+    if (glm::all(glm::greaterThan(localCamera, mesh.aabbMin - margin)) && glm::all(glm::lessThan(localCamera, mesh.aabbMax + margin)))
+        return false;
+
+    // Result of the previous frame, the GPU draws anyway when it is not ready yet
+    glBeginConditionalRender(entity.occlusionQuery[part], GL_QUERY_NO_WAIT);
+    return true;
+}
+
+void IssueOcclusionQueries(App* app, const Camera& camera, WaterScenePart part)
+{
+    if (!app->enableOcclusionQueries)
+        return;
+
+    // Boxes are tested against the finished depth buffer of the view, without writing anything
+    Program& proxyProgram = app->programs[app->occlusionProxyProgramIdx];
+    glUseProgram(proxyProgram.handle);
+    glBindVertexArray(app->skyboxVAO);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_FALSE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDisable(GL_CLIP_DISTANCE0);
+
+    glm::mat4 viewProjection = camera.projection * camera.view;
+
+    for (u32 i = 0; i < app->entities.size(); ++i) {
+        Entity& entity = app->entities[i];
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+
+        if (mesh.triangleCount < (u32)app->occlusionQueryTriangleThreshold) {
+            entity.occlusionQueryIssued[part] = false;
+            continue;
+        }
+
+        // The last result of a skipped entity would be stale when it comes back, so it draws
+        // unconditionally until a new query is issued
+        if (!IsEntityDrawn(entity, part)) {
+            entity.occlusionQueryIssued[part] = false;
+            continue;
+        }
+
+        if (entity.occlusionQuery[part] == 0)
+            glGenQueries(1, &entity.occlusionQuery[part]);
+
+        // Statistics only, the draws never wait on these
+        if (entity.occlusionQueryIssued[part]) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(entity.occlusionQuery[part], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint anySamplesPassed = 0;
+                glGetQueryObjectuiv(entity.occlusionQuery[part], GL_QUERY_RESULT, &anySamplesPassed);
+                if (anySamplesPassed)
+                    app->occlusionQueryHits++;
+                else
+                    app->occlusionQueryMisses++;
+            }
+            else {
+                app->occlusionQueriesPending++;
+            }
+        }
+
+        // The proxy cube spans [-1, 1]
+        glm::vec3 center = (mesh.aabbMin + mesh.aabbMax) * 0.5f;
+        glm::vec3 halfExtent = (mesh.aabbMax - mesh.aabbMin) * 0.5f;
+        glm::mat4 boxMatrix = glm::scale(glm::translate(entity.worldMatrix, center), glm::max(halfExtent, glm::vec3(0.001f)));
+        glm::mat4 worldViewProjection = viewProjection * boxMatrix;
+        glUniformMatrix4fv(app->occlusionProxyProgram_uWorldViewProjection, 1, GL_FALSE, &worldViewProjection[0][0]);
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, entity.occlusionQuery[part]);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+
+        entity.occlusionQueryIssued[part] = true;
+        app->occlusionQueriesIssued++;
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+bool IsEntityDrawn(const Entity& entity, WaterScenePart part)
+{
+    // Occlusion is only known for the main camera, plane side only matters for the water views
+    if (part == WaterScenePart::NONE && entity.occluded)
+        return false;
+    if (part != WaterScenePart::NONE && entity.clipPlaneCulled)
+        return false;
+
+    return !entity.contributionCulled[part];
+}
+
+void SetupViewEntities(App* app, const Camera& camera, WaterScenePart part)
+{
+    float projectionScale = 1.0f / glm::tan(glm::radians(camera.fov) * 0.5f);
+    float halfScreenHeight = app->renderSize.y * 0.5f;
+
+    for (u32 i = 0; i < app->entities.size(); ++i) {
+        Entity& entity = app->entities[i];
+        Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+
+        float scale = glm::max(glm::length(glm::vec3(entity.worldMatrix[0])), glm::max(glm::length(glm::vec3(entity.worldMatrix[1])), glm::length(glm::vec3(entity.worldMatrix[2]))));
+
+        // Contribution: projected area in pixels of the submesh bounding spheres
+        entity.contributionCulled[part] = false;
+        if (app->enableContributionCulling) {
+            float projectedArea = 0.0f;
+            for (u32 j = 0; j < mesh.submeshes.size(); ++j) {
+                const Submesh& submesh = mesh.submeshes[j];
+                glm::vec3 center = glm::vec3(entity.worldMatrix * glm::vec4(submesh.sphereCenter, 1.0f));
+                float radius = submesh.sphereRadius * scale;
+                float distance = glm::length(center - camera.position);
+
+                // Close enough to cover the screen, no need to look any further
+                if (distance <= radius) {
+                    projectedArea = FLT_MAX;
+                    break;
+                }
+
+                float projectedRadius = radius * projectionScale / distance * halfScreenHeight;
+                projectedArea += glm::pi<float>() * projectedRadius * projectedRadius;
+            }
+            entity.contributionCulled[part] = projectedArea < app->contributionCullPixels[part];
+        }
+
+        if (!app->enableLods || mesh.lodCount <= 1) {
+            entity.lodLevel[part] = 0;
+        }
+        else {
+            // Bounding sphere of the box, scaled by the largest axis of the transform
+            glm::vec3 center = glm::vec3(entity.worldMatrix * glm::vec4((mesh.aabbMin + mesh.aabbMax) * 0.5f, 1.0f));
+            float radius = glm::length(mesh.aabbMax - mesh.aabbMin) * 0.5f * scale;
+            float distance = glm::length(center - camera.position);
+
+            // Fraction of the screen height covered by the sphere
+            float screenSize = distance > radius ? radius * projectionScale / distance : 1.0f;
+            if (part != WaterScenePart::NONE)
+                screenSize *= app->lodWaterViewScale;
+
+            // Thresholds are widened around the current level so it does not flicker at the boundary
+            u32 level = glm::min(entity.lodLevel[part], mesh.lodCount - 1);
+            while (level + 1 < mesh.lodCount && screenSize < app->lodScreenSizes[level] * (1.0f - app->lodHysteresis))
+                level++;
+            while (level > 0 && screenSize > app->lodScreenSizes[level - 1] * (1.0f + app->lodHysteresis))
+                level--;
+            entity.lodLevel[part] = level;
+        }
+
+        if (IsEntityDrawn(entity, part)) {
+            app->lodTrianglesFull += mesh.triangleCount;
+            app->lodTrianglesDrawn += mesh.lodTriangleCount[entity.lodLevel[part]];
+        }
+        else if (entity.contributionCulled[part]) {
+            app->contributionCulledCount[part]++;
+        }
+    }
+}
+
+float ComputeLightRadius(const Light& light)
+{
+    // Distance where the shader attenuation (1 + 0.09 d + 0.032 d^2) brings the brightest
+    // channel down to 5/256
+    const float constant = 1.0f;
+    const float linear = 0.09f;
+    const float quadratic = 0.032f;
+
+    vec3 color = light.color * light.intensity;
+    float maxChannel = glm::max(color.r, glm::max(color.g, color.b));
+    float c = constant - maxChannel * (256.0f / 5.0f);
+    if (c >= 0.0f)
+        return 0.0f;
+
+    return (-linear + sqrtf(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+}
+
+void UploadLights(App* app)
+{
+    if (!app->lightsDirty)
+        return;
+
+    // Two vec4 per light: position (direction for directional lights) + radius, color + type.
+    // Directional lights go first so the clustered path can loop over them on their own.
+    std::vector<vec4>& packedLights = app->packedLights;
+    packedLights.clear();
+    for (u32 pass = 0; pass < 2; ++pass) {
+        LightType type = pass == 0 ? LightType_Directional : LightType_Point;
+        for (u32 i = 0; i < app->lights.size(); ++i) {
+            const Light& light = app->lights[i];
+            if (light.type != type)
+                continue;
+
+            if (light.type == LightType_Directional)
+                packedLights.push_back(vec4(light.direction, 0.0f));
+            else
+                packedLights.push_back(vec4(light.position, ComputeLightRadius(light)));
+            // Baked lights are tagged with half a unit on top of the type, uint(w) still gives the type
+            bool baked = light.isStatic && AreLightmapsActive(app);
+            packedLights.push_back(vec4(light.color * light.intensity, (float)light.type + (baked ? 0.5f : 0.0f)));
+        }
+        if (pass == 0)
+            app->packedDirectionalLightCount = packedLights.size() / 2;
+    }
+
+    LightCulling::BuildGrid(app->lightGrid, packedLights, app->packedDirectionalLightCount);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->lightStorageBuffer);
+
+    // Grows by doubling, so adding lights one by one does not reallocate every time
+    if (app->lights.size() > app->lightStorageCapacity || app->lightStorageCapacity == 0) {
+        app->lightStorageCapacity = glm::max(glm::max((u32)app->lights.size(), app->lightStorageCapacity * 2), 64u);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, app->lightStorageCapacity * 2 * sizeof(vec4), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, app->lightStorageBuffer);
+    }
+
+    if (!packedLights.empty())
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, packedLights.size() * sizeof(vec4), packedLights.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    app->lightsDirty = false;
+}
+
+void PassTiledLighting(App* app)
+{
+    Program& tiledLightingProgram = app->programs[app->tiledLightingProgramIdx];
+    glUseProgram(tiledLightingProgram.handle);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glUniformMatrix4fv(app->tiledLightingProgram_uView, 1, GL_FALSE, &app->camera.view[0][0]);
+    glUniformMatrix4fv(app->tiledLightingProgram_uProjection, 1, GL_FALSE, &app->camera.projection[0][0]);
+    glm::mat4 inverseViewProjection = glm::inverse(app->camera.projection * app->camera.view);
+    glUniformMatrix4fv(app->tiledLightingProgram_uInverseViewProjection, 1, GL_FALSE, &inverseViewProjection[0][0]);
+
+    glUniform1i(app->tiledLightingProgram_uAlbedo, 6);
+    glUniform1i(app->tiledLightingProgram_uNormal, 8);
+    glUniform1i(app->tiledLightingProgram_uDepth, 9);
+    glUniform1i(app->tiledLightingProgram_uBakedLight, 11);
+
+    bool halfResolution = IsLightingHalfResolution(app);
+    glUniform1i(app->tiledLightingProgram_uSampleScale, halfResolution ? 2 : 1);
+    glUniform2f(app->tiledLightingProgram_uViewportSize, (float)app->renderSize.x, (float)app->renderSize.y);
+
+    bool fusedBloom = IsBloomThresholdFused(app);
+    glUniform1i(app->tiledLightingProgram_uFusedBloom, fusedBloom ? 1 : 0);
+    glUniform1f(app->tiledLightingProgram_uBloomThreshold, app->valThreshold);
+    glUniform1i(app->tiledLightingProgram_uSkybox, 13);
+
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, app->colorAttachmentTexture);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, app->normalAttachmentTexture);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, app->gBufferDepthTexture);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, app->bakedLightAttachmentTexture);
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, app->rtCubemap);
+
+    // Every pixel is written, so there is no need to clear the target first
+    GLuint target = halfResolution ? app->halfLightTexture : app->mainAttachmentTexture;
+    glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    if (fusedBloom)
+        glBindImageTexture(1, app->rtBright, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+    ivec2 size = halfResolution ? (app->renderSize + 1) / 2 : app->renderSize;
+    GLuint groupsX = (size.x + TILED_LIGHTING_TILE_SIZE - 1) / TILED_LIGHTING_TILE_SIZE;
+    GLuint groupsY = (size.y + TILED_LIGHTING_TILE_SIZE - 1) / TILED_LIGHTING_TILE_SIZE;
+    // The frame graph puts the barriers before the passes reading the result
+    glDispatchCompute(groupsX, groupsY, 1);
+
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glUseProgram(0);
+}
+
+bool IsLightingHalfResolution(const App* app)
+{
+    return app->halfResolutionLighting && app->lightingPath != LightingPath_LightVolumes;
+}
+
+bool IsBloomThresholdFused(const App* app)
+{
+    return app->lightingPath == LightingPath_TiledCompute && !IsLightingHalfResolution(app) && app->renderSize == app->displaySize;
+}
+
+void PassLightUpsample(App* app)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+    glDisable(GL_DEPTH_TEST);
+
+    Program& lightUpsampleProgram = app->programs[app->lightUpsampleProgramIdx];
+    glUseProgram(lightUpsampleProgram.handle);
+
+    glUniform1i(app->lightUpsampleProgram_uAlbedo, 6);
+    glUniform1i(app->lightUpsampleProgram_uNormal, 8);
+    glUniform1i(app->lightUpsampleProgram_uDepth, 9);
+    glUniform1i(app->lightUpsampleProgram_uBakedLight, 11);
+    glUniform1i(app->lightUpsampleProgram_uLight, 12);
+    glUniformMatrix4fv(app->lightUpsampleProgram_uProjection, 1, GL_FALSE, &app->camera.projection[0][0]);
+    glUniform2f(app->lightUpsampleProgram_uViewportSize, (float)app->renderSize.x, (float)app->renderSize.y);
+
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, app->colorAttachmentTexture);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, app->normalAttachmentTexture);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, app->gBufferDepthTexture);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, app->bakedLightAttachmentTexture);
+    glActiveTexture(GL_TEXTURE12);
+    glBindTexture(GL_TEXTURE_2D, app->halfLightTexture);
+
+    glBindVertexArray(app->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    glBindVertexArray(0);
+
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(0);
+}
+
+void UpdateLightClusters(App* app)
+{
+    LightCulling::ClusterGrid& clusterGrid = app->clusterGrid;
+    LightCulling::Build(clusterGrid, app->packedLights, app->packedDirectionalLightCount,
+        app->camera.view, app->camera.projection, app->camera.zNear, app->camera.zFar);
+
+    // Rebuilt every frame, so the buffers are simply respecified
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->clusterBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, clusterGrid.clusters.size() * sizeof(glm::uvec2), clusterGrid.clusters.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, app->clusterBuffer);
+
+    // Never empty, a zero sized buffer cannot be bound
+    if (clusterGrid.lightIndices.empty())
+        clusterGrid.lightIndices.push_back(0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->clusterLightIndexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, clusterGrid.lightIndices.size() * sizeof(u32), clusterGrid.lightIndices.data(), GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, app->clusterLightIndexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void PassLightVolumes(App* app)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
+    glViewport(0, 0, app->renderSize.x, app->renderSize.y);
+
+    // The volumes are depth tested against the scene
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, app->gBuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->lightBuffer);
+    glBlitFramebuffer(0, 0, app->renderSize.x, app->renderSize.y, 0, 0, app->renderSize.x, app->renderSize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, app->lightBuffer);
+
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, app->colorAttachmentTexture);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, app->normalAttachmentTexture);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, app->gBufferDepthTexture);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, app->bakedLightAttachmentTexture);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    glm::mat4 viewProjection = app->camera.projection * app->camera.view;
+    glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+
+    // Directional lights cover the whole screen anyway
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+
+    Program& lightProgram = app->programs[app->lightProgramIdx];
+    glUseProgram(lightProgram.handle);
+    glUniform1i(app->lightProgram_uAlbedo, 6);
+    glUniform1i(app->lightProgram_uNormal, 8);
+    glUniform1i(app->lightProgram_uDepth, 9);
+    glUniform1i(app->lightProgram_uBakedLight, 11);
+    glUniform1i(app->lightProgram_uDirectionalOnly, 1);
+    glUniformMatrix4fv(app->lightProgram_uInverseViewProjection, 1, GL_FALSE, &inverseViewProjection[0][0]);
+    glUniform1i(app->lightProgram_uSampleScale, 1);
+    glUniform2f(app->lightProgram_uViewportSize, (float)app->renderSize.x, (float)app->renderSize.y);
+    glUniform1ui(app->lightProgram_uDirectionalLightCount, app->packedDirectionalLightCount);
+
+    glBindVertexArray(app->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    glBindVertexArray(0);
+
+    // Point lights, one sphere instance each, added on top
+    u32 pointLightCount = app->packedLights.size() / 2 - app->packedDirectionalLightCount;
+    if (pointLightCount > 0) {
+        Program& lightVolumeProgram = app->programs[app->lightVolumeProgramIdx];
+        glUseProgram(lightVolumeProgram.handle);
+
+        Mesh& sphereMesh = app->meshes[app->models[app->primitiveIdxs[1]].meshIdx];
+
+        // The faces of the tessellated sphere sit inside the true sphere, so the proxy is grown a bit
+        float sphereMeshRadius = (sphereMesh.aabbMax.x - sphereMesh.aabbMin.x) * 0.5f;
+        glUniformMatrix4fv(app->lightVolumeProgram_uViewProjection, 1, GL_FALSE, &viewProjection[0][0]);
+        glUniformMatrix4fv(app->lightVolumeProgram_uInverseViewProjection, 1, GL_FALSE, &inverseViewProjection[0][0]);
+        glUniform2f(app->lightVolumeProgram_uViewportSize, (float)app->renderSize.x, (float)app->renderSize.y);
+        glUniform1f(app->lightVolumeProgram_uProxyScale, 1.15f / sphereMeshRadius);
+        glUniform1ui(app->lightVolumeProgram_uFirstLight, app->packedDirectionalLightCount);
+        glUniform1i(app->lightVolumeProgram_uAlbedo, 6);
+        glUniform1i(app->lightVolumeProgram_uNormal, 8);
+        glUniform1i(app->lightVolumeProgram_uDepth, 9);
+        glUniform1i(app->lightVolumeProgram_uBakedLight, 11);
+
+        // Back faces behind the scene surface: only pixels in front of the far side of the
+        // volume are shaded, including when the camera is inside it. The shader rejects the
+        // ones in front of the near side by distance.
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_GEQUAL);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+
+        GLuint vao = FindVAO(sphereMesh, 0, lightVolumeProgram);
+        glBindVertexArray(vao);
+        glDrawElementsInstanced(GL_TRIANGLES, sphereMesh.submeshes[0].indices.size(), GL_UNSIGNED_INT, (void*)(u64)sphereMesh.submeshes[0].indexOffset, pointLightCount);
+        glBindVertexArray(0);
+
+        glDisable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(0);
+}
+
+bool AreLightmapsActive(const App* app)
+{
+    return app->lightmapsBaked && app->useLightmaps;
+}
+
+bool IsEntityLightmapped(const App* app, const Entity& entity)
+{
+    return AreLightmapsActive(app) && entity.isStatic && entity.lightmapScaleOffset.x > 0.0f;
+}
+
+// Average colour of the albedo texture, from its last mip level
+vec3 AverageAlbedo(App* app, u32 materialIdx)
+{
+    if (materialIdx >= app->materials.size() || app->materials[materialIdx].albedoTextureIdx >= app->textures.size())
+        return vec3(0.5f);
+
+    glBindTexture(GL_TEXTURE_2D, app->textures[app->materials[materialIdx].albedoTextureIdx].handle);
+    GLint width = 0, height = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    GLint lastLevel = (GLint)floorf(log2f((float)glm::max(glm::max(width, height), 1)));
+
+    vec4 average(0.5f);
+    glGetTexImage(GL_TEXTURE_2D, lastLevel, GL_RGBA, GL_FLOAT, &average[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Keeps the bounces from adding energy
+    return glm::min(vec3(average), vec3(0.9f));
+}
+
+Lightmapper::Light ToBakeLight(const Light& light)
+{
+    Lightmapper::Light bakeLight;
+    bakeLight.position = light.position;
+    bakeLight.direction = light.direction;
+    bakeLight.color = light.color * light.intensity;
+    bakeLight.radius = light.type == LightType_Point ? ComputeLightRadius(light) : 0.0f;
+    bakeLight.directional = light.type == LightType_Directional;
+    return bakeLight;
+}
+
+void BakeLightmaps(App* app)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<u32> staticEntities;
+    for (u32 i = 0; i < app->entities.size(); ++i) {
+        app->entities[i].lightmapScaleOffset = vec4(0.0f);
+        if (app->entities[i].isStatic)
+            staticEntities.push_back(i);
+    }
+
+    app->lightmapsBaked = false;
+    app->lightmapAtlasFull = false;
+    app->lightsDirty = true;
+    if (staticEntities.empty())
+        return;
+
+    // A mesh is laid out once for its largest static instance, the smaller ones get more
+    // texels than the density asks for rather than charts thinner than the gutters
+    std::unordered_map<u32, float> meshTexelsPerUnit;
+    for (u32 entityIdx : staticEntities) {
+        const Entity& entity = app->entities[entityIdx];
+        float scale = glm::max(glm::length(vec3(entity.worldMatrix[0])), glm::max(glm::length(vec3(entity.worldMatrix[1])), glm::length(vec3(entity.worldMatrix[2]))));
+        float& texelsPerUnit = meshTexelsPerUnit[app->models[entity.modelIndex].meshIdx];
+        texelsPerUnit = glm::max(texelsPerUnit, app->lightmapTexelDensity * scale);
+    }
+    for (const auto& mesh : meshTexelsPerUnit)
+        ModelHelper::BuildLightmapMesh(app, mesh.first, mesh.second);
+
+    // One tile per static entity, the atlas is as large as they need up to lightmapSize
+    std::vector<glm::uvec2> tileSizes;
+    for (u32 entityIdx : staticEntities)
+        tileSizes.push_back(app->meshes[app->models[app->entities[entityIdx].modelIndex].meshIdx].lightmapSize);
+
+    std::vector<glm::uvec2> tilePositions;
+    u32 atlasHeight = 0;
+    if (!Lightmapper::PackRects(tileSizes, (u32)app->lightmapSize, tilePositions, atlasHeight) || atlasHeight > (u32)app->lightmapSize) {
+        app->lightmapAtlasFull = true;
+        return;
+    }
+    u32 atlasWidth = 1;
+    for (u32 k = 0; k < staticEntities.size(); ++k)
+        atlasWidth = glm::max(atlasWidth, tilePositions[k].x + tileSizes[k].x);
+    vec2 atlasSize = vec2((float)atlasWidth, (float)atlasHeight);
+
+    Lightmapper::Scene scene;
+    std::unordered_map<u32, vec3> albedos;
+    for (u32 k = 0; k < staticEntities.size(); ++k) {
+        Entity& entity = app->entities[staticEntities[k]];
+        vec2 tileScale = vec2(tileSizes[k]) / atlasSize;
+        vec2 tileOffset = vec2(tilePositions[k]) / atlasSize;
+        entity.lightmapScaleOffset = vec4(tileScale, tileOffset);
+
+        Model& model = app->models[entity.modelIndex];
+        Mesh& lightmapMesh = app->meshes[app->meshes[model.meshIdx].lightmapMeshIdx];
+
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(entity.worldMatrix)));
+        for (u32 i = 0; i < lightmapMesh.submeshes.size(); ++i) {
+            const Submesh& submesh = lightmapMesh.submeshes[i];
+            u32 vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+
+            u32 normalOffset = 0;
+            u32 lightmapOffset = 0;
+            for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes) {
+                if (attribute.location == 1)
+                    normalOffset = attribute.offset / sizeof(float);
+                else if (attribute.location == LIGHTMAP_TEXCOORD_LOCATION)
+                    lightmapOffset = attribute.offset / sizeof(float);
+            }
+
+            u32 materialIdx = model.materialIdx[i];
+            if (albedos.find(materialIdx) == albedos.end())
+                albedos[materialIdx] = AverageAlbedo(app, materialIdx);
+
+            u32 vertexCount = submesh.vertices.size() / vertexStride;
+            for (u32 v = 0; v < vertexCount; ++v) {
+                const float* vertex = &submesh.vertices[v * vertexStride];
+                scene.positions.push_back(vec3(entity.worldMatrix * vec4(vertex[0], vertex[1], vertex[2], 1.0f)));
+                scene.normals.push_back(glm::normalize(normalMatrix * vec3(vertex[normalOffset], vertex[normalOffset + 1], vertex[normalOffset + 2])));
+                scene.uvs.push_back(glm::vec2(vertex[lightmapOffset], vertex[lightmapOffset + 1]) * tileScale + tileOffset);
+                if (v % 3 == 2)
+                    scene.albedos.push_back(albedos[materialIdx]);
+            }
+        }
+    }
+
+    for (const Light& light : app->lights) {
+        if (light.isStatic)
+            scene.lights.push_back(ToBakeLight(light));
+    }
+    scene.skyColor = app->skyAmbient;
+
+    Lightmapper::Settings settings;
+    settings.width = atlasWidth;
+    settings.height = atlasHeight;
+    settings.samples = (u32)app->lightmapSamples;
+    settings.bounces = (u32)app->lightmapBounces;
+
+    std::vector<glm::vec3> lightmap;
+    Lightmapper::Bake(scene, settings, lightmap);
+
+    if (app->lightmapTexture == 0)
+        glGenTextures(1, &app->lightmapTexture);
+    glBindTexture(GL_TEXTURE_2D, app->lightmapTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, settings.width, settings.height, 0, GL_RGB, GL_FLOAT, lightmap.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    app->lightmapsBaked = true;
+    app->lightmapBakeSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BuildProbeGrid(App* app)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Every entity blocks and reflects light for the probes, static or not
+    Lightmapper::Scene scene;
+    std::unordered_map<u32, vec3> albedos;
+    vec3 boundsMin(FLT_MAX);
+    vec3 boundsMax(-FLT_MAX);
+    for (const Entity& entity : app->entities) {
+        Model& model = app->models[entity.modelIndex];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(entity.worldMatrix)));
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i) {
+            const Submesh& submesh = mesh.submeshes[i];
+            u32 vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+
+            u32 normalOffset = 0;
+            for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes) {
+                if (attribute.location == 1)
+                    normalOffset = attribute.offset / sizeof(float);
+            }
+
+            u32 materialIdx = model.materialIdx[i];
+            if (albedos.find(materialIdx) == albedos.end())
+                albedos[materialIdx] = AverageAlbedo(app, materialIdx);
+
+            for (u32 k = 0; k < submesh.indices.size(); ++k) {
+                const float* vertex = &submesh.vertices[submesh.indices[k] * vertexStride];
+                vec3 position = vec3(entity.worldMatrix * vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+                scene.positions.push_back(position);
+                scene.normals.push_back(glm::normalize(normalMatrix * vec3(vertex[normalOffset], vertex[normalOffset + 1], vertex[normalOffset + 2])));
+                if (k % 3 == 2)
+                    scene.albedos.push_back(albedos[materialIdx]);
+
+                boundsMin = glm::min(boundsMin, position);
+                boundsMax = glm::max(boundsMax, position);
+            }
+        }
+    }
+
+    if (scene.positions.empty()) {
+        boundsMin = vec3(-1.0f);
+        boundsMax = vec3(1.0f);
+    }
+
+    for (const Light& light : app->lights)
+        scene.lights.push_back(ToBakeLight(light));
+    scene.skyColor = app->skyAmbient;
+
+    IrradianceProbes::Init(app->probeGrid, boundsMin, boundsMax, app->probeSpacing, std::move(scene));
+    IrradianceProbes::UpdateAll(app->probeGrid, (u32)app->probeRayCount);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->probeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, app->probeGrid.coefficients.size() * sizeof(vec4), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, app->probeBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    app->probesDirty = false;
+    app->probeBuildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+}
+
+void UpdateProbes(App* app)
+{
+    // Rebuilt when they are turned back on, the shaders skip them until then
+    if (!app->useProbes)
+        return;
+
+    if (app->probesDirty) {
+        BuildProbeGrid(app);
+    }
+    else {
+        // Lights move and change colour freely, the probes catch up over the next frames
+        IrradianceProbes::ProbeGrid& grid = app->probeGrid;
+        grid.scene.lights.clear();
+        for (const Light& light : app->lights)
+            grid.scene.lights.push_back(ToBakeLight(light));
+        grid.scene.skyColor = app->skyAmbient;
+
+        if (app->probeUpdatesPerFrame == 0)
+            return;
+
+        IrradianceProbes::UpdateNext(grid, (u32)app->probeUpdatesPerFrame, (u32)app->probeRayCount);
+    }
+
+    // Small enough to send whole, the updated probes are spread around it
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->probeBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, app->probeGrid.coefficients.size() * sizeof(vec4), app->probeGrid.coefficients.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void UploadBlurKernel(App* app)
+{
+    if (app->blurKernel.radius == app->kernelRad)
+        return;
+
+    app->blurKernel = BlurKernel::Build(app->kernelRad);
+    const BlurKernel::Kernel& kernel = app->blurKernel;
+
+    // std140: radius and tap count, then one vec4 per distance, the discrete weight in x for
+    // the compute blur and the folded tap offset and weight in y and z for the fragment one
+    std::vector<vec4> packed(BLUR_KERNEL_MAX_RADIUS + 2, vec4(0.0f));
+    glm::ivec4 counts(kernel.radius, kernel.tapCount, 0, 0);
+    memcpy(&packed[0], &counts, sizeof(counts));
+    for (i32 i = 0; i <= kernel.radius; ++i)
+        packed[i + 1].x = kernel.weights[i];
+    for (u32 i = 0; i < kernel.tapCount; ++i) {
+        packed[i + 1].y = kernel.tapOffsets[i];
+        packed[i + 1].z = kernel.tapWeights[i];
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, app->blurKernelBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, packed.size() * sizeof(vec4), packed.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
@@ -9,6 +9,13 @@
 #include <unordered_map>
 #include "BufferManagement.h"
 #include "ModelLoadHelper.h"
+#include "SoftwareOcclusion.h"
+#include "LightCulling.h"
+#include "IrradianceProbes.h"
+#include "RenderTargetPool.h"
+#include "DynamicResolution.h"
+#include "FrameGraph.h"
+#include "BlurKernel.h"
 
 typedef glm::vec2  vec2;
 typedef glm::vec3  vec3;
@@ -20,7 +27,8 @@ typedef glm::ivec4 ivec4;
 enum WaterScenePart {
     REFLECTION,
     REFRACTION,
-    NONE
+    NONE,
+    WATER_SCENE_PART_COUNT
 };
 
 struct Image
@@ -99,6 +107,72 @@ enum Mode
     Mode_Deferred
 };
 
+// How the deferred light pass is done
+enum LightingPath
+{
+    LightingPath_Fullscreen,
+    LightingPath_TiledCompute,
+    LightingPath_LightVolumes
+};
+
+// Which point lights the forward shader loops over
+enum ForwardLightList
+{
+    ForwardLightList_All,
+    ForwardLightList_Clustered,
+    ForwardLightList_PerObject
+};
+
+// How the bloom chain is blurred
+enum BloomFilter
+{
+    BloomFilter_Gaussian,
+    BloomFilter_DownUpsample
+};
+
+// What the Scene window shows in deferred mode, each a variant of the COMPOSITE program
+enum CompositeView
+{
+    CompositeView_Main,
+    CompositeView_Texture,
+    CompositeView_Position,
+    CompositeView_Normal,
+    CompositeView_Depth,
+    CompositeView_Count
+};
+
+struct CompositeProgram
+{
+    u32    programIdx;
+    GLuint uSource;
+    GLuint uSourceScale;
+    GLuint uBloom;
+    GLuint uBloomLevels;
+    GLuint uBloomScale;
+    GLuint uDepth;
+    GLuint uInverseViewProjection;
+    GLuint uNear;
+    GLuint uFar;
+    GLuint uViewportSize;
+};
+
+// Levels of the bloom chain, the first one at half the render size
+#define BLOOM_MAX_MIPS 8
+
+// Must match GROUP_SIZE of BLOOM_BLUR in shaders.glsl
+#define BLOOM_BLUR_GROUP_SIZE 128
+
+// Must match MAX_OBJECT_LIGHTS in RENDER_GEOMETRY.glsl, multiple of 4 (packed as uvec4)
+#define MAX_OBJECT_LIGHTS 8
+
+// Must match local_size in TILED_LIGHTING
+#define TILED_LIGHTING_TILE_SIZE 16
+
+// Clustered forward grid, screen tiles by exponential depth slices
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+
 struct VertexShaderLayout
 {
     std::vector<VertexShaderAttribute> attributes;
@@ -110,6 +184,18 @@ struct Vao
     GLuint programHandle;
 };
 
+// Vertex attribute of the lightmap coordinates, only lightmap meshes have it
+#define LIGHTMAP_TEXCOORD_LOCATION 5
+
+// Detail levels per submesh, including the full one
+#define MAX_MESH_LODS 4
+
+struct SubmeshLod
+{
+    u32 indexOffset; // In bytes, like Submesh::indexOffset
+    u32 indexCount;
+};
+
 struct Submesh
 {
     VertexBufferLayout vertexBufferLayout;
@@ -118,6 +204,17 @@ struct Submesh
     u32 vertexOffset;
     u32 indexOffset;
 
+    // Object space bounds
+    vec3  aabbMin;
+    vec3  aabbMax;
+    vec3  sphereCenter;
+    float sphereRadius;
+
+    // Simplified index lists over the same vertices, stored after the full one in the index buffer.
+    // lods[0] is the full detail submesh.
+    std::vector<u32>        lodIndices;
+    std::vector<SubmeshLod> lods;
+
     std::vector<Vao> vaos;
 };
 
@@ -126,6 +223,20 @@ struct Mesh
     std::vector<Submesh>    submeshes;
     GLuint                  vertexBufferHandle;
     GLuint                  indexBufferHandle;
+
+    // Object space bounds of all the submeshes
+    vec3                    aabbMin;
+    vec3                    aabbMax;
+    u32                     triangleCount;
+
+    u32                     lodCount;
+    u32                     lodTriangleCount[MAX_MESH_LODS];
+
+    // Copy with lightmap coordinates, built by the baker for the texel density it used.
+    // The coordinates span a lightmapSize texel tile.
+    u32                     lightmapMeshIdx = UINT32_MAX;
+    float                   lightmapTexelsPerUnit = 0.0f;
+    glm::uvec2              lightmapSize = glm::uvec2(0);
 };
 
 struct Model
@@ -172,6 +283,29 @@ struct Entity {
 	vec3 position;
 	vec3 rotation;
 	vec3 scale;
+
+    // Software occlusion culling
+    bool isOccluder = false;
+    bool occluded = false;
+
+    // Side of the water clipping plane, valid for the view the uniforms were last aligned for
+    bool clipPlaneCulled = false;
+    bool clipPlaneNeeded = true;
+
+    // Hardware occlusion queries, one per view, issued on the bounding box
+    GLuint occlusionQuery[WATER_SCENE_PART_COUNT] = {};
+    bool   occlusionQueryIssued[WATER_SCENE_PART_COUNT] = {};
+
+    // Detail level picked for each view
+    u32 lodLevel[WATER_SCENE_PART_COUNT] = {};
+
+    // Too small on screen to be worth drawing in each view
+    bool contributionCulled[WATER_SCENE_PART_COUNT] = {};
+
+    // Never moves, so it gets baked lighting. The scale and offset place the lightmap
+    // coordinates of the mesh in the atlas, zero when it has no lightmap.
+    bool isStatic = false;
+    vec4 lightmapScaleOffset = vec4(0.0f);
 };
 enum LightType
 {
@@ -188,6 +322,9 @@ struct Light
 	float intensity;
     std::string name; 
 
+    // Baked into the lightmaps of the static entities
+    bool isStatic = false;
+
     // Constructor
     Light(LightType type, vec3 color, vec3 direction, vec3 position, float intensity, std::string name) 
     {
@@ -259,7 +396,21 @@ struct App
     char gpuName[64];
     char openGlVersion[64];
 
+    // Render resolution, follows the Scene window content region
     ivec2 displaySize;
+    ivec2 sceneViewportSize;
+
+    // Every render size dependent texture comes from here, old sizes are freed once idle
+    RenderTargetPool::Pool renderTargetPool;
+
+    // Rebuilt every frame, hands the pool textures to the passes and aliases the transients
+    FrameGraph::Graph frameGraph;
+    std::vector<GLuint> attachedRenderTargets;
+
+    // The G-buffer, lighting and water passes render into the bottom left renderSize
+    // pixels of the displaySize targets, the composite scales them back up
+    ivec2 renderSize;
+    DynamicResolution::Controller dynamicResolution;
     
 	// Resources
     std::vector<Texture>    textures;
@@ -272,6 +423,16 @@ struct App
 
     // program indices
     u32 lightProgramIdx;
+
+    // Tiled compute lighting program
+    u32 tiledLightingProgramIdx;
+
+    // Instanced point light spheres
+    u32 lightVolumeProgramIdx;
+
+    // Half resolution light back to full resolution
+    u32 lightUpsampleProgramIdx;
+
     u32 texturedMeshProgramIdx;
 	u32 debugLightProgramIdx;
 	u32 forwardProgramIdx;
@@ -280,13 +441,22 @@ struct App
     u32 blitBrightestPixelProgramIdx;
 
     // Bloom/blur shader programs
-	u32 bloomProgramIdx;
 	u32 blurProgramIdx;
+    u32 bloomDownsampleProgramIdx;
+    u32 bloomUpsampleProgramIdx;
+    u32 bloomBlurProgramIdx;
 
     u32 patrickModel; 
 
     // Cubemap shader program
     u32 cubemapProgramIdx;
+
+    // Depth-only prepass programs, alpha tested for the G-buffer, positions only for forward
+    u32 depthPrepassProgramIdx;
+    u32 depthPrepassPositionProgramIdx;
+
+    // Bounding box program for occlusion queries
+    u32 occlusionProxyProgramIdx;
     
     // texture indices
     u32 diceTexIdx;
@@ -300,6 +470,13 @@ struct App
 
     // Mode
     Mode mode;
+    LightingPath lightingPath = LightingPath_TiledCompute;
+
+    // Shades the fullscreen and tiled light passes at half resolution, without the albedo,
+    // then a joint bilateral upsample guided by the G-buffer fills the light buffer
+    bool   halfResolutionLighting = false;
+    GLuint halfLightTexture;
+    GLuint halfLightBuffer;
 
     // Embedded geometry (in-editor simple meshes such as
     // a screen filling quad, a cube, a sphere...)
@@ -309,12 +486,57 @@ struct App
     // Location of the texture uniform in the textured quad shader
     GLuint programUniformTexture;
 	GLuint forwardProgram_uTexture;
+	GLuint forwardProgram_uLightList;
+	GLuint forwardProgram_uLightmap;
+	GLuint forwardProgram_uDirectionalLightCount;
+	GLuint forwardProgram_uClusterCount;
+	GLuint forwardProgram_uClusterTileSize;
+	GLuint forwardProgram_uClusterDepthScaleBias;
 	GLuint texturedMeshProgram_uTexture;
-	GLuint texturedMeshProgram_uNear;
-	GLuint texturedMeshProgram_uFar;
+    GLuint texturedMeshProgram_uLightmap;
+	GLuint depthPrepassProgram_uTexture;
+	GLuint occlusionProxyProgram_uWorldViewProjection;
     GLuint lightProgram_uAlbedo; 
 	GLuint lightProgram_uNormal;
-	GLuint lightProgram_uPosition;
+	GLuint lightProgram_uDepth;
+	GLuint lightProgram_uInverseViewProjection;
+	GLuint lightProgram_uViewportSize;
+    GLuint lightProgram_uDirectionalOnly;
+    GLuint lightProgram_uDirectionalLightCount;
+    GLuint lightProgram_uBakedLight;
+    GLuint lightProgram_uSampleScale;
+
+    GLuint lightVolumeProgram_uAlbedo;
+    GLuint lightVolumeProgram_uDepth;
+    GLuint lightVolumeProgram_uInverseViewProjection;
+    GLuint lightVolumeProgram_uViewportSize;
+    GLuint lightVolumeProgram_uNormal;
+    GLuint lightVolumeProgram_uViewProjection;
+    GLuint lightVolumeProgram_uProxyScale;
+    GLuint lightVolumeProgram_uFirstLight;
+    GLuint lightVolumeProgram_uBakedLight;
+
+    GLuint tiledLightingProgram_uAlbedo;
+    GLuint tiledLightingProgram_uInverseViewProjection;
+    GLuint tiledLightingProgram_uNormal;
+    GLuint tiledLightingProgram_uDepth;
+    GLuint tiledLightingProgram_uView;
+    GLuint tiledLightingProgram_uProjection;
+    GLuint tiledLightingProgram_uBakedLight;
+    GLuint tiledLightingProgram_uSampleScale;
+    GLuint tiledLightingProgram_uViewportSize;
+    GLuint tiledLightingProgram_uFusedBloom;
+    GLuint tiledLightingProgram_uBloomThreshold;
+    GLuint tiledLightingProgram_uSkybox;
+
+    GLuint lightUpsampleProgram_uLight;
+    GLuint lightUpsampleProgram_uAlbedo;
+    GLuint lightUpsampleProgram_uNormal;
+    GLuint lightUpsampleProgram_uDepth;
+    GLuint lightUpsampleProgram_uBakedLight;
+    GLuint lightUpsampleProgram_uProjection;
+    GLuint lightUpsampleProgram_uViewportSize;
+
     GLuint uProjectionMatrix; 
 	GLuint uLightColor;
 	
@@ -323,13 +545,19 @@ struct App
     GLuint colorMap;
     GLuint colorTexture; 
 	GLuint threshold;
+	GLuint blitBrightestProgram_uRenderScale;
     GLuint inputLod; 
     GLuint dir; 
-    GLuint colorMapBlend;
-    GLuint maxLod;
-	GLuint mainTexture;
-	GLuint kernelRadius;
-	
+    GLuint bloomDownsampleProgram_uSource;
+    GLuint bloomUpsampleProgram_uSource;
+    GLuint bloomUpsampleProgram_uIntensity;
+    GLuint bloomBlurProgram_uSource;
+    GLuint bloomBlurProgram_uDir;
+    GLuint bloomBlurProgram_uIntensities;
+
+    // Bloom added to the lit color, or the attachment viewer, in one fullscreen pass
+    CompositeProgram compositePrograms[CompositeView_Count];
+
     //Water effect uniforms
     //GLuint waterWVP;
     GLuint waterProgram_uView;
@@ -349,17 +577,18 @@ struct App
 	float moveFactor = 0.0f; 
 
 
-	// Color attachment of the framebuffer
+	// Color attachment of the framebuffer. The G-buffer is RGBA8 albedo, RG16 octahedral
+	// normals and the baked light, positions come from gBufferDepthTexture.
 	GLuint colorAttachmentTexture;
-	GLuint depthAttachmentTexture;
 	GLuint normalAttachmentTexture;
-	GLuint positionAttachmentTexture;
 	GLuint mainAttachmentTexture;
 
 	GLuint blitAttachmentTexture;
-    GLuint bloomAttachmentTexture;
 
-    // Render selector
+    // Final image of the deferred path, what the Scene window shows
+    GLuint compositeTexture;
+
+    // Render selector, the texture each view is made from
 	std::unordered_map<std::string, GLuint> renderSelector;
     std::string currentAttachment = "Main";
 
@@ -389,7 +618,10 @@ struct App
 	// Framebuffers for deferred
     GLuint gBuffer;
 	GLuint lightBuffer;
-	GLuint bloomBuffer;
+	GLuint compositeBuffer;
+
+    // Shared by the light and forward framebuffers
+    GLuint depthLightAttachmentTexture;
 
     // Textures for water effect
 	GLuint rtRefraction;
@@ -404,14 +636,10 @@ struct App
     //CubeMap
     GLuint rtCubemap;
 
-    // Bloom mipmap
+    // Bloom mipmap, one framebuffer per level with rtBright and rtBloomH attached
     GLuint rtBright; 
     GLuint rtBloomH; 
-	GLuint fboBloom1;
-	GLuint fboBloom2;
-	GLuint fboBloom3;
-	GLuint fboBloom4;
-	GLuint fboBloom5;
+    GLuint bloomMipBuffers[BLOOM_MAX_MIPS];
 
     // Framebuffer for forward
     GLuint forwardBuffer; 
@@ -428,7 +656,10 @@ struct App
 	float valThreshold = 1.0f; 
     int kernelRad = 24; 
     float inputLodIntensity = 1.0f;
-	float intensities[5]  = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+	float intensities[BLOOM_MAX_MIPS]  = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+    BloomFilter bloomFilter = BloomFilter_DownUpsample;
+    bool computeBloomBlur = true;
+    int bloomMipCount = 5;
 	
     // primitives
     std::vector<std::string> primitives = {"Cube", "Sphere","Cone", "Cylinder","Plane", "Torus" };
@@ -441,21 +672,130 @@ struct App
 
 	bool showDebugLights = false;
 	bool enableWaterPlane = true;
+
+    // Water visibility, the reflection and refraction passes are skipped when the plane is not seen
+    bool   enableWaterOcclusionQuery = true;
+    bool   waterInView = false;
+    bool   waterOccluded = false;
+    bool   waterPassesRendered = false;
+    GLuint waterOcclusionQuery;
+    bool   waterQueryPending = false;
+    u32    waterPlaneCulledCount[2] = {};
+
+    // Software occlusion culling
+    SoftwareOcclusion::DepthBuffer occlusionBuffer;
+    bool enableSoftwareOcclusion = true;
+    u32  occlusionCulledCount = 0;
+
+    // Depth prepass, per pass toggles and automatic selection from measured overdraw
+    bool   depthPrepassForward = false;
+    bool   depthPrepassDeferred = false;
+    bool   depthPrepassAuto = true;
+    float  depthPrepassOverdrawThreshold = 1.5f;
+    float  measuredOverdraw = 0.0f;
+    GLuint overdrawQuery;
+    bool   overdrawQueryActive = false;
+    bool   overdrawQueryPending = false;
+    Mode   overdrawQueryMode;
+
+    // Hardware occlusion queries with conditional rendering for heavy entities
+    bool enableOcclusionQueries = true;
+    int  occlusionQueryTriangleThreshold = 10000;
+    u32  occlusionQueriesIssued = 0;
+    u32  occlusionQueryHits = 0;    // Found visible
+    u32  occlusionQueryMisses = 0;  // Found hidden, draw skipped by the GPU
+    u32  occlusionQueriesPending = 0;
+
+    // Mesh LOD selection by projected size, as a fraction of the screen height
+    bool  enableLods = true;
+    float lodScreenSizes[MAX_MESH_LODS - 1] = { 0.5f, 0.25f, 0.1f };
+    float lodHysteresis = 0.1f;
+    float lodWaterViewScale = 0.5f;
+    u32   lodTrianglesFull = 0;
+    u32   lodTrianglesDrawn = 0;
+
+    // Projected area under which entities are dropped, per view. The water views are distorted
+    // by the DuDv map so they can drop a lot more.
+    bool  enableContributionCulling = true;
+    float contributionCullPixels[WATER_SCENE_PART_COUNT] = { 400.0f, 400.0f, 16.0f };
+    u32   contributionCulledCount[WATER_SCENE_PART_COUNT] = {};
+
+    // Lights in a shader storage buffer at binding 3, uploaded only when they change
+    GLuint lightStorageBuffer;
+    u32    lightStorageCapacity = 0;
+    bool   lightsDirty = true;
+    std::vector<vec4> packedLights;
+    u32    packedDirectionalLightCount = 0;
+
+    ForwardLightList forwardLightList = ForwardLightList_Clustered;
+
+    // Strongest lights of each entity, sent with its local params
+    LightCulling::LightGrid lightGrid;
+    u32    objectLightsAssigned = 0;
+
+    // Clustered forward light lists, cluster ranges at binding 4 and light indices at binding 5
+    LightCulling::ClusterGrid clusterGrid;
+    GLuint clusterBuffer;
+    GLuint clusterLightIndexBuffer;
+
+    // G-buffer depth, read by the tiled lighting pass
+    GLuint gBufferDepthTexture;
+
+    // Lightmaps of the static entities from the static lights, one atlas for the scene.
+    // The G-buffer keeps the baked light times the albedo, alpha set where it is baked.
+    bool   lightmapsBaked = false;
+    bool   lightmapAtlasFull = false; // The tiles at this density did not fit, nothing baked
+    bool   useLightmaps = true;
+    float  lightmapTexelDensity = 4.0f; // Texels per world unit
+    int    lightmapSize = 2048;         // Largest atlas side
+    int    lightmapSamples = 32;
+    int    lightmapBounces = 1;
+    float  lightmapBakeSeconds = 0.0f;
+    GLuint lightmapTexture = 0;
+    GLuint bakedLightAttachmentTexture;
+
+    // Ambient and indirect light of every pixel from a grid of probes, traced on the CPU a
+    // few probes per frame. Coefficients at binding 6, the grid in the global params.
+    // Lightmapped pixels already have it baked and skip them.
+    IrradianceProbes::ProbeGrid probeGrid;
+    bool   useProbes = true;
+    bool   probesDirty = true;
+    float  probeSpacing = 4.0f;
+    int    probeUpdatesPerFrame = 1;
+    int    probeRayCount = 128;
+    vec3   skyAmbient = vec3(0.2f);
+    float  probeBuildSeconds = 0.0f;
+    GLuint probeBuffer;
+
+    // Weights of the bloom blur for kernelRad, in a uniform buffer at binding 3, rebuilt
+    // only when the radius changes
+    BlurKernel::Kernel blurKernel = {};
+    GLuint blurKernelBuffer;
 };
 
 void Init(App* app);
 
+void Shutdown(App* app);
+
 void InitFramebuffers(App* app);
 
 void InitBuffers(App* app);
 
 void InitOpenGLInfo(App* app);
 
-void InitBloomMipmap(App* app);
-
 unsigned int LoadCubemap(std::vector<std::string> faces);
 
-void GenBloomFramebuffers(App* app);
+// Attaches the color textures at one mip level, and the depth, checking the status once all are there
+void AttachFramebuffer(GLuint fbo, const GLuint* colors, u32 colorCount, GLuint depth, GLint level);
+
+// Re-attaches the framebuffers when the frame graph handed out other textures
+void AttachRenderTargets(App* app);
+
+// Follows the Scene window size from last frame, the frame graph sizes the targets from it
+void ResizeRenderTargets(App* app);
+
+// Scaled render size for the next frame, from the dynamic resolution controller
+void UpdateRenderSize(App* app);
 
 void Gui(App* app);
 
@@ -463,11 +803,51 @@ void Update(App* app);
 
 void Render(App* app);
 
+// Declares the passes of the current mode with the textures they read and write
+void BuildFrameGraph(App* app);
+
+void PassForward(App* app);
+
+void PassWaterReflection(App* app);
+
+void PassWaterRefraction(App* app);
+
+// Draws the plane into the G-buffer, only as an occlusion proxy without the water textures
+void PassWaterSurface(App* app, bool texturesRendered);
+
+// Fullscreen deferred lighting, at half resolution when enabled
+void PassLighting(App* app);
+
+void PassSkybox(App* app);
+
+// Blurs every mip of the bloom chain in one direction
+void PassBloomBlur(App* app, GLuint texture, GLenum colorAttachment, int dirX, int dirY);
+
+// Same blur as a compute shader, one dispatch for every mip, texels shared through groupshared memory
+void PassBloomBlurCompute(App* app, GLuint source, GLuint destination, int dirX, int dirY);
+
+// 13 tap filtered downsample of every level of rtBright into the next one
+void PassBloomDownsample(App* app);
+
+// 3x3 tent upsample of every level of rtBright added into the one above, ends in level 0
+void PassBloomUpsample(App* app);
+
+// Size of a level of the bloom chain
+ivec2 BloomMipSize(const App* app, u32 level);
+
+// Light meshes into the main color, depth tested against the light buffer depth
+void PassDebugLights(App* app);
+
 void PassBlur(App* app, u32 fbo, int w, int h, GLenum colorAttachment, GLuint texture, GLint inputLod, int dirX, int dirY, float inputLodIntensity = 1.0);
 
 void PassBlitBrightPixels(App* app, u32 fbo, int w, int h, GLenum colorAttachment, GLuint texture, float threshold);
 
-void PassBloom(App* app, u32 fbo, GLenum colorAttachment, GLuint texture, int maxLod);
+// The view of the Scene window for an attachment name
+CompositeView GetCompositeView(const std::string& attachment);
+
+// Final image at the display size: the view of currentAttachment and the debug lights, in
+// one framebuffer bind. Covers the whole target, so it is not cleared.
+void PassComposite(App* app);
 
 u32 LoadTexture2D(App* app, const char* filepath);
 
@@ -495,8 +875,70 @@ void GuiInspectorCamera(App* app);
 
 void CameraDirection(Camera& cam);
 
+void DrawEntitySubmeshes(App* app, const Entity& entity, Program& program, GLint textureLocation, u32 lodLevel);
+
+bool IsEntityDrawn(const Entity& entity, WaterScenePart part);
+
+// Per view culling and LOD selection, before the view is drawn
+void SetupViewEntities(App* app, const Camera& camera, WaterScenePart part);
+
 void DrawScene(App* app, u32 programIdx, GLuint fbo, Camera camera, WaterScenePart part);
 
+void PassDepthPrepass(App* app, GLuint fbo, bool alphaTest);
+
+void BeginOverdrawQuery(App* app);
+
+void EndOverdrawQuery(App* app);
+
+void UpdateOverdrawMeasure(App* app);
+
+bool BeginEntityConditionalRender(App* app, const Entity& entity, const Camera& camera, WaterScenePart part);
+
+void IssueOcclusionQueries(App* app, const Camera& camera, WaterScenePart part);
+
 void PassWaterScene(App* app, Camera camera, GLuint fbo, WaterScenePart part);
 
-void RenderSkybox(App* app, Camera camera);
\ No newline at end of file
+bool IsAABBInFrustum(const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::mat4& worldViewProjection);
+
+bool UpdateWaterVisibility(App* app);
+
+void RenderSkybox(App* app, Camera camera);
+
+void UpdateSoftwareOcclusion(App* app);
+
+float ComputeLightRadius(const Light& light);
+
+void UploadLights(App* app);
+
+void PassTiledLighting(App* app);
+
+void PassLightVolumes(App* app);
+
+// Light volumes always shade at full resolution
+bool IsLightingHalfResolution(const App* app);
+
+// The tiled lighting writes level 0 of rtBright itself, each 2x2 quad reduced in shared
+// memory, and shades the sky in place of the skybox pass. The other paths, half resolution
+// and dynamic resolution, where the quads do not map onto level 0, keep the bright pass.
+bool IsBloomThresholdFused(const App* app);
+
+// Half resolution light to the light buffer, times the full resolution albedo
+void PassLightUpsample(App* app);
+
+// Path traces the static lights into a lightmap atlas for the static entities
+void BakeLightmaps(App* app);
+
+bool AreLightmapsActive(const App* app);
+
+bool IsEntityLightmapped(const App* app, const Entity& entity);
+
+// Places the probes over the scene and traces all of them, when the geometry changed
+void BuildProbeGrid(App* app);
+
+// Traces the next probes of the round robin and uploads the grid
+void UpdateProbes(App* app);
+
+void UpdateLightClusters(App* app);
+
+// Uploads the blur weights and folded taps when kernelRad changed
+void UploadBlurKernel(App* app);
\ No newline at end of file
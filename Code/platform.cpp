@@ -111,8 +111,7 @@ void OnGlfwCharEvent(GLFWwindow* window, unsigned int character)
 
 void OnGlfwResizeFramebuffer(GLFWwindow* window, int width, int height)
 {
-    App* app = (App*)glfwGetWindowUserPointer(window);
-    app->displaySize = vec2(width, height);
+    // The render size follows the Scene window instead, see ResizeRenderTargets
 }
 
 void OnGlfwCloseWindow(GLFWwindow* window)
@@ -269,6 +268,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    Shutdown(&app);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
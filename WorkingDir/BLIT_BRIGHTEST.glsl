@@ -23,12 +23,16 @@
 	uniform sampler2D uTexture;
 	uniform float threshold;
 
+	// Rendered part of uTexture, the output covers the whole target
+	uniform vec2 uRenderScale;
+
 	layout(location = 0) out vec4 oColor;
 
 	void main()
 	{
 		vec3 luminances = vec3(0.2126, 0.7152, 0.0722);
-		vec4 texel = texture2D(uTexture, vTexCoord);
+		vec2 texCoord = min(vTexCoord * uRenderScale, uRenderScale - 0.5 / vec2(textureSize(uTexture, 0)));
+		vec4 texel = texture2D(uTexture, texCoord);
 		float luminance = dot(luminances, texel.rgb);
 		luminance = max(0.0, luminance - threshold);
 		texel.rgb *= sign(luminance);
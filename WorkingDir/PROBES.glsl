@@ -0,0 +1,49 @@
+///////////////////////////////////////////////////////////////////////
+// Irradiance probes, included by the programs that sample them after their
+// GlobalParams block, which has the probe grid members
+///////////////////////////////////////////////////////////////////////
+
+// Keep in sync with PROBE_SH_COEFFICIENTS
+#define PROBE_SH_COEFFICIENTS 9
+
+// Second order SH of every probe, already convolved for diffuse lighting
+layout(binding = 6, std430) readonly buffer Probes
+{
+	vec4 uProbeCoefficients[];
+};
+
+vec3 EvaluateProbe(uint probe, vec3 n)
+{
+	uint base = probe * PROBE_SH_COEFFICIENTS;
+	vec3 result = uProbeCoefficients[base + 0].rgb * 0.282095;
+	result += uProbeCoefficients[base + 1].rgb * 0.488603 * n.y;
+	result += uProbeCoefficients[base + 2].rgb * 0.488603 * n.z;
+	result += uProbeCoefficients[base + 3].rgb * 0.488603 * n.x;
+	result += uProbeCoefficients[base + 4].rgb * 1.092548 * n.x * n.y;
+	result += uProbeCoefficients[base + 5].rgb * 1.092548 * n.y * n.z;
+	result += uProbeCoefficients[base + 6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0);
+	result += uProbeCoefficients[base + 7].rgb * 1.092548 * n.x * n.z;
+	result += uProbeCoefficients[base + 8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+	return max(result, vec3(0.0));
+}
+
+// Ambient and indirect light, blended from the eight probes around the point
+vec3 SampleProbes(vec3 pos, vec3 normal)
+{
+	if (uUseProbes == 0u || uProbeGridDims.x < 2u)
+		return vec3(0.0);
+
+	vec3 gridPos = clamp((pos - uProbeGridMin) / uProbeCellSize, vec3(0.0), vec3(uProbeGridDims - 1u));
+	uvec3 cell = min(uvec3(gridPos), uProbeGridDims - 2u);
+	vec3 f = gridPos - vec3(cell);
+
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < 8u; i++)
+	{
+		uvec3 offset = uvec3(i & 1u, (i >> 1) & 1u, i >> 2);
+		vec3 w = mix(1.0 - f, f, vec3(offset));
+		uvec3 probe = cell + offset;
+		result += w.x * w.y * w.z * EvaluateProbe(probe.x + probe.y * uProbeGridDims.x + probe.z * uProbeGridDims.x * uProbeGridDims.y, normal);
+	}
+	return result;
+}
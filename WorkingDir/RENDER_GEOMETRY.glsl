@@ -5,38 +5,46 @@
 	layout(location=0) in vec3 aPosition;
 	layout(location=1) in vec3 aNormal;
 	layout(location=2) in vec2 aTexCoord;
+	layout(location=5) in vec2 aLightmapCoord;
 	//layout(location=3) in vec3 aTangent;
 	//layout(location=4) in vec3 aBitangent;
 
-	struct Light
-	{
-		uint type;
-		vec3 color;
-		vec3 direction;
-		vec3 position;
-	};
-	
+	// Same members as in the fragment stage, a block shared by both has to match
 	layout(binding = 0, std140) uniform GlobalParams
 	{
-		vec3 uCameraPosition;
-		uint uLightCount;
-		Light uLights[16];
+		vec3  uCameraPosition;
+		uint  uLightCount;
+		vec3  uProbeGridMin;
+		uint  uUseProbes;
+		vec3  uProbeCellSize;
+		uvec3 uProbeGridDims;
 	};
 
+	// Keep in sync with MAX_OBJECT_LIGHTS
+	#define MAX_OBJECT_LIGHTS 8
+
 	layout(binding = 1, std140) uniform LocalParams
 	{
-		mat4 uWorldMatrix;
-		mat4 uWorldViewProjectionMatrix;
+		mat4  uWorldMatrix;
+		mat4  uWorldViewProjectionMatrix;
+		uvec4 uObjectLights[MAX_OBJECT_LIGHTS / 4];
+		uint  uObjectLightCount;
+		vec4  uLightmapScaleOffset; // Zero when the entity has no lightmap
 	};
 
 	out vec2 vTexCoord;
+	out vec2 vLightmapCoord;
 	out vec3 vPosition;
 	out vec3 vNormal;
 	out vec3 vViewDir;
 
+	// Must match DEPTH_PREPASS bit for bit for the GL_EQUAL depth test
+	invariant gl_Position;
+
 	void main()
 	{
 		vTexCoord = aTexCoord;
+		vLightmapCoord = aLightmapCoord * uLightmapScaleOffset.xy + uLightmapScaleOffset.zw;
 		vPosition = vec3(uWorldMatrix * vec4(aPosition,1.0));
 		vNormal = vec3(uWorldMatrix * vec4(aNormal,0.0));
 		vViewDir = uCameraPosition - vPosition;
@@ -47,27 +55,67 @@
 
 	#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
+	// Packed light, the xyz of positionRadius is the direction for directional lights
 	struct Light
 	{
-		uint type;
-		vec3 color;
-		vec3 direction;
-		vec3 position;
+		vec4 positionRadius;
+		vec4 colorType;
 	};
 
 	layout(binding = 0, std140) uniform GlobalParams
 	{
-		vec3 uCameraPosition;
-		uint uLightCount;
-		Light uLights[16];
+		vec3  uCameraPosition;
+		uint  uLightCount;
+		vec3  uProbeGridMin;
+		uint  uUseProbes;
+		vec3  uProbeCellSize;
+		uvec3 uProbeGridDims;
+	};
+
+	layout(binding = 3, std430) readonly buffer Lights
+	{
+		Light uLights[];
 	};
 
+	// Clustered light lists, offset and count per cluster into uClusterLightIndices
+	layout(binding = 4, std430) readonly buffer Clusters
+	{
+		uvec2 uClusters[];
+	};
+
+	layout(binding = 5, std430) readonly buffer ClusterLights
+	{
+		uint uClusterLightIndices[];
+	};
+
+	// Keep in sync with MAX_OBJECT_LIGHTS
+	#define MAX_OBJECT_LIGHTS 8
+
+	// Strongest point lights of the entity, picked on the CPU
+	layout(binding = 1, std140) uniform LocalParams
+	{
+		mat4  uWorldMatrix;
+		mat4  uWorldViewProjectionMatrix;
+		uvec4 uObjectLights[MAX_OBJECT_LIGHTS / 4];
+		uint  uObjectLightCount;
+		vec4  uLightmapScaleOffset; // Zero when the entity has no lightmap
+	};
+
+	// Matches ForwardLightList: 0 all lights, 1 clustered, 2 per object
+	uniform int   uLightList;
+	uniform uint  uDirectionalLightCount; // Directional lights come first in uLights
+	uniform uvec3 uClusterCount;
+	uniform vec2  uClusterTileSize;
+	uniform vec2  uClusterDepthScaleBias;
+
 	in vec2 vTexCoord;
+	in vec2 vLightmapCoord;
 	in vec3 vPosition; 
 	in vec3 vNormal;  
 	in vec3 vViewDir;
 
 	uniform sampler2D uTexture;
+	uniform sampler2D uLightmap;
 
 	uniform int uViewmode;
 
@@ -85,46 +133,48 @@
 		return (2.0 * near * far) / (far + near - z * (far - near));	
 	}
 
-	vec3 CalculateDirLight(Light light, vec3 normal, vec3 viewDir)
+	#include "PROBES.glsl"
+
+	// Static lights are already in the lightmap of static entities
+	bool IsBakedLight(Light light)
 	{
-		vec3 lightDir = normalize(-light.direction);
+		return fract(light.colorType.w) > 0.25;
+	}
 
-		float ambientStrength = 0.2f;
-		vec3 ambient = ambientStrength * light.color;
+	vec3 CalculateDirLight(Light light, vec3 normal, vec3 viewDir)
+	{
+		vec3 lightDir = normalize(-light.positionRadius.xyz);
 
 		float diff = max(dot(normal, lightDir), 0.0);
-		vec3 diffuse = diff * light.color;
+		vec3 diffuse = diff * light.colorType.rgb;
 
 		float specularStrength = 0.1f;
 		vec3 reflectDir = reflect(-lightDir, normal);
 		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-		vec3 specular = specularStrength * spec * light.color;
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
 
-		return ambient + diffuse + specular;
+		return diffuse + specular;
 	}
 
 	vec3 CalculatePointLight(Light light, vec3 normal, vec3 pos, vec3 viewDir)
 	{
 
-		vec3 lightDir = normalize(light.position - pos);
+		vec3 lightDir = normalize(light.positionRadius.xyz - pos);
 		float constant = 1.0f;
 		float linear = 0.09f;
 		float quadratic = 0.032f;
-		float distance = length(light.position - pos);
+		float distance = length(light.positionRadius.xyz - pos);
 		float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
 
-		float ambientStrength = 0.2f;
-		vec3 ambient = ambientStrength * light.color;
-
 		float diff = max(dot(normal, lightDir), 0.0);
-		vec3 diffuse = diff * light.color;
+		vec3 diffuse = diff * light.colorType.rgb;
 
 		float specularStrength = 0.1f;
 		vec3 reflectDir = reflect(-lightDir, normal);
 		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-		vec3 specular = specularStrength * spec * light.color;
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
 		
-		return (ambient + diffuse + specular) * attenuation;
+		return (diffuse + specular) * attenuation;
 	}
 
 
@@ -134,25 +184,67 @@
 		vec3 normal = normalize(vNormal);
 		vec3 viewDir = normalize(vViewDir);
 
-		vec3 finalColor = vec3(0.0);
+		bool lightmapped = uLightmapScaleOffset.x > 0.0;
+		vec3 finalColor = lightmapped ? texture(uLightmap, vLightmapCoord).rgb : SampleProbes(vPosition, normal);
+		finalColor *= texColor;
 
 		oColor = vec4(texColor, 1.0);
 		oPosition = vec4(vPosition, 1.0);
 		oNormal = vec4(normal, 1.0);
 		oDepth = vec4(LinearizeDepth(gl_FragCoord.z) / far, 0.0, 0.0, 1.0);
 
-		for(int i = 0; i<uLightCount; i++){
-			if(uLights[i].type == 0){
+		if (uLightList == 2)
+		{
+			for (uint i = 0; i < uDirectionalLightCount; i++)
+				if (!(lightmapped && IsBakedLight(uLights[i])))
+					finalColor += CalculateDirLight(uLights[i], normal, viewDir) * texColor;
 
-				Light light = uLights[i];
-				finalColor += CalculateDirLight(light, normal, viewDir) * texColor;
+			for (uint i = 0; i < uObjectLightCount; i++)
+			{
+				Light light = uLights[uObjectLights[i / 4][i % 4]];
+				if (lightmapped && IsBakedLight(light))
+					continue;
+				finalColor += CalculatePointLight(light, normal, vPosition, viewDir) * texColor;
 			}
-			else
+		}
+		else if (uLightList == 1)
+		{
+			for (uint i = 0; i < uDirectionalLightCount; i++)
+				if (!(lightmapped && IsBakedLight(uLights[i])))
+					finalColor += CalculateDirLight(uLights[i], normal, viewDir) * texColor;
+
+			// gl_FragCoord.w is 1 / clip w, the view space depth
+			float viewDepth = 1.0 / gl_FragCoord.w;
+			uvec3 cluster;
+			cluster.xy = min(uvec2(gl_FragCoord.xy / uClusterTileSize), uClusterCount.xy - 1);
+			cluster.z = uint(clamp(log(viewDepth) * uClusterDepthScaleBias.x + uClusterDepthScaleBias.y, 0.0, float(uClusterCount.z - 1)));
+
+			uvec2 clusterLights = uClusters[cluster.x + cluster.y * uClusterCount.x + cluster.z * uClusterCount.x * uClusterCount.y];
+			for (uint i = 0; i < clusterLights.y; i++)
 			{
-				Light light = uLights[i];
+				Light light = uLights[uClusterLightIndices[clusterLights.x + i]];
+				if (lightmapped && IsBakedLight(light))
+					continue;
 				finalColor += CalculatePointLight(light, normal, vPosition, viewDir) * texColor;
 			}
 		}
+		else
+		{
+			for(int i = 0; i<uLightCount; i++){
+				if (lightmapped && IsBakedLight(uLights[i]))
+					continue;
+				if(uint(uLights[i].colorType.w) == 0){
+
+					Light light = uLights[i];
+					finalColor += CalculateDirLight(light, normal, viewDir) * texColor;
+				}
+				else
+				{
+					Light light = uLights[i];
+					finalColor += CalculatePointLight(light, normal, vPosition, viewDir) * texColor;
+				}
+			}
+		}
 		oColor = vec4(finalColor, 1.0);
 	}
 
@@ -41,11 +41,18 @@
 	layout(location = 0) in vec3 aPosition;
 	layout(location = 1) in vec3 aNormal;
 	layout(location = 2) in vec2 aTexCoord;
+	layout(location = 5) in vec2 aLightmapCoord;
+
+	// Keep in sync with MAX_OBJECT_LIGHTS
+	#define MAX_OBJECT_LIGHTS 8
 
 	layout(binding = 1, std140) uniform LocalParams
 	{
-		mat4 uWorldMatrix;
-		mat4 uWorldViewProjectionMatrix;
+		mat4  uWorldMatrix;
+		mat4  uWorldViewProjectionMatrix;
+		uvec4 uObjectLights[MAX_OBJECT_LIGHTS / 4];
+		uint  uObjectLightCount;
+		vec4  uLightmapScaleOffset; // Zero when the entity has no lightmap
 	};
 
 	layout(binding = 2, std140) uniform ClippingPlane
@@ -54,16 +61,23 @@
 	};
 
 	out vec2 vTexCoord;
+	out vec2 vLightmapCoord;
 	out vec3 vPosition;
 	out vec3 vNormal;
+	flat out int vLightmapped;
+
+	// Must match DEPTH_PREPASS bit for bit for the GL_EQUAL depth test
+	invariant gl_Position;
 
 	void main()
 	{
 		vTexCoord = aTexCoord;
+		vLightmapCoord = aLightmapCoord * uLightmapScaleOffset.xy + uLightmapScaleOffset.zw;
+		vLightmapped = uLightmapScaleOffset.x > 0.0 ? 1 : 0;
 		vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
 		vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
 		
-		gl_ClipDistance[0] = dot(vec4(vPosition, 0.0), clippingPlane);
+		gl_ClipDistance[0] = dot(vec4(vPosition, 1.0), clippingPlane);
 
 		gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
 	}
@@ -71,22 +85,25 @@
 	#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
 	in vec2 vTexCoord;
+	in vec2 vLightmapCoord;
 	in vec3 vPosition;
 	in vec3 vNormal;
+	flat in int vLightmapped;
 
 	uniform sampler2D uTexture;
-	uniform float uNear; 
-	uniform float uFar;	
+	uniform sampler2D uLightmap;
 
+	// The light passes rebuild the position from the depth buffer
 	layout(location = 0) out vec4 oColor;
-	layout(location = 1) out vec4 oPosition;
-	layout(location = 2) out vec4 oNormal;
-	layout(location = 3) out vec4 oDepth;
+	layout(location = 1) out vec4 oNormal;
+	layout(location = 2) out vec4 oBakedLight; // Alpha tells the light pass to skip the static lights
 
-	float LinearizeDepth(float depth)
+	// Octahedral normal, in [0, 1] for the RG16 target
+	vec2 EncodeNormal(vec3 n)
 	{
-		float z = depth * 2.0 - 1.0; 
-		return (2.0 * uNear * uFar) / (uFar + uNear - z * (uFar - uNear));
+		n /= abs(n.x) + abs(n.y) + abs(n.z);
+		vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+		return e * 0.5 + 0.5;
 	}
 
 	void main()
@@ -96,12 +113,12 @@
 			discard;
 		oColor = texColor;
 		//oColor = texture(uTexture, vTexCoord);
-		oPosition = vec4(vPosition, 1.0);
-		oNormal = vec4(normalize(vNormal), 1.0);
+		oNormal = vec4(EncodeNormal(normalize(vNormal)), 0.0, 1.0);
 
-
-		float depth = LinearizeDepth(gl_FragCoord.z) / uFar;
-		oDepth = vec4(vec3(depth),1.0);
+		if (vLightmapped != 0)
+			oBakedLight = vec4(texture(uLightmap, vLightmapCoord).rgb * texColor.rgb, 1.0);
+		else
+			oBakedLight = vec4(0.0);
 	}
 
 	#endif
@@ -110,26 +127,90 @@
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 
-#ifdef LIGHTING_RENDER
-	#if defined(VERTEX) ///////////////////////////////////////////////////
+#ifdef DEPTH_PREPASS
+
+	// ALPHA_TEST for the G-buffer, which discards cut-out texels. The forward shader has no
+	// alpha test, so its prepass is positions only.
 
+	#if defined(VERTEX) ///////////////////////////////////////////////////
 	layout(location = 0) in vec3 aPosition;
-	layout(location = 1) in vec2 aTexCoord;
+	#if defined(ALPHA_TEST)
+	layout(location = 2) in vec2 aTexCoord;
+	#endif
 
-	struct Light
+	layout(binding = 1, std140) uniform LocalParams
 	{
-		uint type;
-		vec3 color;
-		vec3 direction;
-		vec3 position;
+		mat4 uWorldMatrix;
+		mat4 uWorldViewProjectionMatrix;
 	};
 
-	layout(binding = 0, std140) uniform GlobalParams
+	#if defined(ALPHA_TEST)
+	out vec2 vTexCoord;
+	#endif
+
+	invariant gl_Position;
+
+	void main()
 	{
-		vec3 uCameraPosition;
-		uint uLightCount;
-		Light uLights[16];
-	};
+	#if defined(ALPHA_TEST)
+		vTexCoord = aTexCoord;
+	#endif
+		gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	}
+
+	#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+	#if defined(ALPHA_TEST)
+	in vec2 vTexCoord;
+
+	uniform sampler2D uTexture;
+	#endif
+
+	void main()
+	{
+	#if defined(ALPHA_TEST)
+		// Same alpha test as the geometry pass so cut-out texels do not write depth
+		if(texture(uTexture, vTexCoord).a < 0.1)
+			discard;
+	#endif
+	}
+
+	#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef OCCLUSION_PROXY
+
+	#if defined(VERTEX) ///////////////////////////////////////////////////
+	layout(location = 0) in vec3 aPosition;
+
+	uniform mat4 uWorldViewProjectionMatrix;
+
+	void main()
+	{
+		gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	}
+
+	#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+	// Depth test only, colour writes are masked while the queries run
+	void main()
+	{
+	}
+
+	#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef LIGHTING_RENDER
+	#if defined(VERTEX) ///////////////////////////////////////////////////
+
+	layout(location = 0) in vec3 aPosition;
+	layout(location = 1) in vec2 aTexCoord;
 
 	out vec2 vTexCoord;
 
@@ -144,15 +225,29 @@
 	in vec2 vTexCoord;
 
 	uniform sampler2D uAlbedo;
-	uniform sampler2D uPosition;
 	uniform sampler2D uNormal;
+	uniform sampler2D uDepth;
+	uniform mat4 uInverseViewProjection;
+
+	// Baked light times albedo, alpha set where the static lights are in it
+	uniform sampler2D uBakedLight;
+
+	// Point lights are drawn as light volumes afterwards, directional lights come first
+	uniform bool uDirectionalOnly;
+	uniform uint uDirectionalLightCount;
 
+	// G-buffer pixels per output pixel. Above 1 the output is the half resolution target:
+	// light only, the upsample multiplies by the albedo and adds the baked light.
+	uniform int uSampleScale;
+
+	// Rendered part of the G-buffer, smaller than the targets under dynamic resolution
+	uniform vec2 uViewportSize;
+
+	// Packed light, the xyz of positionRadius is the direction for directional lights
 	struct Light
 	{
-		uint type;
-		vec3 color;
-		vec3 direction;
-		vec3 position;
+		vec4 positionRadius;
+		vec4 colorType;
 	};
 
 	layout(location = 0) out vec4 oColor;
@@ -160,74 +255,112 @@
 
 	layout(binding = 0, std140) uniform GlobalParams
 	{
-		vec3 uCameraPosition;
-		uint uLightCount;
-		Light uLights[16];
+		vec3  uCameraPosition;
+		uint  uLightCount;
+		vec3  uProbeGridMin;
+		uint  uUseProbes;
+		vec3  uProbeCellSize;
+		uvec3 uProbeGridDims;
 	};
 
+	layout(binding = 3, std430) readonly buffer Lights
+	{
+		Light uLights[];
+	};
+
+	// Octahedral normal, stored in [0, 1] in the RG16 target
+	vec3 DecodeNormal(vec2 encoded)
+	{
+		vec2 f = encoded * 2.0 - 1.0;
+		vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+		float t = max(-n.z, 0.0);
+		n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+		return normalize(n);
+	}
+
+	// World position of a G-buffer pixel from the hardware depth
+	vec3 ReconstructPosition(ivec2 pixel, float depth)
+	{
+		vec2 uv = (vec2(pixel) + 0.5) / uViewportSize;
+		vec4 world = uInverseViewProjection * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+		return world.xyz / world.w;
+	}
+
+	#include "PROBES.glsl"
+
+	// Static lights are already in the lightmap of static entities
+	bool IsBakedLight(Light light)
+	{
+		return fract(light.colorType.w) > 0.25;
+	}
+
 	vec3 CalculateDirLight(Light light, vec3 normal, vec3 viewDir)
 	{
-		vec3 lightDir = normalize(-light.direction);
+		vec3 lightDir = normalize(-light.positionRadius.xyz);
 	
-		float ambientStrength = 0.2f;
-		vec3 ambient = ambientStrength * light.color;
-
 		float diff = max(dot(normal, lightDir), 0.0);
-		vec3 diffuse = diff * light.color;
+		vec3 diffuse = diff * light.colorType.rgb;
 
 		float specularStrength = 0.1f;
 		vec3 reflectDir = reflect(-lightDir, normal);
 		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-		vec3 specular = specularStrength * spec * light.color;
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
 
-		return ambient + diffuse + specular;
+		return diffuse + specular;
 	}
 
 	vec3 CalculatePointLight(Light light, vec3 normal, vec3 pos, vec3 viewDir)
 	{
 
-		vec3 lightDir = normalize(light.position - pos);
+		vec3 lightDir = normalize(light.positionRadius.xyz - pos);
 		float constant = 1.0f;
 		float linear = 0.09f;
 		float quadratic = 0.032f;
-		float distance = length(light.position - pos);
+		float distance = length(light.positionRadius.xyz - pos);
 		float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
 
-		float ambientStrength = 0.2f;
-		vec3 ambient = ambientStrength * light.color;
-
 		float diff = max(dot(normal, lightDir), 0.0);
-		vec3 diffuse = diff * light.color;
+		vec3 diffuse = diff * light.colorType.rgb;
 
 		float specularStrength = 0.1f;
 		vec3 reflectDir = reflect(-lightDir, normal);
 		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-		vec3 specular = specularStrength * spec * light.color;
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
 		
-		return (ambient + diffuse + specular) * attenuation;
+		return (diffuse + specular) * attenuation;
 	}
 
 	void main()
 	{
-		vec3 albedo = texture(uAlbedo, vTexCoord).rgb;
-		vec3 fragPos = texture(uPosition, vTexCoord).rgb;
-		vec3 normal = texture(uNormal, vTexCoord).rgb;
-		float alpha = texture(uAlbedo, vTexCoord).a;
+		ivec2 source = ivec2(gl_FragCoord.xy) * uSampleScale;
+		vec3 albedo = texelFetch(uAlbedo, source, 0).rgb;
+		vec3 fragPos = ReconstructPosition(source, texelFetch(uDepth, source, 0).r);
+		vec3 normal = DecodeNormal(texelFetch(uNormal, source, 0).rg);
 
 		vec3 viewDir = normalize(uCameraPosition - fragPos);
-		vec3 lightColor = vec3(0.0);
+		vec4 bakedLight = texelFetch(uBakedLight, source, 0);
+		vec3 lightColor = bakedLight.rgb;
+		if (uSampleScale > 1)
+		{
+			albedo = vec3(1.0);
+			lightColor = vec3(0.0);
+		}
+		if (bakedLight.a < 0.5)
+			lightColor += SampleProbes(fragPos, normal) * albedo;
 
-		for(int i = 0; i < uLightCount; i++)
+		uint lightCount = uDirectionalOnly ? uDirectionalLightCount : uLightCount;
+		for(uint i = 0; i < lightCount; i++)
 		{
 			Light light = uLights[i];
-			if (light.type == 0)
+			if (bakedLight.a > 0.5 && IsBakedLight(light))
+				continue;
+			uint type = uint(light.colorType.w);
+			if (type == 0)
 			{
 				lightColor += CalculateDirLight(light, normal, viewDir) * albedo;
 			}
-			else if (light.type == 1)
+			else if (type == 1)
 			{
-				vec3 lightDir = normalize(light.position - fragPos);
-				float distance = length(lightDir);
 				lightColor += CalculatePointLight(light, normal, fragPos, viewDir) * albedo;
 			}
 			
@@ -240,7 +373,507 @@
 	#endif
 #endif
 
-#ifdef BLOOM
+#ifdef LIGHT_VOLUME
+	#if defined(VERTEX) ///////////////////////////////////////////////////
+
+	layout(location = 0) in vec3 aPosition;
+
+	// Packed light, the xyz of positionRadius is the direction for directional lights
+	struct Light
+	{
+		vec4 positionRadius;
+		vec4 colorType;
+	};
+
+	layout(binding = 3, std430) readonly buffer Lights
+	{
+		Light uLights[];
+	};
+
+	uniform mat4 uViewProjection;
+	uniform float uProxyScale;
+	uniform uint uFirstLight;
+
+	flat out uint vLightIndex;
+
+	void main()
+	{
+		vLightIndex = uFirstLight + uint(gl_InstanceID);
+		vec4 positionRadius = uLights[vLightIndex].positionRadius;
+
+		vec3 worldPosition = positionRadius.xyz + aPosition * positionRadius.w * uProxyScale;
+		gl_Position = uViewProjection * vec4(worldPosition, 1.0);
+	}
+
+	#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+	flat in uint vLightIndex;
+
+	uniform sampler2D uAlbedo;
+	uniform sampler2D uNormal;
+	uniform sampler2D uDepth;
+	uniform sampler2D uBakedLight;
+	uniform mat4 uInverseViewProjection;
+	uniform vec2 uViewportSize;
+
+	struct Light
+	{
+		vec4 positionRadius;
+		vec4 colorType;
+	};
+
+	layout(location = 0) out vec4 oColor;
+
+	layout(binding = 0, std140) uniform GlobalParams
+	{
+		vec3 uCameraPosition;
+		uint uLightCount;
+	};
+
+	layout(binding = 3, std430) readonly buffer Lights
+	{
+		Light uLights[];
+	};
+
+	// Octahedral normal, stored in [0, 1] in the RG16 target
+	vec3 DecodeNormal(vec2 encoded)
+	{
+		vec2 f = encoded * 2.0 - 1.0;
+		vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+		float t = max(-n.z, 0.0);
+		n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+		return normalize(n);
+	}
+
+	// World position of a G-buffer pixel from the hardware depth
+	vec3 ReconstructPosition(ivec2 pixel, float depth)
+	{
+		vec2 uv = (vec2(pixel) + 0.5) / uViewportSize;
+		vec4 world = uInverseViewProjection * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+		return world.xyz / world.w;
+	}
+
+	// Static lights are already in the lightmap of static entities
+	bool IsBakedLight(Light light)
+	{
+		return fract(light.colorType.w) > 0.25;
+	}
+
+	vec3 CalculatePointLight(Light light, vec3 normal, vec3 pos, vec3 viewDir)
+	{
+		vec3 lightDir = normalize(light.positionRadius.xyz - pos);
+		float constant = 1.0f;
+		float linear = 0.09f;
+		float quadratic = 0.032f;
+		float distance = length(light.positionRadius.xyz - pos);
+		float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+
+		float diff = max(dot(normal, lightDir), 0.0);
+		vec3 diffuse = diff * light.colorType.rgb;
+
+		float specularStrength = 0.1f;
+		vec3 reflectDir = reflect(-lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
+
+		return (diffuse + specular) * attenuation;
+	}
+
+	void main()
+	{
+		ivec2 texel = ivec2(gl_FragCoord.xy);
+		vec3 fragPos = ReconstructPosition(texel, texelFetch(uDepth, texel, 0).r);
+
+		// The depth test only bounds the far side of the volume
+		Light light = uLights[vLightIndex];
+		if (length(light.positionRadius.xyz - fragPos) > light.positionRadius.w)
+			discard;
+		if (texelFetch(uBakedLight, texel, 0).a > 0.5 && IsBakedLight(light))
+			discard;
+
+		vec3 albedo = texelFetch(uAlbedo, texel, 0).rgb;
+		vec3 normal = DecodeNormal(texelFetch(uNormal, texel, 0).rg);
+		vec3 viewDir = normalize(uCameraPosition - fragPos);
+
+		oColor = vec4(CalculatePointLight(light, normal, fragPos, viewDir) * albedo, 0.0);
+	}
+
+	#endif
+#endif
+
+#ifdef TILED_LIGHTING
+
+	#if defined(COMPUTE) //////////////////////////////////////////////////
+
+	// Keep in sync with TILED_LIGHTING_TILE_SIZE
+	#define TILE_SIZE 16
+	#define MAX_LIGHTS_PER_TILE 1024
+
+	layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+	// Packed light, the xyz of positionRadius is the direction for directional lights
+	struct Light
+	{
+		vec4 positionRadius;
+		vec4 colorType;
+	};
+
+	layout(binding = 0, std140) uniform GlobalParams
+	{
+		vec3  uCameraPosition;
+		uint  uLightCount;
+		vec3  uProbeGridMin;
+		uint  uUseProbes;
+		vec3  uProbeCellSize;
+		uvec3 uProbeGridDims;
+	};
+
+	layout(binding = 3, std430) readonly buffer Lights
+	{
+		Light uLights[];
+	};
+
+	layout(binding = 0, rgba16f) uniform writeonly image2D oColor;
+
+	// Level 0 of the bloom chain, half the size of oColor
+	layout(binding = 1, rgba16f) uniform writeonly image2D oBloom;
+
+	uniform sampler2D uAlbedo;
+	uniform sampler2D uNormal;
+	uniform sampler2D uDepth;
+	uniform sampler2D uBakedLight;
+
+	uniform mat4 uView;
+	uniform mat4 uProjection;
+	uniform mat4 uInverseViewProjection;
+
+	// G-buffer pixels per output pixel, see LIGHTING_RENDER
+	uniform int uSampleScale;
+	uniform vec2 uViewportSize;
+
+	// Set when the lighting also shades the sky and writes oBloom, in place of the skybox
+	// and bright passes, see IsBloomThresholdFused
+	uniform int uFusedBloom;
+	uniform float uBloomThreshold;
+	uniform samplerCube uSkybox;
+
+	shared uint sMinDepth;
+	shared uint sMaxDepth;
+	shared uint sTileLightCount;
+	shared uint sTileLights[MAX_LIGHTS_PER_TILE];
+	shared vec3 sBloom[TILE_SIZE * TILE_SIZE];
+
+	// What the bloom blurs: the pixels brighter than the threshold, the rest black
+	vec3 BloomInput(vec3 color)
+	{
+		float luminance = dot(vec3(0.2126, 0.7152, 0.0722), color);
+		return luminance > uBloomThreshold ? color : vec3(0.0);
+	}
+
+	// Octahedral normal, stored in [0, 1] in the RG16 target
+	vec3 DecodeNormal(vec2 encoded)
+	{
+		vec2 f = encoded * 2.0 - 1.0;
+		vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+		float t = max(-n.z, 0.0);
+		n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+		return normalize(n);
+	}
+
+	// World position of a G-buffer pixel from the hardware depth
+	vec3 ReconstructPosition(ivec2 pixel, float depth)
+	{
+		vec2 uv = (vec2(pixel) + 0.5) / uViewportSize;
+		vec4 world = uInverseViewProjection * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+		return world.xyz / world.w;
+	}
+
+	#include "PROBES.glsl"
+
+	// Static lights are already in the lightmap of static entities
+	bool IsBakedLight(Light light)
+	{
+		return fract(light.colorType.w) > 0.25;
+	}
+
+	vec3 CalculateDirLight(Light light, vec3 normal, vec3 viewDir)
+	{
+		vec3 lightDir = normalize(-light.positionRadius.xyz);
+	
+		float diff = max(dot(normal, lightDir), 0.0);
+		vec3 diffuse = diff * light.colorType.rgb;
+
+		float specularStrength = 0.1f;
+		vec3 reflectDir = reflect(-lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
+
+		return diffuse + specular;
+	}
+
+	vec3 CalculatePointLight(Light light, vec3 normal, vec3 pos, vec3 viewDir)
+	{
+		vec3 lightDir = normalize(light.positionRadius.xyz - pos);
+		float constant = 1.0f;
+		float linear = 0.09f;
+		float quadratic = 0.032f;
+		float distance = length(light.positionRadius.xyz - pos);
+		float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+
+		float diff = max(dot(normal, lightDir), 0.0);
+		vec3 diffuse = diff * light.colorType.rgb;
+
+		float specularStrength = 0.1f;
+		vec3 reflectDir = reflect(-lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+		vec3 specular = specularStrength * spec * light.colorType.rgb;
+		
+		return (diffuse + specular) * attenuation;
+	}
+
+	// Positive distance in front of the camera
+	float LinearDepth(float depth)
+	{
+		float ndcDepth = depth * 2.0 - 1.0;
+		return uProjection[3][2] / (ndcDepth + uProjection[2][2]);
+	}
+
+	// Lit color of a G-buffer pixel from the lights of the tile
+	vec3 ShadePixel(ivec2 source, float depth)
+	{
+		vec3 albedo = texelFetch(uAlbedo, source, 0).rgb;
+		vec3 fragPos = ReconstructPosition(source, depth);
+		vec3 normal = DecodeNormal(texelFetch(uNormal, source, 0).rg);
+
+		vec3 viewDir = normalize(uCameraPosition - fragPos);
+		vec4 bakedLight = texelFetch(uBakedLight, source, 0);
+		vec3 lightColor = bakedLight.rgb;
+		if (uSampleScale > 1)
+		{
+			albedo = vec3(1.0);
+			lightColor = vec3(0.0);
+		}
+
+		uint tileLightCount = min(sTileLightCount, uint(MAX_LIGHTS_PER_TILE));
+		if (depth < 1.0)
+		{
+			if (bakedLight.a < 0.5)
+				lightColor += SampleProbes(fragPos, normal) * albedo;
+
+			for (uint i = 0; i < tileLightCount; i++)
+			{
+				Light light = uLights[sTileLights[i]];
+				if (bakedLight.a > 0.5 && IsBakedLight(light))
+					continue;
+				if (uint(light.colorType.w) == 0)
+					lightColor += CalculateDirLight(light, normal, viewDir) * albedo;
+				else
+					lightColor += CalculatePointLight(light, normal, fragPos, viewDir) * albedo;
+			}
+		}
+		else if (uFusedBloom != 0)
+		{
+			// The skybox pass is left out, its color is needed for the bloom
+			vec3 farPoint = ReconstructPosition(source, 1.0);
+			lightColor = textureLod(uSkybox, normalize(farPoint - uCameraPosition), 0.0).rgb;
+		}
+
+		return lightColor;
+	}
+
+	void main()
+	{
+		ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+		ivec2 source = pixel * uSampleScale;
+		ivec2 size = (ivec2(uViewportSize) + uSampleScale - 1) / uSampleScale;
+		bool insideScreen = pixel.x < size.x && pixel.y < size.y;
+
+		if (gl_LocalInvocationIndex == 0)
+		{
+			sMinDepth = 0xFFFFFFFFu;
+			sMaxDepth = 0u;
+			sTileLightCount = 0u;
+		}
+		barrier();
+
+		// Depth bounds of the tile, the background does not count. Positive floats
+		// keep their order when compared as uints.
+		float depth = insideScreen ? texelFetch(uDepth, source, 0).r : 1.0;
+		if (depth < 1.0)
+		{
+			uint linearDepth = floatBitsToUint(LinearDepth(depth));
+			atomicMin(sMinDepth, linearDepth);
+			atomicMax(sMaxDepth, linearDepth);
+		}
+		barrier();
+
+		float minDepth = uintBitsToFloat(sMinDepth);
+		float maxDepth = uintBitsToFloat(sMaxDepth);
+
+		// Side planes of the tile frustum in view space, through the camera
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * TILE_SIZE) / vec2(size) * 2.0 - 1.0;
+		vec2 tileMax = vec2((gl_WorkGroupID.xy + 1) * TILE_SIZE) / vec2(size) * 2.0 - 1.0;
+		vec3 planes[4];
+		planes[0] = normalize(vec3( uProjection[0][0], 0.0,  tileMin.x));
+		planes[1] = normalize(vec3(-uProjection[0][0], 0.0, -tileMax.x));
+		planes[2] = normalize(vec3(0.0,  uProjection[1][1],  tileMin.y));
+		planes[3] = normalize(vec3(0.0, -uProjection[1][1], -tileMax.y));
+
+		// Each invocation tests a slice of the lights
+		if (sMaxDepth != 0u)
+		{
+			for (uint i = gl_LocalInvocationIndex; i < uLightCount; i += TILE_SIZE * TILE_SIZE)
+			{
+				Light light = uLights[i];
+				bool touchesTile = true;
+
+				if (uint(light.colorType.w) == 1)
+				{
+					vec3 center = (uView * vec4(light.positionRadius.xyz, 1.0)).xyz;
+					float radius = light.positionRadius.w;
+
+					touchesTile = -center.z + radius >= minDepth && -center.z - radius <= maxDepth;
+					for (int p = 0; p < 4 && touchesTile; ++p)
+						touchesTile = dot(planes[p], center) >= -radius;
+				}
+
+				if (touchesTile)
+				{
+					uint slot = atomicAdd(sTileLightCount, 1u);
+					if (slot < MAX_LIGHTS_PER_TILE)
+						sTileLights[slot] = i;
+				}
+			}
+		}
+		barrier();
+
+		// Every invocation stays for the bloom reduction, the ones outside only add black
+		vec3 lightColor = vec3(0.0);
+		if (insideScreen)
+		{
+			lightColor = ShadePixel(source, depth);
+			imageStore(oColor, pixel, vec4(lightColor, 1.0));
+		}
+
+		// Each 2x2 quad averaged and thresholded, as the bright pass does with its bilinear
+		// fetch, without the full resolution color going out and back in. Tiles start on
+		// even pixels, so a quad never spans two workgroups.
+		if (uFusedBloom != 0)
+		{
+			sBloom[gl_LocalInvocationIndex] = lightColor;
+			barrier();
+
+			ivec2 bloomPixel = pixel / 2;
+			if (all(equal(gl_LocalInvocationID.xy & 1u, uvec2(0u))) && all(lessThan(bloomPixel, imageSize(oBloom))))
+			{
+				uint index = gl_LocalInvocationIndex;
+				vec3 color = (sBloom[index] + sBloom[index + 1u] + sBloom[index + TILE_SIZE] + sBloom[index + TILE_SIZE + 1u]) * 0.25;
+				imageStore(oBloom, bloomPixel, vec4(BloomInput(color), 1.0));
+			}
+		}
+	}
+
+	#endif
+#endif
+
+#ifdef LIGHT_UPSAMPLE
+
+	#if defined(VERTEX) ///////////////////////////////////////////////////
+
+	layout(location = 0) in vec3 aPosition;
+	layout(location = 1) in vec2 aTexCoord;
+
+	void main()
+	{
+		gl_Position = vec4(aPosition, 1.0);
+	}
+
+	#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+	// Half resolution light without albedo, pixel i shaded from G-buffer pixel 2i
+	uniform sampler2D uLight;
+
+	uniform sampler2D uAlbedo;
+	uniform sampler2D uNormal;
+	uniform sampler2D uDepth;
+	uniform sampler2D uBakedLight;
+
+	uniform mat4 uProjection;
+	uniform vec2 uViewportSize;
+
+	layout(location = 0) out vec4 oColor;
+
+	// Octahedral normal, stored in [0, 1] in the RG16 target
+	vec3 DecodeNormal(vec2 encoded)
+	{
+		vec2 f = encoded * 2.0 - 1.0;
+		vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+		float t = max(-n.z, 0.0);
+		n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+		return normalize(n);
+	}
+
+	float LinearDepth(float depth)
+	{
+		float ndcDepth = depth * 2.0 - 1.0;
+		return uProjection[3][2] / (ndcDepth + uProjection[2][2]);
+	}
+
+	// Joint bilateral: the bilinear taps around the pixel, weighed down when their
+	// G-buffer sample lies at another depth or faces another way
+	void main()
+	{
+		ivec2 pixel = ivec2(gl_FragCoord.xy);
+		vec4 bakedLight = texelFetch(uBakedLight, pixel, 0);
+		float depth = texelFetch(uDepth, pixel, 0).r;
+		if (depth >= 1.0)
+		{
+			oColor = vec4(bakedLight.rgb, 1.0);
+			return;
+		}
+
+		vec3 albedo = texelFetch(uAlbedo, pixel, 0).rgb;
+		vec3 normal = DecodeNormal(texelFetch(uNormal, pixel, 0).rg);
+		float linearDepth = LinearDepth(depth);
+
+		ivec2 lightSize = (ivec2(uViewportSize) + 1) / 2;
+		vec2 lightPos = vec2(pixel) * 0.5;
+		ivec2 base = ivec2(floor(lightPos));
+		vec2 f = lightPos - vec2(base);
+
+		vec3 light = vec3(0.0);
+		float weightSum = 0.0;
+		for (int i = 0; i < 4; i++)
+		{
+			ivec2 offset = ivec2(i & 1, i >> 1);
+			ivec2 tap = min(base + offset, lightSize - 1);
+			ivec2 guide = tap * 2;
+
+			vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+			float tapDepth = LinearDepth(texelFetch(uDepth, guide, 0).r);
+			float depthWeight = 1.0 / (1e-3 + 32.0 * abs(tapDepth - linearDepth) / linearDepth);
+			float normalWeight = pow(max(dot(normal, DecodeNormal(texelFetch(uNormal, guide, 0).rg)), 0.0), 8.0);
+
+			float weight = bilinear.x * bilinear.y * depthWeight * normalWeight;
+			light += texelFetch(uLight, tap, 0).rgb * weight;
+			weightSum += weight;
+		}
+
+		// Every tap is on another surface, take the closest one as it is
+		if (weightSum < 1e-4)
+			light = texelFetch(uLight, min(ivec2(lightPos + 0.5), lightSize - 1), 0).rgb;
+		else
+			light /= weightSum;
+
+		oColor = vec4(light * albedo + bakedLight.rgb, 1.0);
+	}
+
+	#endif
+#endif
+
+
+
+#ifdef COMPOSITE
 
 	#if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -255,30 +888,89 @@
 		gl_Position = vec4(aPosition, 1.0);
 	}
 
-	#endif
-	#if defined(FRAGMENT) ///////////////////////////////////////////////////
+	#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-		out vec4 FragColor;
-  
-		in vec2 vTexCoord;
+	// Final image of the Scene window, one variant per view: VIEW_MAIN adds the bloom to the
+	// lit color, VIEW_TEXTURE shows a target as it is, VIEW_POSITION, VIEW_NORMAL and
+	// VIEW_DEPTH unpack the G-buffer
 
-		uniform sampler2D uMainTexture;
-		uniform sampler2D uColorMap;
-		uniform int uMaxLod;
+	in vec2 vTexCoord;
 
-		void main()
-		{    
-			vec3 color = texture(uMainTexture, vTexCoord).rgb;
-			vec3 bloomColor = vec3(0.0);
-			for (int lod = 0; lod < uMaxLod; ++lod) {
-				bloomColor += textureLod(uColorMap, vTexCoord, lod).rgb;
-			}
-			bloomColor /= float(uMaxLod); // optional: average the bloom
+	layout(location = 0) out vec4 oColor;
 
-			color += bloomColor;
-			FragColor = vec4(color, 1.0);
+	// The lit color, the shown target, or the G-buffer texture the view is made from
+	uniform sampler2D uSource;
+
+	// Rendered part of uSource, the output covers the whole target
+	uniform vec2 uSourceScale;
+
+	#if defined(VIEW_MAIN)
+	uniform sampler2D uBloom;
+	uniform int uBloomLevels;
+	uniform float uBloomScale;
+	#elif !defined(VIEW_TEXTURE)
+	uniform sampler2D uDepth;
+	uniform mat4 uInverseViewProjection;
+	uniform float uNear;
+	uniform float uFar;
+	uniform vec2 uViewportSize;
+
+	// Octahedral normal, stored in [0, 1] in the RG16 target
+	vec3 DecodeNormal(vec2 encoded)
+	{
+		vec2 f = encoded * 2.0 - 1.0;
+		vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+		float t = max(-n.z, 0.0);
+		n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+		return normalize(n);
+	}
+
+	// World position of a G-buffer pixel from the hardware depth
+	vec3 ReconstructPosition(ivec2 pixel, float depth)
+	{
+		vec2 uv = (vec2(pixel) + 0.5) / uViewportSize;
+		vec4 world = uInverseViewProjection * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+		return world.xyz / world.w;
+	}
+
+	float LinearizeDepth(float depth)
+	{
+		float z = depth * 2.0 - 1.0;
+		return (2.0 * uNear * uFar) / (uFar + uNear - z * (uFar - uNear));
+	}
+	#endif
+
+	void main()
+	{
+		vec2 texCoord = min(vTexCoord * uSourceScale, uSourceScale - 0.5 / vec2(textureSize(uSource, 0)));
+
+	#if defined(VIEW_MAIN)
+		vec3 bloom = vec3(0.0);
+		for (int lod = 0; lod < uBloomLevels; ++lod)
+			bloom += textureLod(uBloom, vTexCoord, lod).rgb;
+		oColor = vec4(texture(uSource, texCoord).rgb + bloom * uBloomScale, 1.0);
+	#elif defined(VIEW_TEXTURE)
+		oColor = vec4(texture(uSource, texCoord).rgb, 1.0);
+	#else
+		// The G-buffer pixel under the output one, the sky stays black
+		ivec2 pixel = ivec2(texCoord * vec2(textureSize(uDepth, 0)));
+		float depth = texelFetch(uDepth, pixel, 0).r;
+		if (depth >= 1.0)
+		{
+			oColor = vec4(0.0, 0.0, 0.0, 1.0);
+			return;
 		}
 
+		#if defined(VIEW_POSITION)
+		oColor = vec4(ReconstructPosition(pixel, depth), 1.0);
+		#elif defined(VIEW_NORMAL)
+		oColor = vec4(DecodeNormal(texelFetch(uSource, pixel, 0).rg), 1.0);
+		#else
+		oColor = vec4(vec3(LinearizeDepth(depth) / uFar), 1.0);
+		#endif
+	#endif
+	}
+
 	#endif
 #endif
 
@@ -304,37 +996,202 @@
   
 		in vec2 vTexCoord;
 
+		// Keep in sync with BLUR_KERNEL_MAX_RADIUS
+		#define MAX_RADIUS 72
+
 		uniform sampler2D uColorMap;
 		uniform vec2 uDir; 
 		uniform int uInputLod;
-		uniform int kernelRadius; 
 		uniform float uLodIntensity;
 
+		// Built by BlurKernel on the CPU, x: radius, y: tap count. Tap i has its offset in
+		// uKernel[i].y and its weight in uKernel[i].z, already normalized.
+		layout(binding = 3, std140) uniform BlurKernel
+		{
+			ivec4 uKernelCounts;
+			vec4  uKernel[MAX_RADIUS + 1];
+		};
+
 		void main()
 		{             
-			vec2 texSize = textureSize(uColorMap, uInputLod);
-			vec2 texelSize = 1.0 / texSize; // gets size of single texel
-			vec2 margin1 = texelSize * 0.5;
-			vec2 margin2 = vec2(1.0) - margin1;
-
-			FragColor = vec4(0.0);
-
-			vec2 directionFragCoord = gl_FragCoord.xy * uDir;
-			int coord = int(directionFragCoord.x + directionFragCoord.y);
-			vec2 directionTexSize = texelSize * uDir;
-			int size = int(directionTexSize.x + directionTexSize.y);
-			float weight = 0.0;
-			FragColor = vec4(0.0);
-
-			for (int i = -kernelRadius; i <= kernelRadius; i++) {
-				float w = smoothstep(0.0, float(kernelRadius), float(kernelRadius - abs(i)));
-				vec2 offset = uDir * texelSize * float(i);
-				vec2 sampleCoord = clamp(vTexCoord + offset, margin1, margin2);
-				FragColor += textureLod(uColorMap, sampleCoord, uInputLod) * w * uLodIntensity;
-				weight += w;
+			vec2 texelSize = 1.0 / vec2(textureSize(uColorMap, uInputLod));
+			vec2 texelStep = uDir * texelSize;
+
+			// Every tap but the center is two texels in one bilinear fetch. The sampler clamps
+			// to the edge texel, as the margins used to.
+			FragColor = textureLod(uColorMap, vTexCoord, uInputLod) * uKernel[0].z;
+			for (int i = 1; i < uKernelCounts.y; i++) {
+				vec2 offset = texelStep * uKernel[i].y;
+				FragColor += (textureLod(uColorMap, vTexCoord + offset, uInputLod) + textureLod(uColorMap, vTexCoord - offset, uInputLod)) * uKernel[i].z;
 			}
 
-			FragColor /= weight;
+			FragColor *= uLodIntensity;
+		}
+
+	#endif
+#endif
+
+
+#ifdef BLOOM_BLUR
+
+	#if defined(COMPUTE) //////////////////////////////////////////////////
+
+	// Keep in sync with BLOOM_BLUR_GROUP_SIZE, BLUR_KERNEL_MAX_RADIUS and BLOOM_MAX_MIPS
+	#define GROUP_SIZE 128
+	#define MAX_RADIUS 72
+	#define MAX_MIPS 8
+
+	// A workgroup blurs GROUP_SIZE texels of one line along uDir, gl_WorkGroupID.z is the level
+	layout(local_size_x = GROUP_SIZE) in;
+
+	uniform sampler2D uSource;
+	layout(binding = 0, rgba16f) uniform writeonly image2D uDestination[MAX_MIPS];
+	uniform ivec2 uDir;
+	uniform float uIntensities[MAX_MIPS];
+
+	// Built by BlurKernel on the CPU, x: radius. The texels come from shared memory, not a
+	// sampler, so only the discrete weights in uKernel[i].x are used.
+	layout(binding = 3, std140) uniform BlurKernel
+	{
+		ivec4 uKernelCounts;
+		vec4  uKernel[MAX_RADIUS + 1];
+	};
+
+	// The segment and the apron on both sides, every texel fetched once
+	shared vec3 sLine[GROUP_SIZE + 2 * MAX_RADIUS];
+
+	void main()
+	{
+		int level = int(gl_WorkGroupID.z);
+		ivec2 size = textureSize(uSource, level);
+		ivec2 lineSize = uDir.x != 0 ? size : size.yx;
+		ivec2 acrossDir = ivec2(1) - uDir;
+		int across = int(gl_WorkGroupID.y);
+		int lineStart = int(gl_WorkGroupID.x) * GROUP_SIZE;
+
+		// The dispatch covers level 0, the whole group leaves together on the smaller ones
+		if (across >= lineSize.y || lineStart >= lineSize.x)
+			return;
+
+		int radius = uKernelCounts.x;
+		int local = int(gl_LocalInvocationID.x);
+		for (int i = local; i < GROUP_SIZE + 2 * radius; i += GROUP_SIZE) {
+			int along = clamp(lineStart - radius + i, 0, lineSize.x - 1);
+			sLine[i] = texelFetch(uSource, uDir * along + acrossDir * across, level).rgb;
+		}
+		barrier();
+
+		int along = lineStart + local;
+		if (along >= lineSize.x)
+			return;
+
+		int center = local + radius;
+		vec3 color = sLine[center] * uKernel[0].x;
+		for (int i = 1; i < radius; ++i)
+			color += (sLine[center - i] + sLine[center + i]) * uKernel[i].x;
+
+		imageStore(uDestination[level], uDir * along + acrossDir * across, vec4(color * uIntensities[level], 1.0));
+	}
+
+	#endif
+#endif
+
+#ifdef BLOOM_DOWNSAMPLE
+
+	#if defined(VERTEX) ///////////////////////////////////////////////////
+
+	layout(location = 0) in vec3 aPosition;
+	layout(location = 1) in vec2 aTexCoord;
+
+	out vec2 vTexCoord;
+
+	void main()
+	{
+		vTexCoord = aTexCoord;
+		gl_Position = vec4(aPosition, 1.0);
+	}
+
+	#endif
+	#if defined(FRAGMENT) ///////////////////////////////////////////////////
+
+		out vec4 FragColor;
+
+		in vec2 vTexCoord;
+
+		// Base and max level are both the source level
+		uniform sampler2D uSource;
+
+		vec3 Sample(vec2 offset)
+		{
+			return textureLod(uSource, vTexCoord + offset / vec2(textureSize(uSource, 0)), 0.0).rgb;
+		}
+
+		// 13 bilinear taps: a 4x4 box in the middle and four overlapping 3x3 ones around it,
+		// weighted so the sparkles of single bright texels do not flicker
+		void main()
+		{
+			vec3 a = Sample(vec2(-2.0,  2.0));
+			vec3 b = Sample(vec2( 0.0,  2.0));
+			vec3 c = Sample(vec2( 2.0,  2.0));
+			vec3 d = Sample(vec2(-2.0,  0.0));
+			vec3 e = Sample(vec2( 0.0,  0.0));
+			vec3 f = Sample(vec2( 2.0,  0.0));
+			vec3 g = Sample(vec2(-2.0, -2.0));
+			vec3 h = Sample(vec2( 0.0, -2.0));
+			vec3 i = Sample(vec2( 2.0, -2.0));
+			vec3 j = Sample(vec2(-1.0,  1.0));
+			vec3 k = Sample(vec2( 1.0,  1.0));
+			vec3 l = Sample(vec2(-1.0, -1.0));
+			vec3 m = Sample(vec2( 1.0, -1.0));
+
+			vec3 color = e * 0.125;
+			color += (a + c + g + i) * 0.03125;
+			color += (b + d + f + h) * 0.0625;
+			color += (j + k + l + m) * 0.125;
+			FragColor = vec4(color, 1.0);
+		}
+
+	#endif
+#endif
+
+#ifdef BLOOM_UPSAMPLE
+
+	#if defined(VERTEX) ///////////////////////////////////////////////////
+
+	layout(location = 0) in vec3 aPosition;
+	layout(location = 1) in vec2 aTexCoord;
+
+	out vec2 vTexCoord;
+
+	void main()
+	{
+		vTexCoord = aTexCoord;
+		gl_Position = vec4(aPosition, 1.0);
+	}
+
+	#endif
+	#if defined(FRAGMENT) ///////////////////////////////////////////////////
+
+		out vec4 FragColor;
+
+		in vec2 vTexCoord;
+
+		// Base and max level are both the smaller source level, blended onto the one above
+		uniform sampler2D uSource;
+		uniform float uIntensity;
+
+		vec3 Sample(vec2 offset)
+		{
+			return textureLod(uSource, vTexCoord + offset / vec2(textureSize(uSource, 0)), 0.0).rgb;
+		}
+
+		// 3x3 tent, 9 bilinear taps
+		void main()
+		{
+			vec3 color = Sample(vec2(0.0)) * 4.0;
+			color += (Sample(vec2(-1.0, 0.0)) + Sample(vec2(1.0, 0.0)) + Sample(vec2(0.0, -1.0)) + Sample(vec2(0.0, 1.0))) * 2.0;
+			color += Sample(vec2(-1.0, -1.0)) + Sample(vec2(1.0, -1.0)) + Sample(vec2(-1.0, 1.0)) + Sample(vec2(1.0, 1.0));
+			FragColor = vec4(color * (uIntensity / 16.0), 1.0);
 		}
 
 	#endif
@@ -428,6 +1285,11 @@
 		reflectTexCoords.x = clamp(reflectTexCoords.x, 0.001, 0.999);
 		reflectTexCoords.y = clamp(reflectTexCoords.y, -0.999, 0.001);
 
+		// Only the viewport corner of the targets is rendered, the mirrored y wraps back into it
+		vec2 renderScale = uViewportSize / vec2(textureSize(uRefractionMap, 0));
+		refractTexCoords *= renderScale;
+		reflectTexCoords = vec2(reflectTexCoords.x, 1.0 + reflectTexCoords.y) * renderScale;
+
 		vec4 refractColor = texture(uRefractionMap, refractTexCoords);
 		vec4 reflectColor = texture(uReflectionMap, reflectTexCoords);
 